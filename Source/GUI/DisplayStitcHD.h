@@ -28,9 +28,14 @@ using namespace std;
 
 #include <QtGui/qmainwindow.h>
 #include <QtGui/qlabel.h>
+#include <QtGui/qimage.h>
+#include <QtGui/qpixmap.h>
 #include <Qt/qevent.h>
 #include <Qt/qcoreapplication.h>
 #include <QtGui/qscrollarea.h>
+#include <QtGui/qscrollbar.h>
+
+#include <opencv2/imgproc/imgproc.hpp>
 
 class DisplayStitcHD : public QMainWindow
 {
@@ -45,7 +50,8 @@ public:
 		config(config),
 		stitcher(config),
 		running(false),
-		saveNextFrame(false)
+		saveNextFrame(false),
+		zoom(1)
 	{
 		frame = new QLabel;
 		frame->setAlignment(Qt::AlignCenter);
@@ -55,6 +61,7 @@ public:
 		scroll->setWidgetResizable(true);
 		scroll->setAlignment(Qt::AlignCenter);
 		scroll->setWidget(frame);
+		scroll->viewport()->installEventFilter(this);
 
 		QBoxLayout *vBox = new QVBoxLayout;
 		QBoxLayout *hBox = new QHBoxLayout;
@@ -78,6 +85,9 @@ public:
 		latencyIndex = 0;
 
 		setWindowTitle("Display");
+
+		// The stitcher writes what's shown straight into image
+		stitcher.setDisplayTarget(imageBuffer, this);
 	}
 
 	~DisplayStitcHD()
@@ -107,10 +117,15 @@ protected:
 				cout << "ERROR: Can't stitch because the stitcher isn't running." << endl;
 			else
 			{
+				// Only the part of the canvas in the scroll area gets stitched
+				updateViewport();
+
+				if (saveNextFrame)
+					stitcher.requestFullFrame();
+
 				if (0 == stitcher.getImage())
 				{
-					frame->resize(qMax(stitcher.displayFrame.cols, scroll->width()), qMax(stitcher.displayFrame.rows, scroll->height()));
-					frame->setPixmap(Mat2QPixmap(stitcher.displayFrame));
+					showFrame();
 					if (saveNextFrame)
 					{
 						imwrite(pictureOutputFileName(), stitcher.displayFrame);
@@ -129,7 +144,25 @@ protected:
 					int latency = Timer::msTime(latencies[(latencyIndex + 1) % latencies.size()], latencies[latencyIndex]) / latencies.size();
 					latencyIndex = (latencyIndex + 1) % latencies.size();
 
-					stitchLatency->setText(QString("Stitch Latency: %1 ms").arg(latency));
+					QString text = QString("Stitch Latency: %1 ms").arg(latency);
+
+					const ImageStitcher::TileCounters& tiles = stitcher.tileCounters();
+					if (tiles.tiles > 0)
+						text += QString(", %1/%2 tiles reused").arg(tiles.reused).arg(tiles.tiles);
+
+					// Climbs only when the output geometry changes
+					text += QString(", %1 buffer allocations").arg(stitcher.stitchAllocations());
+
+					if (config.targetFrameTime > 0)
+					{
+						const QualityGovernor& governor = stitcher.qualityGovernor();
+						text += QString(", quality: %1 (%2 ms frames, %3 ms stitching)")
+							.arg(QualityGovernor::levelName(governor.getLevel()))
+							.arg(governor.averageFrameTime())
+							.arg(governor.averageStitchTime());
+					}
+
+					stitchLatency->setText(text);
 				}
 				else
 				{
@@ -165,16 +198,114 @@ protected:
 			saveNextFrame = true;
 			return true;
 		}
+		// Retry calibration lock event
+		else if (e->type() == QEvent::User + 6)
+		{
+			stitcher.retryCalibrationLock();
+			return true;
+		}
 		else
 			return QWidget::event(e);
 	}
 
+	// Ctrl + mouse wheel zooms out and back in
+	bool eventFilter(QObject* object, QEvent* e)
+	{
+		if (e->type() == QEvent::Wheel)
+		{
+			QWheelEvent* wheel = (QWheelEvent*)e;
+
+			if (wheel->modifiers() & Qt::ControlModifier)
+			{
+				// The stitcher renders down to 1/16 scale
+				zoom = qBound(1.0 / 16, wheel->delta() > 0 ? zoom * 1.25 : zoom * 0.8, 1.0);
+				return true;
+			}
+		}
+
+		return QMainWindow::eventFilter(object, e);
+	}
+
+	// The canvas area the scroll area shows, at the current zoom
+	void updateViewport()
+	{
+		QWidget* port = scroll->viewport();
+
+		view = Rect(
+			int(scroll->horizontalScrollBar()->value() / zoom),
+			int(scroll->verticalScrollBar()->value() / zoom),
+			int(port->width() / zoom) + 2,
+			int(port->height() / zoom) + 2);
+
+		stitcher.setViewport(view, zoom);
+	}
+
+	// Puts the stitched part of the canvas where it belongs in the scroll area
+	void showFrame()
+	{
+		Size canvas = stitcher.canvasSize;
+		Rect rect = stitcher.displayRect;
+		double scale = stitcher.displayScale;
+		Mat shown = stitcher.displayFrame;
+
+		// The recorder and snapshots get the whole canvas at full size
+		Rect visible = view & Rect(0, 0, canvas.width, canvas.height);
+		if (visible.area() > 0 && (rect != visible || scale != zoom))
+		{
+			Rect crop(cvFloor((visible.x - rect.x) * scale), cvFloor((visible.y - rect.y) * scale),
+				cvCeil(visible.width * scale), cvCeil(visible.height * scale));
+			crop &= Rect(0, 0, shown.cols, shown.rows);
+
+			Size size(max(1, cvRound(visible.width * zoom)), max(1, cvRound(visible.height * zoom)));
+			Mat scaled;
+			cv::resize(shown(crop), scaled, size, 0, 0, INTER_AREA);
+			shown = scaled;
+			rect = visible;
+		}
+
+		frame->setMinimumSize(cvRound(canvas.width * zoom), cvRound(canvas.height * zoom));
+
+		if (rect.width == canvas.width && rect.height == canvas.height)
+		{
+			// All of it fits
+			frame->setAlignment(Qt::AlignCenter);
+			frame->setContentsMargins(0, 0, 0, 0);
+		}
+		else
+		{
+			frame->setAlignment(Qt::AlignLeft | Qt::AlignTop);
+			frame->setContentsMargins(cvRound(rect.x * zoom), cvRound(rect.y * zoom), 0, 0);
+		}
+
+		if (stitcher.displayTargetWritten && shown.data == stitcher.displayFrame.data)
+			frame->setPixmap(QPixmap::fromImage(image));
+		else
+			frame->setPixmap(Mat2QPixmap(shown));
+	}
+
+	// The stitcher's display target, resized to whatever it stitches
+	static unsigned char* imageBuffer(void* context, Size size, int& step)
+	{
+		QImage& image = ((DisplayStitcHD*)context)->image;
+
+		if (image.width() != size.width || image.height() != size.height)
+			image = QImage(size.width, size.height, QImage::Format_RGB32);
+
+		step = image.bytesPerLine();
+		return image.bits();
+	}
+
 private:
 
 	bool running;
 	bool saveNextFrame;
 	Config& config;
+
+	// Display scale, and the canvas area last asked for
+	double zoom;
+	Rect view;
 	QLabel *frame;
+	QImage image;
 	QLabel *stitchLatency, *hmgLatency;
 	QScrollArea *scroll;
 
@@ -18,21 +18,17 @@ along with StitcHD.  If not, see <http://www.gnu.org/licenses/>.
 #include "MainWindow.h"
 #include "SettingsWindow.h"
 #include "DisplayCameras.h"
+#include "WarpKernels.hpp"
 
 #include <iostream>
 using namespace std;
 
 QPixmap Mat2QPixmap(const Mat3b mat)
 {
-	// From http://stackoverflow.com/questions/5026965/how-to-convert-an-opencv-cvmat-to-qimage
-	QImage qi(mat.cols, mat.rows, QImage::Format_ARGB32);
-    for (int y = 0; y < mat.rows; ++y) {
-            const cv::Vec3b *srcrow = mat[y];
-            QRgb *destrow = (QRgb*)qi.scanLine(y);
-            for (int x = 0; x < mat.cols; ++x) {
-                    destrow[x] = qRgba(srcrow[x][2], srcrow[x][1], srcrow[x][0], 255);
-            }
-    }
+	// Format_RGB32 holds B, G, R, 255, which a BGR row only needs widening to
+	QImage qi(mat.cols, mat.rows, QImage::Format_RGB32);
+	for (int y = 0; y < mat.rows; ++y)
+		WarpKernels::packBgrx(mat.ptr(y), mat.cols, qi.scanLine(y));
 
 	QPixmap qp;
 	qp.convertFromImage(qi);
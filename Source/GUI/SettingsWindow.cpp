@@ -83,6 +83,20 @@ QGroupBox* SettingsWindow::buildStitcherSettings()
 	alphaBlendGroup->addButton(radioButton, 3);
 	row->addWidget(radioButton);
 
+	radioButton = new QRadioButton("Multi-band", this);
+	radioButton->setToolTip("<p>Multi-band Blending</p> \
+		  <p>In overlap regions, the stitcher blends coarse detail over a wide area and fine detail over a narrow one, hiding exposure differences without ghosting. CPU stitching only.</p>");
+	radioButton->setChecked(config->alphaBlend == 4);
+	alphaBlendGroup->addButton(radioButton, 4);
+	row->addWidget(radioButton);
+
+	radioButton = new QRadioButton("Seam cut", this);
+	radioButton->setToolTip("<p>Seam Cut Blending</p> \
+		  <p>In overlap regions, each pixel comes from one image, cut along the path where the images differ least, with a narrow blend across the cut. The cut is found in the background and moves when the scene does. CPU stitching only.</p>");
+	radioButton->setChecked(config->alphaBlend == 5);
+	alphaBlendGroup->addButton(radioButton, 5);
+	row->addWidget(radioButton);
+
 	grid->addLayout(row, index, 1);
 	
 	connect(alphaBlendGroup, SIGNAL(buttonClicked(int)), this, SLOT(alphaBlendChanged(int)));
@@ -113,6 +127,40 @@ QGroupBox* SettingsWindow::buildStitcherSettings()
 	connect(expBlendSlider, SIGNAL(sliderMoved(int)), this, SLOT(expBlendChanged(int)));
 	index++;
 
+	// Projection radio buttons
+	label = new QLabel("Projection:");
+	label->setToolTip("<p>Choose the surface the frames are stitched onto.</p>");
+	grid->addWidget(label, index, 0);
+
+	projectionGroup = new QButtonGroup;
+	row = new QBoxLayout(QBoxLayout::LeftToRight);
+
+	radioButton = new QRadioButton("Planar", this);
+	radioButton->setToolTip("<p>Planar Projection</p> \
+		  <p>The frames are stitched onto the first camera's image plane. Frames far off to the side get stretched.</p>");
+	radioButton->setChecked(config->projection == 0);
+	projectionGroup->addButton(radioButton, 0);
+	row->addWidget(radioButton);
+
+	radioButton = new QRadioButton("Cylindrical", this);
+	radioButton->setToolTip("<p>Cylindrical Projection</p> \
+		  <p>The frames are stitched onto a cylinder around the first camera. Suits wide horizontal rigs.</p>");
+	radioButton->setChecked(config->projection == 1);
+	projectionGroup->addButton(radioButton, 1);
+	row->addWidget(radioButton);
+
+	radioButton = new QRadioButton("Spherical", this);
+	radioButton->setToolTip("<p>Spherical Projection</p> \
+		  <p>The frames are stitched onto a sphere around the first camera. Suits rigs which are wide both ways.</p>");
+	radioButton->setChecked(config->projection == 2);
+	projectionGroup->addButton(radioButton, 2);
+	row->addWidget(radioButton);
+
+	grid->addLayout(row, index, 1);
+
+	connect(projectionGroup, SIGNAL(buttonClicked(int)), this, SLOT(projectionChanged(int)));
+	index++;
+
 	// Tint slider
 	tip = "<p>Frame Tint</p> \
 		  <p>Helps to delineate the frames from one another.</p>";
@@ -692,6 +740,11 @@ SettingsWindow::SettingsWindow(QWidget *parent, Config* config)
 	connect(recordButton, SIGNAL(clicked()), this, SLOT(toggleRecording()));
 	hBox->addWidget(recordButton);
 
+	lockButton = new QPushButton(config->lockCalibration ? "Cancel Lock" : "Lock Calibration");
+	lockButton->setToolTip("<p>Once the cameras are mounted, freezes the homographies, stops the homographiers and stitches from a precompiled plan. The lock waits for the homographies to settle.</p>");
+	connect(lockButton, SIGNAL(clicked()), this, SLOT(toggleCalibrationLock()));
+	hBox->addWidget(lockButton);
+
 	mainLayout->addLayout(hBox);
 
 	QWidget *centralWidget = new QWidget;
@@ -730,6 +783,11 @@ void SettingsWindow::expBlendChanged(int value)
 	expBlendLabel->setText(QString("%1%").arg(value));
 }
 
+void SettingsWindow::projectionChanged(int value)
+{
+	config->projection = value;
+}
+
 void SettingsWindow::frameTintChanged(int value)
 {
 	config->frameTint = value;
@@ -860,6 +918,9 @@ void SettingsWindow::setDefaults()
 
 	expBlendSlider->setValue(def.expBlendValue);
 	expBlendChanged(def.expBlendValue);
+
+	projectionGroup->button(def.projection)->setChecked(true);
+	projectionChanged(def.projection);
 	tintSlider->setValue(def.frameTint);
 	frameTintChanged(def.frameTint);
 	maxTintBox->setChecked(def.maxTint);
@@ -920,4 +981,29 @@ void SettingsWindow::toggleRecording()
 	}
 
 	recording = !recording;
+}
+
+void SettingsWindow::toggleCalibrationLock()
+{
+	// Tell the displayWindow to try again if a lock failed, otherwise lock,
+	// cancel a pending lock or unlock. The stitcher picks it up on its next
+	// frame, and the button follows.
+	if (config->lockCalibration && displayWindow->stitcher.calibrationLockFailed())
+		QCoreApplication::postEvent(displayWindow, new QEvent(QEvent::Type(QEvent::User + 6)), Qt::LowEventPriority);
+	else
+		config->lockCalibration = !config->lockCalibration;
+
+	updateLockButton();
+}
+
+void SettingsWindow::updateLockButton()
+{
+	const VideoStitcher& stitcher = displayWindow->stitcher;
+
+	if (stitcher.calibrationLocked())
+		lockButton->setText("Unlock Calibration");
+	else if (config->lockCalibration && !stitcher.calibrationLockFailed())
+		lockButton->setText("Cancel Lock");
+	else
+		lockButton->setText("Lock Calibration");
 }
\ No newline at end of file
@@ -60,6 +60,7 @@ public slots:
 	void interpolationChanged(int);
 	void alphaBlendChanged(int);
 	void expBlendChanged(int);
+	void projectionChanged(int);
 	void frameTintChanged(int);
 	void maxTintChanged(int);
 	
@@ -86,6 +87,7 @@ public slots:
 	void setDefaults();
 	void saveFrame();
 	void toggleRecording();
+	void toggleCalibrationLock();
 
 protected:
 
@@ -96,6 +98,9 @@ protected:
 
 		if (running && e->type() == QEvent::User)
 		{
+			// Show whether the stitcher actually locked
+			updateLockButton();
+
 			// Tell the stitcher to start up again
 			QCoreApplication::postEvent(displayWindow, new QEvent(QEvent::User), Qt::LowEventPriority);
 			return true;
@@ -108,7 +113,7 @@ private:
 	bool running;
 	bool recording;
 
-	QButtonGroup *alphaBlendGroup, *flannOptGroup;
+	QButtonGroup *alphaBlendGroup, *projectionGroup, *flannOptGroup;
 	QCheckBox *interpolationBox, *maxTintBox,
 		*extendedBox, *uprightBox, *showHmgMatchesBox, *showFpsBox;
 	QSlider *expBlendSlider, *tintSlider, *hmgOverlapSlider,
@@ -119,7 +124,7 @@ private:
 		*hmgAlphaLabel, *hessianLabel, *flannPrecisionLabel, *flannBuildLabel,
 		*flannMemoryLabel, *flannFracLabel, *toleranceLabel, *ransacLabel;
 	QSpinBox *hessianBox, *nOctaveBox, *nOctaveLayerBox, *flannChecksBox, *flannTreesBox;
-	QPushButton *setDefaultsButton, *saveFrameButton, *recordButton;
+	QPushButton *setDefaultsButton, *saveFrameButton, *recordButton, *lockButton;
 
 	DisplayStitcHD *displayWindow;
 
@@ -129,6 +134,9 @@ private:
 	QGroupBox* buildMatchSettings();
 	QGroupBox* buildHmgSettings();
 
+	// Labels lockButton with what a click would do
+	void updateLockButton();
+
 };
 
 #endif
\ No newline at end of file
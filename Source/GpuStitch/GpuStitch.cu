@@ -44,6 +44,9 @@ namespace GpuStitch
 
 	const int MaxFrames = 4;
 
+	// How many frame sizes the canvas may extend beyond the first frame
+	const int MaxCanvasReach = 2;
+
 	// Used in device threads to transform a point using a homography
 	__device__
 	void applyHomographyToPoint(const int& x0, const int& y0,
@@ -68,7 +71,7 @@ namespace GpuStitch
 	}
 
 	// Find the distance between two points
-	__device__
+	__host__ __device__
 	float getDistance(const int& x1, const int& y1,
 		const int& x2, const int& y2)
 	{
@@ -95,23 +98,21 @@ namespace GpuStitch
 		}
 	}
 
-	// Adds the value of a frame at a certain point on the canvas to the current RGB values at that point
+	// Adds the value of a frame at frame coordinates (tX, tY) to the current RGB values
 	// Returns the multiplier for that point - depends on alpha blending
+	template <bool Interpolate>
 	__device__
 	float addFrameToPixel(int& val1, int& val2, int& val3,
-		const int& x, const int& y,
-		const DevMem2D_<Tpixel>& src, const DevMem2D_<Thmg>& hmg,
+		const float& tX, const float& tY,
+		const DevMem2D_<Tpixel>& src,
+		const DevMem2D_<float>& weights, const bool& weighted,
 		const StitchParams& params)
 	{
-		// Transform the pixel indices using the homography
-		float tX, tY;
-		applyHomographyToPoint(x, y, hmg, tX, tY);
-		
 		// Round them down to the nearest int
 		int tXi = round(tX);
 		int tYi = round(tY);
 
-		if (!params.interpolate)
+		if (!Interpolate)
 		{
 			if (tXi < 1 || tXi >= src.cols || tYi < 1 || tYi >= src.rows)
 				return 0;
@@ -123,21 +124,10 @@ namespace GpuStitch
 		}
 		
 		float rc;
-		if (params.alphaBlend == 2)
+		if (weighted)
 		{
-			// Linear blending
-			rc = 1.0 - getDistance(tX, tY, src.cols / 2, src.rows / 2) / getDistance(0, 0, src.cols / 2, src.rows / 2);
-		}
-		else if (params.alphaBlend == 3)
-		{
-			// Exponential decay blending
-
-			//		Get the Distance
-			rc = getDistance(tX, tY, src.cols / 2, src.rows / 2) / getDistance(0, 0, src.cols / 2, src.rows / 2);
-			//		Find the exponent
-			rc = -(34.0 * params.expBlendValue + 100.0) * (rc - 0.5) / 50.0 - 1.0;
-			//		Calculate the exponential
-			rc = powf(10, rc);
+			// Linear or exponential blending, precomputed for each source pixel
+			rc = weights.ptr(int(tY))[int(tX)];
 		}
 		else
 		{
@@ -145,7 +135,7 @@ namespace GpuStitch
 			rc = 1.0;
 		}
 
-		if (!params.interpolate)
+		if (!Interpolate)
 		{
 			val1 += src.ptr(tYi)[tXi * CHANNELS];
 			val2 += src.ptr(tYi)[tXi * CHANNELS + 1];
@@ -211,11 +201,25 @@ namespace GpuStitch
 		}
 	}
 
-	// This is the entry point for the GPU - the kernel
+	// How frames are tinted
+	enum TintMode
+	{
+		NoTint,			// shift is 0
+		ShiftTint,		// shift is added to one channel of frames 1-3
+		HardTint		// hardShift paints each frame a solid colour
+	};
+
+	// This is the entry point for the GPU - the kernel. Everything that is the
+	// same for the whole frame is a template argument, so that none of it is
+	// tested per pixel; selectKernel() picks the instance once per frame.
+	template <int NumFrames, int AlphaBlend, bool Interpolate, int Tint>
 	__global__
-	void stitch_kernel(const int numFrames,
+	void stitch_kernel(
 		DevMem2D_<Tpixel> const * const matSrc,
 		DevMem2D_<Thmg> const * const matHmg,
+		DevMem2D_<float2> const * const matMaps,
+		DevMem2D_<float> const * const matWeights,
+		const DevMem2D_<int> matSpans,
 		DevMem2D_<Tpixel> matDst,
 		const StitchParams params)
 	{
@@ -233,14 +237,42 @@ namespace GpuStitch
 			float multiplier = 0.0;
 			float midV1=0, midV2=0, midV3=0;
 
-			for (int i=0; i<numFrames; i++)
+			// The columns each frame can reach on this row
+			const int* spans = matSpans.ptr(y);
+
+			// Where at most one frame reaches, its weight divides back out
+			int covering = 0;
+#pragma unroll
+			for (int i=0; i<NumFrames; i++)
+				if (x >= spans[2*i] && x < spans[2*i + 1])
+					covering++;
+
+			bool weighted = (AlphaBlend == 2 || AlphaBlend == 3) && covering > 1;
+
+#pragma unroll
+			for (int i=0; i<NumFrames; i++)
 			{
+				if (x < spans[2*i] || x >= spans[2*i + 1])
+					continue;
+
+				// Curved canvases look their frame coordinates up
+				float tX, tY;
+				if (params.projection == 0)
+					applyHomographyToPoint(x, y, matHmg[i], tX, tY);
+				else
+				{
+					float2 t = matMaps[i].ptr(y)[x];
+					tX = t.x;
+					tY = t.y;
+				}
+
 				int v1=0, v2=0, v3=0;
-				float m = addFrameToPixel(v1, v2, v3, x, y, matSrc[i], matHmg[i], params);
+				float m = addFrameToPixel<Interpolate>(v1, v2, v3, tX, tY, matSrc[i], matWeights[i], weighted, params);
 
 				if (m > 0.0)
 				{
-					if (params.hardShift)
+					// i is a constant in the unrolled loop, so this folds away
+					if (Tint == HardTint)
 					{
 						switch (i)
 						{
@@ -262,9 +294,17 @@ namespace GpuStitch
 					}
 					else
 					{
-						if (i == 1) v3 += params.shift;
-						if (i == 2) v2 += params.shift;
-						if (i == 3) v1 += params.shift;
+						// Exposure compensation, 1 unless the Homographiers measured otherwise
+						v1 = int(v1 * params.gains[i][0] + 0.5f);
+						v2 = int(v2 * params.gains[i][1] + 0.5f);
+						v3 = int(v3 * params.gains[i][2] + 0.5f);
+
+						if (Tint == ShiftTint)
+						{
+							if (i == 1) v3 += params.shift;
+							if (i == 2) v2 += params.shift;
+							if (i == 3) v1 += params.shift;
+						}
 					}
 
 					midV1 += m * v1;
@@ -274,7 +314,7 @@ namespace GpuStitch
 					multiplier += m;
 					//multiplier += 1.0;
 
-					if (params.alphaBlend == 0)
+					if (AlphaBlend == 0)
 						break;
 				}
 			}
@@ -300,6 +340,65 @@ namespace GpuStitch
 		}
 	}
 
+	typedef void (*StitchKernel)(
+		DevMem2D_<Tpixel> const * const,
+		DevMem2D_<Thmg> const * const,
+		DevMem2D_<float2> const * const,
+		DevMem2D_<float> const * const,
+		const DevMem2D_<int>,
+		DevMem2D_<Tpixel>,
+		const StitchParams);
+
+	// The kernel table, one level of template arguments at a time
+
+	template <int NumFrames, int AlphaBlend, bool Interpolate>
+	__host__
+	StitchKernel selectTint(int tint)
+	{
+		switch (tint)
+		{
+		case HardTint:	return stitch_kernel<NumFrames, AlphaBlend, Interpolate, HardTint>;
+		case ShiftTint:	return stitch_kernel<NumFrames, AlphaBlend, Interpolate, ShiftTint>;
+		default:		return stitch_kernel<NumFrames, AlphaBlend, Interpolate, NoTint>;
+		}
+	}
+
+	template <int NumFrames, int AlphaBlend>
+	__host__
+	StitchKernel selectInterpolate(bool interpolate, int tint)
+	{
+		if (interpolate)
+			return selectTint<NumFrames, AlphaBlend, true>(tint);
+		else
+			return selectTint<NumFrames, AlphaBlend, false>(tint);
+	}
+
+	template <int NumFrames>
+	__host__
+	StitchKernel selectBlend(int alphaBlend, bool interpolate, int tint)
+	{
+		switch (alphaBlend)
+		{
+		case 0:		return selectInterpolate<NumFrames, 0>(interpolate, tint);
+		case 2:		return selectInterpolate<NumFrames, 2>(interpolate, tint);
+		case 3:		return selectInterpolate<NumFrames, 3>(interpolate, tint);
+		default:	return selectInterpolate<NumFrames, 1>(interpolate, tint);	// Average
+		}
+	}
+
+	__host__
+	StitchKernel selectKernel(int numFrames, const StitchParams& params)
+	{
+		int tint = params.hardShift ? HardTint : (params.shift != 0 ? ShiftTint : NoTint);
+
+		switch (numFrames)
+		{
+		case 2:		return selectBlend<2>(params.alphaBlend, params.interpolate, tint);
+		case 3:		return selectBlend<3>(params.alphaBlend, params.interpolate, tint);
+		default:	return selectBlend<4>(params.alphaBlend, params.interpolate, tint);
+		}
+	}
+
 	// Helpful function to check to see if a Cuda error has occurred
 	__host__
 	bool checkForCudaError(char* message)
@@ -312,16 +411,513 @@ namespace GpuStitch
 		return false;
 	}
 
-	// Used in host thread to transform a point using a homography
+	// Bounding box of every frame's corners projected onto the first frame
+	__host__
+	Rect canvasExtent(const vector<Mat>& matSrc, const vector<Mat>& matHmg)
+	{
+		// A frame seen at a grazing angle can project almost to infinity,
+		// so the canvas is capped a few frames beyond the first
+		double limitX = MaxCanvasReach * matSrc[0].cols;
+		double limitY = MaxCanvasReach * matSrc[0].rows;
+
+		double minX = 0;
+		double minY = 0;
+		double maxX = matSrc[0].cols - 1;
+		double maxY = matSrc[0].rows - 1;
+
+		for (int i=1; i<matSrc.size(); i++)
+		{
+			Mat inv = matHmg[i].inv();
+
+			int cornersX[4] = { 0, matSrc[i].cols - 1, 0, matSrc[i].cols - 1 };
+			int cornersY[4] = { 0, 0, matSrc[i].rows - 1, matSrc[i].rows - 1 };
+
+			for (int j=0; j<4; j++)
+			{
+				double z = inv.at<double>(2, 0) * cornersX[j] + inv.at<double>(2, 1) * cornersY[j] + inv.at<double>(2, 2);
+
+				if (z <= 0)
+				{
+					// Beyond the horizon
+					minX = -limitX;
+					minY = -limitY;
+					maxX = matSrc[0].cols - 1 + limitX;
+					maxY = matSrc[0].rows - 1 + limitY;
+					continue;
+				}
+
+				double x = (inv.at<double>(0, 0) * cornersX[j] + inv.at<double>(0, 1) * cornersY[j] + inv.at<double>(0, 2)) / z;
+				double y = (inv.at<double>(1, 0) * cornersX[j] + inv.at<double>(1, 1) * cornersY[j] + inv.at<double>(1, 2)) / z;
+
+				minX = min(minX, x);
+				minY = min(minY, y);
+				maxX = max(maxX, x);
+				maxY = max(maxY, y);
+			}
+		}
+
+		int left = cvFloor(max(minX, -limitX));
+		int top = cvFloor(max(minY, -limitY));
+		int right = cvCeil(min(maxX, matSrc[0].cols - 1 + limitX));
+		int bottom = cvCeil(min(maxY, matSrc[0].rows - 1 + limitY));
+
+		return Rect(left, top, right - left + 1, bottom - top + 1);
+	}
+
+	// The linear or exponential blend weight of every pixel in a frame of size src.
+	// Same formula addFrameToPixel used to evaluate per pixel.
+	__host__
+	void buildWeightTable(Mat& table, Size src, const StitchParams& params)
+	{
+		table.create(src, CV_32FC1);
+
+		float maxDistance = getDistance(0, 0, src.width / 2, src.height / 2);
+
+		for (int y=0; y<src.height; y++)
+		{
+			float* row = table.ptr<float>(y);
+
+			for (int x=0; x<src.width; x++)
+			{
+				float rc = getDistance(x, y, src.width / 2, src.height / 2) / maxDistance;
+
+				if (params.alphaBlend == 2)
+				{
+					// Linear blending
+					rc = 1.0 - rc;
+				}
+				else
+				{
+					// Exponential decay blending
+					rc = -(34.0 * params.expBlendValue + 100.0) * (rc - 0.5) / 50.0 - 1.0;
+					rc = powf(10, rc);
+				}
+
+				row[x] = rc;
+			}
+		}
+	}
+
+	// The weight tables on the device, rebuilt only when a frame size or the blend settings change
+	struct WeightTable
+	{
+		WeightTable() : size(0, 0), alphaBlend(-1), expBlendValue(-1) {}
+
+		Size size;
+		int alphaBlend;
+		float expBlendValue;
+		GpuMat weights;
+	};
+
+	__host__
+	const GpuMat& weightTable(int frame, Size src, const StitchParams& params)
+	{
+		static WeightTable tables[MaxFrames];
+		WeightTable& table = tables[frame];
+
+		bool weighted = params.alphaBlend == 2 || params.alphaBlend == 3;
+
+		if (weighted && (table.size != src || table.alphaBlend != params.alphaBlend
+			|| (params.alphaBlend == 3 && table.expBlendValue != params.expBlendValue)))
+		{
+			Mat weights;
+			buildWeightTable(weights, src, params);
+			table.weights.upload(weights);
+
+			table.size = src;
+			table.alphaBlend = params.alphaBlend;
+			table.expBlendValue = params.expBlendValue;
+		}
+
+		return table.weights;
+	}
+
+	// The columns [begin, end) of canvas row y that homography h can map into
+	// a frame of size src. Errs on the wide side, addFrameToPixel tests every pixel.
+	__host__
+	bool rowSpan(const Mat& h, Size src, int y, int width, int& begin, int& end)
+	{
+		// Along the row each condition on the source coordinates is linear in x:
+		// z > 0, 0.5 <= X/z < cols - 0.5 and 0.5 <= Y/z < rows - 0.5
+		double x0 = h.at<double>(0, 1) * y + h.at<double>(0, 2);
+		double y0 = h.at<double>(1, 1) * y + h.at<double>(1, 2);
+		double z0 = h.at<double>(2, 1) * y + h.at<double>(2, 2);
+		double dx = h.at<double>(0, 0);
+		double dy = h.at<double>(1, 0);
+		double dz = h.at<double>(2, 0);
+
+		// Each condition is slope * x + offset >= 0
+		double slopes[5] = {
+			dz,
+			dx - 0.5 * dz,
+			(src.width - 0.5) * dz - dx,
+			dy - 0.5 * dz,
+			(src.height - 0.5) * dz - dy
+		};
+		double offsets[5] = {
+			z0,
+			x0 - 0.5 * z0,
+			(src.width - 0.5) * z0 - x0,
+			y0 - 0.5 * z0,
+			(src.height - 0.5) * z0 - y0
+		};
+
+		double lo = 0;
+		double hi = width - 1;
+
+		for (int i=0; i<5; i++)
+		{
+			if (slopes[i] > 0)
+				lo = max(lo, -offsets[i] / slopes[i]);
+			else if (slopes[i] < 0)
+				hi = min(hi, -offsets[i] / slopes[i]);
+			else if (offsets[i] < 0)
+				return false;
+		}
+
+		if (lo > hi)
+			return false;
+
+		// A pixel of slack on each side for float rounding on the device
+		begin = max(0, cvFloor(lo) - 1);
+		end = min(width, cvCeil(hi) + 2);
+
+		return begin < end;
+	}
+
+	// Furthest a curved canvas reaches from the first camera's axis
+	const double MaxAngle = 85.0 * CV_PI / 180.0;
+
+	// Where a cylindrical or spherical canvas sits relative to the first frame
+	struct CurvedCanvas
+	{
+		int projection;
+		double focal;
+		Point2d center;		// Principal point of the first frame
+		Point2d offset;		// Projected coordinates of canvas pixel (0, 0)
+		double scale;		// Rendered pixels per canvas pixel
+	};
+
+	// The point on the first frame's plane which canvas pixel (u, v) shows
+	__host__
+	bool toPlane(const CurvedCanvas& canvas, double u, double v, double& x, double& y)
+	{
+		double theta = (u + canvas.offset.x - canvas.center.x) / canvas.focal;
+		double height = (v + canvas.offset.y - canvas.center.y) / canvas.focal;
+
+		if (fabs(theta) > MaxAngle)
+			return false;
+
+		if (canvas.projection == 1)
+		{
+			// Cylindrical
+			x = canvas.center.x + canvas.focal * tan(theta);
+			y = canvas.center.y + canvas.focal * height / cos(theta);
+			return true;
+		}
+
+		// Spherical
+		if (fabs(height) > MaxAngle)
+			return false;
+
+		x = canvas.center.x + canvas.focal * tan(theta);
+		y = canvas.center.y + canvas.focal * tan(height) / cos(theta);
+		return true;
+	}
+
+	// Projected coordinates of a point on the first frame's plane, without the offset
+	__host__
+	void fromPlane(const CurvedCanvas& canvas, double x, double y, double& u, double& v)
+	{
+		double pX = (x - canvas.center.x) / canvas.focal;
+		double pY = (y - canvas.center.y) / canvas.focal;
+		double radius = sqrt(1 + pX * pX);
+
+		u = canvas.center.x + canvas.focal * atan(pX);
+
+		if (canvas.projection == 1)
+			v = canvas.center.y + canvas.focal * pY / radius;
+		else
+			v = canvas.center.y + canvas.focal * atan2(pY, radius);
+	}
+
+	// Bounding box of every frame's edges on a curved canvas
+	__host__
+	Rect projectedExtent(const vector<Mat>& matSrc, const vector<Mat>& matHmg, const CurvedCanvas& canvas)
+	{
+		const int edgeSamples = 16;
+
+		double reach = canvas.focal * MaxAngle;
+		double limitU0 = canvas.center.x - reach;
+		double limitU1 = canvas.center.x + reach;
+		double limitV0 = -MaxCanvasReach * matSrc[0].rows;
+		double limitV1 = matSrc[0].rows - 1 + MaxCanvasReach * matSrc[0].rows;
+
+		if (canvas.projection == 2)
+		{
+			limitV0 = max(limitV0, canvas.center.y - reach);
+			limitV1 = min(limitV1, canvas.center.y + reach);
+		}
+
+		double minU = limitU1;
+		double minV = limitV1;
+		double maxU = limitU0;
+		double maxV = limitV0;
+
+		for (int i=0; i<matSrc.size(); i++)
+		{
+			Mat inv = matHmg[i].inv();
+
+			for (int j=0; j<4*edgeSamples; j++)
+			{
+				// Walk round the frame's edges
+				int edge = j / edgeSamples;
+				double t = double(j % edgeSamples) / edgeSamples;
+				double w = matSrc[i].cols - 1;
+				double h = matSrc[i].rows - 1;
+
+				double pX, pY;
+				switch (edge)
+				{
+				case 0: pX = t * w; pY = 0; break;
+				case 1: pX = w; pY = t * h; break;
+				case 2: pX = (1 - t) * w; pY = h; break;
+				default: pX = 0; pY = (1 - t) * h; break;
+				}
+
+				double z = inv.at<double>(2, 0) * pX + inv.at<double>(2, 1) * pY + inv.at<double>(2, 2);
+
+				if (z <= 0)
+				{
+					// Beyond the horizon
+					minU = limitU0;
+					minV = limitV0;
+					maxU = limitU1;
+					maxV = limitV1;
+					continue;
+				}
+
+				double x = (inv.at<double>(0, 0) * pX + inv.at<double>(0, 1) * pY + inv.at<double>(0, 2)) / z;
+				double y = (inv.at<double>(1, 0) * pX + inv.at<double>(1, 1) * pY + inv.at<double>(1, 2)) / z;
+
+				double u, v;
+				fromPlane(canvas, x, y, u, v);
+
+				minU = min(minU, u);
+				minV = min(minV, v);
+				maxU = max(maxU, u);
+				maxV = max(maxV, v);
+			}
+		}
+
+		int left = cvFloor(max(minU, limitU0));
+		int top = cvFloor(max(minV, limitV0));
+		int right = cvCeil(min(maxU, limitU1));
+		int bottom = cvCeil(min(maxV, limitV1));
+
+		return Rect(left, top, right - left + 1, bottom - top + 1);
+	}
+
+	// Frame coordinates of every pixel of a curved canvas, (-1, -1) where the frame
+	// can't be seen, and per row the [begin, end) columns it can be sampled in
+	__host__
+	void buildMapTable(Mat& map, Mat& spans, const Mat& hmg, Size src, Size canvasSize, const CurvedCanvas& canvas)
+	{
+		map.create(canvasSize, CV_32FC2);
+		spans.create(canvasSize.height, 2, CV_32SC1);
+
+		for (int r=0; r<canvasSize.height; r++)
+		{
+			Point2f* mapRow = map.ptr<Point2f>(r);
+			int* span = spans.ptr<int>(r);
+			span[0] = canvasSize.width;
+			span[1] = 0;
+
+			for (int c=0; c<canvasSize.width; c++)
+			{
+				double x, y;
+				double z = 0;
+
+				if (toPlane(canvas, c / canvas.scale, r / canvas.scale, x, y))
+					z = hmg.at<double>(2, 0) * x + hmg.at<double>(2, 1) * y + hmg.at<double>(2, 2);
+
+				if (z <= 0)
+				{
+					mapRow[c] = Point2f(-1, -1);
+					continue;
+				}
+
+				float tX = (hmg.at<double>(0, 0) * x + hmg.at<double>(0, 1) * y + hmg.at<double>(0, 2)) / z;
+				float tY = (hmg.at<double>(1, 0) * x + hmg.at<double>(1, 1) * y + hmg.at<double>(1, 2)) / z;
+				mapRow[c] = Point2f(tX, tY);
+
+				// Wide of addFrameToPixel's test
+				if (tX >= 0 && tX < src.width && tY >= 0 && tY < src.height)
+				{
+					span[0] = min(span[0], c);
+					span[1] = c + 1;
+				}
+			}
+
+			if (span[0] >= span[1])
+			{
+				span[0] = 0;
+				span[1] = 0;
+			}
+		}
+	}
+
+	// The map tables on the device, rebuilt only when the homographies or the canvas change
+	struct MapTable
+	{
+		MapTable() : src(0, 0), canvasSize(0, 0) { canvas.projection = 0; canvas.scale = 1; }
+
+		Mat hmg;
+		Size src;
+		Size canvasSize;
+		CurvedCanvas canvas;
+		Mat spans;
+		GpuMat map;
+	};
+
+	__host__
+	bool sameTable(const MapTable& table, const Mat& hmg, Size src, Size canvasSize, const CurvedCanvas& canvas)
+	{
+		if (table.src != src || table.canvasSize != canvasSize || table.hmg.empty())
+			return false;
+
+		if (table.canvas.projection != canvas.projection || table.canvas.focal != canvas.focal
+			|| table.canvas.center != canvas.center || table.canvas.offset != canvas.offset
+			|| table.canvas.scale != canvas.scale)
+			return false;
+
+		for (int r=0; r<3; r++)
+			for (int c=0; c<3; c++)
+				if (table.hmg.at<double>(r, c) != hmg.at<double>(r, c))
+					return false;
+
+		return true;
+	}
+
+	__host__
+	const MapTable& mapTable(int frame, const Mat& hmg, Size src, Size canvasSize, const CurvedCanvas& canvas)
+	{
+		static MapTable tables[MaxFrames];
+		MapTable& table = tables[frame];
+
+		if (!sameTable(table, hmg, src, canvasSize, canvas))
+		{
+			Mat map;
+			buildMapTable(map, table.spans, hmg, src, canvasSize, canvas);
+			table.map.upload(map);
+
+			hmg.copyTo(table.hmg);
+			table.src = src;
+			table.canvasSize = canvasSize;
+			table.canvas = canvas;
+		}
+
+		return table;
+	}
+
+	// Device headers of every frame's source, homography, map and weights
+	struct FrameTables
+	{
+		DevMem2D_<Tpixel> src[MAX_CAMERAS];
+		DevMem2D_<Thmg> hmg[MAX_CAMERAS];
+		DevMem2D_<float2> map[MAX_CAMERAS];
+		DevMem2D_<float> weight[MAX_CAMERAS];
+	};
+
+	// Everything stitch_gpu writes each frame, kept between frames so that
+	// nothing is allocated while the frame and view sizes stay the same
+	struct StitchBuffers
+	{
+		StitchBuffers() : tables_d(NULL), outputIndex(0)
+		{
+			for (int i=0; i<2; i++)
+			{
+				pinned[i] = NULL;
+				pinnedSize[i] = 0;
+			}
+		}
+
+		GpuMat dst;
+		Mat spans;
+		GpuMat spansDev;
+		GpuMat src[MaxFrames];
+		Mat hmg[MaxFrames];
+		GpuMat hmgDev[MaxFrames];
+		FrameTables* tables_d;
+
+		// The output is double-buffered in page-locked memory, so the frame
+		// handed out last stays intact while the next one is downloaded
+		void* pinned[2];
+		size_t pinnedSize[2];
+		Mat output[2];
+		int outputIndex;
+	};
+
+	static int allocationCount = 0;
+
+	__host__
+	int allocations()
+	{
+		return allocationCount;
+	}
+
+	// Gives m the size and type, counting it if that takes reallocating
+	__host__
+	void ensure(GpuMat& m, int rows, int cols, int type)
+	{
+		if (m.empty() || m.rows != rows || m.cols != cols || m.type() != type)
+		{
+			m.create(rows, cols, type);
+			allocationCount++;
+		}
+	}
+
+	__host__
+	void ensure(Mat& m, int rows, int cols, int type)
+	{
+		if (m.empty() || m.rows != rows || m.cols != cols || m.type() != type)
+		{
+			m.create(rows, cols, type);
+			allocationCount++;
+		}
+	}
+
+	// The next output buffer, reallocated only if it is too small
 	__host__
-	Point applyHomographyToPoint(int x, int y, Mat &homography)
-	{
-		Point point;
-		double z = (homography.at<double>(2, 0) * x + homography.at<double>(2, 1) * y + homography.at<double>(2, 2));
-		double scale = 1./z;
-		point.x = cvRound((homography.at<double>(0, 0) * x + homography.at<double>(0, 1) * y + homography.at<double>(0, 2)) * scale);
-		point.y = cvRound((homography.at<double>(1, 0) * x + homography.at<double>(1, 1) * y + homography.at<double>(1, 2)) * scale);
-		return point;
+	Mat* outputBuffer(StitchBuffers& buffers, Size size)
+	{
+		buffers.outputIndex = (buffers.outputIndex + 1) % 2;
+		int i = buffers.outputIndex;
+
+		size_t needed = size.width * CHANNELS * size.height;
+
+		if (needed > buffers.pinnedSize[i])
+		{
+			if (buffers.pinned[i] != NULL)
+				cudaFreeHost(buffers.pinned[i]);
+
+			buffers.pinned[i] = NULL;
+			buffers.pinnedSize[i] = 0;
+
+			cudaMallocHost(&buffers.pinned[i], needed);
+			allocationCount++;
+
+			if (checkForCudaError("cudaMallocHost"))
+			{
+				buffers.pinned[i] = NULL;
+				return NULL;
+			}
+
+			buffers.pinnedSize[i] = needed;
+		}
+
+		buffers.output[i] = Mat(size.height, size.width, CV_8UC3, buffers.pinned[i]);
+		return &buffers.output[i];
 	}
 
 	__host__
@@ -329,6 +925,22 @@ namespace GpuStitch
 		vector<Mat> matSrc,
 		vector<Mat> matHmg,
 		StitchParams params)
+	{
+		Rect view;
+		double scale = 1;
+		Size canvasSize;
+
+		return stitch_gpu(matSrc, matHmg, params, view, scale, canvasSize);
+	}
+
+	__host__
+	Mat stitch_gpu(
+		vector<Mat> matSrc,
+		vector<Mat> matHmg,
+		StitchParams params,
+		Rect& view,
+		double& scale,
+		Size& canvasSize)
 	{
 		int numFrames = matSrc.size();
 
@@ -353,123 +965,149 @@ namespace GpuStitch
 				return Mat(0,0,0);
 		}
 
-		int minX = 0;
-		int minY = 0; 
-		int maxX = matSrc[0].cols;
-		int maxY = matSrc[0].rows;
+		CurvedCanvas canvas;
+		canvas.projection = params.projection;
+		canvas.focal = params.focalLength > 0 ? params.focalLength : matSrc[0].cols;
+		canvas.center = Point2d(matSrc[0].cols / 2.0, matSrc[0].rows / 2.0);
+		canvas.offset = Point2d(0, 0);
+		canvas.scale = 1;
 
-		for (int i=1; i<matSrc.size(); i++)
+		// Only the area the frames cover is allocated and rendered
+		Rect extent = params.projection == 0 ? canvasExtent(matSrc, matHmg) : projectedExtent(matSrc, matHmg, canvas);
+
+		canvasSize = extent.size();
+
+		// And of that, only the view
+		Rect canvasRect(0, 0, extent.width, extent.height);
+		view &= canvasRect;
+
+		if (view.area() == 0 || (view == canvasRect && scale == 1))
 		{
-			Mat inv = matHmg[i].inv();
-			Point p = applyHomographyToPoint(0, 0, inv);
-			if (p.x > maxX)		maxX = p.x;
-			if (p.x < minX)		minX = p.x;
-			if (p.y > maxY)		maxY = p.y;
-			if (p.y < minY)		minY = p.y;
-			p = applyHomographyToPoint(0, matSrc[i].rows - 1, inv);
-			if (p.x > maxX)		maxX = p.x;
-			if (p.x < minX)		minX = p.x;
-			if (p.y > maxY)		maxY = p.y;
-			if (p.y < minY)		minY = p.y;
-			p = applyHomographyToPoint(matSrc[i].cols - 1, 0, inv);
-			if (p.x > maxX)		maxX = p.x;
-			if (p.x < minX)		minX = p.x;
-			if (p.y > maxY)		maxY = p.y;
-			if (p.y < minY)		minY = p.y;
-			p = applyHomographyToPoint(matSrc[i].cols - 1, matSrc[i].rows - 1, inv);
-			if (p.x > maxX)		maxX = p.x;
-			if (p.x < minX)		minX = p.x;
-			if (p.y > maxY)		maxY = p.y;
-			if (p.y < minY)		minY = p.y;
-		}
-
-		int offsetX = matSrc[0].cols - (maxX + minX) / 2;
-		int offsetY = matSrc[0].rows - (maxY + minY) / 2;
-
-		Mat translation = (Mat_<double>(3,3) << 1, 0, -offsetX, 0, 1, -offsetY, 0, 0, 1);
-
-		for(int i=0; i<matSrc.size(); i++)
-			matHmg[i] = matHmg[i] * translation;
-
-		GpuMat matDstDev = GpuMat(2 * matSrc[0].rows, 2 * matSrc[0].cols, CV_8UC3);
-
-		vector<GpuMat> matSrcDev(MaxFrames);
-		vector<GpuMat> matHmgDev(MaxFrames);
-
-		DevMem2D_<Tpixel> matSrcMem_h[MAX_CAMERAS];
-		DevMem2D_<Thmg> matHmgMem_h[MAX_CAMERAS];
-
-		// Convert Mats into GpuMats and then DevMem2Ds
-		for (int i=0; i<numFrames; i++)
+			view = canvasRect;
+			scale = 1;
+		}
+
+		Size dstSize(max(1, cvRound(view.width * scale)), max(1, cvRound(view.height * scale)));
+
+		if (params.projection == 0)
 		{
-			matSrcDev[i] = GpuMat(matSrc[i]);
-			Mat tmp;
-			matHmg[i].convertTo(tmp, CV_32FC1);
-			matHmgDev[i] = GpuMat(tmp);
+			Mat translation = (Mat_<double>(3,3) << 1 / scale, 0, extent.x + view.x, 0, 1 / scale, extent.y + view.y, 0, 0, 1);
 
-			matSrcMem_h[i] = matSrcDev[i];
-			matHmgMem_h[i] = matHmgDev[i];
+			for(int i=0; i<matSrc.size(); i++)
+				matHmg[i] = matHmg[i] * translation;
+		}
+		else
+		{
+			canvas.offset = Point2d(extent.x + view.x, extent.y + view.y);
+			canvas.scale = scale;
 		}
 
-		void* matSrcMem_d;
-		cudaMalloc(&matSrcMem_d, sizeof(matSrcMem_h));
+		static StitchBuffers buffers;
 
-		if (checkForCudaError("cudaMalloc"))
-			return Mat(0,0,0);
+		ensure(buffers.dst, dstSize.height, dstSize.width, CV_8UC3);
+		GpuMat& matDstDev = buffers.dst;
 
-		void* matHmgMem_d;
-		cudaMalloc(&matHmgMem_d, sizeof(matHmgMem_h));
+		FrameTables tables_h;
 
-		if (checkForCudaError("cudaMalloc"))
+		// Curved canvases bake the projection and homography into a table per frame
+		const MapTable* maps[MAX_CAMERAS];
+
+		for (int i=0; i<numFrames; i++)
 		{
-			cudaFree(matHmgMem_d);
-			return Mat(0,0,0);
+			if (params.projection != 0)
+			{
+				maps[i] = &mapTable(i, matHmg[i], matSrc[i].size(), dstSize, canvas);
+				tables_h.map[i] = maps[i]->map;
+			}
 		}
 
-		cudaMemcpy(matSrcMem_d, matSrcMem_h, sizeof(matSrcMem_h), cudaMemcpyHostToDevice);
+		// Per row, the [begin, end) columns of each frame
+		ensure(buffers.spans, dstSize.height, 2 * numFrames, CV_32SC1);
+		Mat& matSpans = buffers.spans;
+		for (int r=0; r<matSpans.rows; r++)
+		{
+			int* spans = matSpans.ptr<int>(r);
+			for (int i=0; i<numFrames; i++)
+			{
+				if (params.projection != 0)
+				{
+					spans[2*i] = maps[i]->spans.at<int>(r, 0);
+					spans[2*i + 1] = maps[i]->spans.at<int>(r, 1);
+				}
+				else if (!rowSpan(matHmg[i], matSrc[i].size(), r, dstSize.width, spans[2*i], spans[2*i + 1]))
+				{
+					spans[2*i] = 0;
+					spans[2*i + 1] = 0;
+				}
+			}
+		}
+		ensure(buffers.spansDev, matSpans.rows, matSpans.cols, CV_32SC1);
+		buffers.spansDev.upload(matSpans);
+		GpuMat& matSpansDev = buffers.spansDev;
 
-		if (checkForCudaError("cudaMemcpy"))
+		// Upload into the GpuMats kept from the last frame, then take their DevMem2Ds
+		for (int i=0; i<numFrames; i++)
 		{
-			cudaFree(matSrcMem_d);
-			cudaFree(matHmgMem_d);
-			return Mat(0,0,0);
+			ensure(buffers.src[i], matSrc[i].rows, matSrc[i].cols, matSrc[i].type());
+			buffers.src[i].upload(matSrc[i]);
+
+			ensure(buffers.hmg[i], 3, 3, CV_32FC1);
+			matHmg[i].convertTo(buffers.hmg[i], CV_32FC1);
+			ensure(buffers.hmgDev[i], 3, 3, CV_32FC1);
+			buffers.hmgDev[i].upload(buffers.hmg[i]);
+
+			tables_h.src[i] = buffers.src[i];
+			tables_h.hmg[i] = buffers.hmgDev[i];
+			tables_h.weight[i] = weightTable(i, matSrc[i].size(), params);
 		}
 
-		cudaMemcpy(matHmgMem_d, matHmgMem_h, sizeof(matHmgMem_h), cudaMemcpyHostToDevice);
+		// The headers live in one device block, allocated once
+		if (buffers.tables_d == NULL)
+		{
+			void* tables_d = NULL;
+			cudaMalloc(&tables_d, sizeof(FrameTables));
+			allocationCount++;
+
+			if (checkForCudaError("cudaMalloc"))
+				return Mat(0,0,0);
+
+			buffers.tables_d = (FrameTables*)tables_d;
+		}
+
+		cudaMemcpy(buffers.tables_d, &tables_h, sizeof(FrameTables), cudaMemcpyHostToDevice);
 
 		if (checkForCudaError("cudaMemcpy"))
-		{
-			cudaFree(matSrcMem_d);
-			cudaFree(matHmgMem_d);
 			return Mat(0,0,0);
-		}
 
 		dim3 block(32, 16, 1);
 
-		int x = int(0.5f + float(matDstDev.cols * CHANNELS) / float(block.x));
-		int y = int(0.5f + float(matDstDev.rows) / float(block.y));
+		// Rounded up, as the output is kept between frames and any pixel
+		// left out would show an old frame
+		int x = (matDstDev.cols * CHANNELS + block.x - 1) / block.x;
+		int y = (matDstDev.rows + block.y - 1) / block.y;
 		dim3 grid(x, y, 1);
 
-		stitch_kernel<<<grid, block>>>(
-			numFrames,
-			(DevMem2D_<Tpixel>*)matSrcMem_d,
-			(DevMem2D_<Thmg>*)matHmgMem_d,
+		StitchKernel kernel = selectKernel(numFrames, params);
+
+		kernel<<<grid, block>>>(
+			buffers.tables_d->src,
+			buffers.tables_d->hmg,
+			buffers.tables_d->map,
+			buffers.tables_d->weight,
+			matSpansDev,
 			matDstDev,
 			params);
 
 		cudaDeviceSynchronize();
-		bool rc = checkForCudaError("after kernel launch");
-		
-		cudaFree(matSrcMem_d);
-		cudaFree(matHmgMem_d);
 
-		if (rc)
+		if (checkForCudaError("after kernel launch"))
 			return Mat(0,0,0);
-		else
-		{
-			Mat output;
-			matDstDev.download(output);
-			return output;
-		}
+
+		Mat* output = outputBuffer(buffers, dstSize);
+		if (output == NULL)
+			return Mat(0,0,0);
+
+		matDstDev.download(*output);
+		return *output;
 	}
 }
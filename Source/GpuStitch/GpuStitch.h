@@ -39,6 +39,12 @@ namespace GpuStitch
 			expBlendValue = 50;
 			shift = 0;
 			hardShift = false;
+			projection = 0;
+			focalLength = 0;
+
+			for (int i=0; i<4; i++)
+				for (int c=0; c<3; c++)
+					gains[i][c] = 1;
 		}
 
 		bool interpolate;
@@ -46,6 +52,9 @@ namespace GpuStitch
 		float expBlendValue;
 		int shift;
 		bool hardShift;
+		int projection;			// 0 = planar, 1 = cylindrical, 2 = spherical
+		float focalLength;		// In pixels of the first frame, 0 = its width
+		float gains[4][3];		// Multiplies each frame's B, G and R samples before the shift
 	};
 
 	__declspec(dllexport)
@@ -54,6 +63,24 @@ namespace GpuStitch
 		vector<Mat> matHmg,
 		StitchParams params
 		);
+
+	// Renders only the view rectangle of the canvas, scaled by scale. An empty
+	// view is the whole canvas. view and scale are set to what was rendered,
+	// and canvasSize to the size of the whole canvas.
+	__declspec(dllexport)
+	Mat stitch_gpu(
+		vector<Mat> matSrc,
+		vector<Mat> matHmg,
+		StitchParams params,
+		Rect& view,
+		double& scale,
+		Size& canvasSize
+		);
+
+	// Device and page-locked buffers allocated so far. Stays put while the
+	// frame and view sizes do.
+	__declspec(dllexport)
+	int allocations();
 }
 
 #endif
\ No newline at end of file
@@ -214,5 +214,10 @@ void CameraCapture::getFrame()
 		}
 	}
 
+	// Done here, so that each camera's thread builds its own
+	pyramid.resize(frame.rows > 0 && frame.cols > 0 ? pyramidLevels : 0);
+	for (int l=0; l<pyramid.size(); l++)
+		pyrDown(l == 0 ? frame : pyramid[l - 1], pyramid[l]);
+
 	Timer::send(Timer::Camera, id, Timer::CamTimeval::End);
 }
@@ -23,6 +23,9 @@ along with StitcHD.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <Windows.h>
 
+#include <vector>
+using namespace std;
+
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/core/core.hpp>
 using namespace cv;
@@ -35,6 +38,11 @@ public:
 	HANDLE doneEvent;
 	Mat frame;
 
+	// pyramid[l] is frame reduced 2^(l+1) times, pyramidLevels of them
+	// built after each capture for stitching reduced views
+	vector<Mat> pyramid;
+	int pyramidLevels;
+
 	/// Constructor
 	CameraCapture(int id,
 			int width,
@@ -51,6 +59,7 @@ public:
 	{
 		running = false;
 		initialized = false;
+		pyramidLevels = 0;
 		doneEvent = INVALID_HANDLE_VALUE;
 		threadHandle = INVALID_HANDLE_VALUE;
 	}
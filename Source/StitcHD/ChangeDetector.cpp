@@ -0,0 +1,135 @@
+/*
+This file is part of StitcHD.
+
+StitcHD is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+StitcHD is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with StitcHD.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ChangeDetector.hpp"
+
+#include <cstdlib>
+
+ChangeDetector::ChangeDetector()
+	:current(0),
+	frameSize(0, 0)
+{
+}
+
+void ChangeDetector::reset()
+{
+	frameSize = Size(0, 0);
+}
+
+void ChangeDetector::update(const Mat& frame, int threshold)
+{
+	const int samplesPerBlock = BlockSize / SampleStep;
+
+	Size blocks((frame.cols + BlockSize - 1) / BlockSize, (frame.rows + BlockSize - 1) / BlockSize);
+
+	// Start over from scratch
+	if (frame.size() != frameSize)
+	{
+		frameSize = frame.size();
+		samples.create((frame.rows + SampleStep - 1) / SampleStep, (frame.cols + SampleStep - 1) / SampleStep, CV_8UC3);
+		for (int i = 0; i < History; i++)
+		{
+			changedBlocks[i].create(blocks, CV_8U);
+			changedBlocks[i].setTo(Scalar::all(1));
+		}
+
+		for (int y = 0; y < samples.rows; y++)
+		{
+			const unsigned char* src = frame.ptr(y * SampleStep);
+			unsigned char* sample = samples.ptr(y);
+
+			for (int x = 0; x < samples.cols; x++)
+				for (int c = 0; c < 3; c++)
+					sample[3 * x + c] = src[3 * x * SampleStep + c];
+		}
+
+		return;
+	}
+
+	current = (current + 1) % History;
+
+	for (int by = 0; by < blocks.height; by++)
+	{
+		unsigned char* changedRow = changedBlocks[current].ptr(by);
+
+		int y0 = by * samplesPerBlock;
+		int y1 = min(y0 + samplesPerBlock, samples.rows);
+
+		for (int bx = 0; bx < blocks.width; bx++)
+		{
+			int x0 = bx * samplesPerBlock;
+			int x1 = min(x0 + samplesPerBlock, samples.cols);
+
+			int difference = 0;
+
+			for (int y = y0; y < y1; y++)
+			{
+				const unsigned char* src = frame.ptr(y * SampleStep);
+				const unsigned char* sample = samples.ptr(y);
+
+				for (int x = x0; x < x1; x++)
+					for (int c = 0; c < 3; c++)
+						difference += abs(src[3 * x * SampleStep + c] - sample[3 * x + c]);
+			}
+
+			int count = 3 * (y1 - y0) * (x1 - x0);
+			changedRow[bx] = difference > threshold * count;
+
+			if (!changedRow[bx])
+				continue;
+
+			for (int y = y0; y < y1; y++)
+			{
+				const unsigned char* src = frame.ptr(y * SampleStep);
+				unsigned char* sample = samples.ptr(y);
+
+				for (int x = x0; x < x1; x++)
+					for (int c = 0; c < 3; c++)
+						sample[3 * x + c] = src[3 * x * SampleStep + c];
+			}
+		}
+	}
+}
+
+bool ChangeDetector::changed(const Rect& rect, int frames) const
+{
+	if (rect.width <= 0 || rect.height <= 0)
+		return false;
+
+	const Mat& last = changedBlocks[current];
+
+	int bx0 = max(rect.x / BlockSize, 0);
+	int by0 = max(rect.y / BlockSize, 0);
+	int bx1 = min((rect.x + rect.width - 1) / BlockSize, last.cols - 1);
+	int by1 = min((rect.y + rect.height - 1) / BlockSize, last.rows - 1);
+
+	for (int f = 0; f < min(frames, (int)History); f++)
+	{
+		const Mat& blocks = changedBlocks[(current + History - f) % History];
+
+		for (int by = by0; by <= by1; by++)
+		{
+			const unsigned char* changedRow = blocks.ptr(by);
+
+			for (int bx = bx0; bx <= bx1; bx++)
+				if (changedRow[bx])
+					return true;
+		}
+	}
+
+	return false;
+}
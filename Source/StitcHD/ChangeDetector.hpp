@@ -0,0 +1,61 @@
+/*
+This file is part of StitcHD.
+
+StitcHD is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+StitcHD is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with StitcHD.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CHANGEDETECTOR_HPP
+#define CHANGEDETECTOR_HPP
+
+#include <opencv2/core/core.hpp>
+using namespace cv;
+
+// Finds the blocks of a camera's frames which changed since they were last
+// rendered. Each block keeps a sparse sample of its pixels as they were the
+// last time it changed, so slow drift still adds up to a change but sensor
+// noise doesn't.
+class ChangeDetector
+{
+public:
+
+	ChangeDetector();
+
+	static const int BlockSize = 32;
+
+	// Every SampleStep'th pixel of every SampleStep'th row is compared
+	static const int SampleStep = 4;
+
+	// Marks the blocks whose mean difference from their sample exceeds
+	// threshold (0 - 255), and takes new samples of them. Everything counts
+	// as changed the first time, or if the frame size changes.
+	void update(const Mat& frame, int threshold);
+
+	// Forgets the samples, so the next update marks everything
+	void reset();
+
+	// How many updates changed() can look back over
+	static const int History = 2;
+
+	// True if any block overlapping rect changed in the last frames updates
+	bool changed(const Rect& rect, int frames = 1) const;
+
+private:
+
+	Mat samples;					// CV_8UC3, one pixel per sample
+	Mat changedBlocks[History];		// CV_8U, one per block, per update
+	int current;					// changedBlocks of the last update
+	Size frameSize;
+};
+
+#endif // CHANGEDETECTOR_HPP
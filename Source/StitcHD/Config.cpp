@@ -59,6 +59,18 @@ void Config::setDefaults()
 	expBlendValue = 50;
 	frameTint = 0;
 	maxTint = false;
+	stitchThreads = 0;
+	projection = 0;
+	focalLength = 0;
+	tileThreshold = 0;
+	hugePages = false;
+	maxWarpError = 10;
+	stitchBlock = 0;
+	gainCompensation = true;
+	recordFormat = 0;
+	offlineFrames = 0;
+	targetFrameTime = 0;
+	lockCalibration = false;
 
 	showMatches = false;
 	frameOverlap = 80;
@@ -221,7 +233,7 @@ int Config::readInputLine(string line)
 		string str;
 		iss >> str;
 		int result = atoi(str.c_str());
-		if (result >= 0 && result <= 3)
+		if (result >= 0 && result <= 5)
 			alphaBlend = result;
 	}
 	else if (type == "ExpBlendValue:")
@@ -232,6 +244,102 @@ int Config::readInputLine(string line)
 		if (blend >= 0 && blend <= 100)
 			expBlendValue = blend;
 	}
+	else if (type == "StitchThreads:")
+	{
+		string str;
+		iss >> str;
+		int threads = atoi(str.c_str());
+		if (threads >= 0 && threads <= 64)
+			stitchThreads = threads;
+	}
+	else if (type == "Projection:")
+	{
+		string str;
+		iss >> str;
+		int result = atoi(str.c_str());
+		if (result >= 0 && result <= 2)
+			projection = result;
+	}
+	else if (type == "FocalLength:")
+	{
+		string str;
+		iss >> str;
+		int focal = atoi(str.c_str());
+		if (focal >= 0)
+			focalLength = focal;
+	}
+	else if (type == "TileThreshold:")
+	{
+		string str;
+		iss >> str;
+		int threshold = atoi(str.c_str());
+		if (threshold >= 0 && threshold <= 255)
+			tileThreshold = threshold;
+	}
+	else if (type == "MaxWarpError:")
+	{
+		string str;
+		iss >> str;
+		int error = atoi(str.c_str());
+		if (error >= 0 && error <= 100)
+			maxWarpError = error;
+	}
+	else if (type == "StitchBlock:")
+	{
+		string str;
+		iss >> str;
+		int block = atoi(str.c_str());
+		if (block >= 0 && block <= 8192)
+			stitchBlock = block;
+	}
+	else if (type == "GainCompensation:")
+	{
+		string str;
+		iss >> str;
+		int result = atoi(str.c_str());
+		if (result == 0 || result == 1)
+			gainCompensation = (bool)result;
+	}
+	else if (type == "RecordFormat:")
+	{
+		string str;
+		iss >> str;
+		int format = atoi(str.c_str());
+		if (format == 0 || format == 1)
+			recordFormat = format;
+	}
+	else if (type == "OfflineFrames:")
+	{
+		string str;
+		iss >> str;
+		int frames = atoi(str.c_str());
+		if (frames >= 0 && frames <= 64)
+			offlineFrames = frames;
+	}
+	else if (type == "TargetFrameTime:")
+	{
+		string str;
+		iss >> str;
+		int ms = atoi(str.c_str());
+		if (ms >= 0 && ms <= 1000)
+			targetFrameTime = ms;
+	}
+	else if (type == "LockCalibration:")
+	{
+		string str;
+		iss >> str;
+		int result = atoi(str.c_str());
+		if (result == 0 || result == 1)
+			lockCalibration = (bool)result;
+	}
+	else if (type == "HugePages:")
+	{
+		string str;
+		iss >> str;
+		int result = atoi(str.c_str());
+		if (result == 0 || result == 1)
+			hugePages = (bool)result;
+	}
 	else if (type == "nOctaves:")
 	{
 		string str;
@@ -393,6 +501,18 @@ int Config::writeToFile()
 
 		file << "AlphaBlend: " << alphaBlend << endl;
 		file << "ExpBlendValue: " << expBlendValue << endl;
+		file << "StitchThreads: " << stitchThreads << endl;
+		file << "Projection: " << projection << endl;
+		file << "FocalLength: " << focalLength << endl;
+		file << "TileThreshold: " << tileThreshold << endl;
+		file << "HugePages: " << hugePages << endl;
+		file << "MaxWarpError: " << maxWarpError << endl;
+		file << "StitchBlock: " << stitchBlock << endl;
+		file << "GainCompensation: " << gainCompensation << endl;
+		file << "RecordFormat: " << recordFormat << endl;
+		file << "OfflineFrames: " << offlineFrames << endl;
+		file << "TargetFrameTime: " << targetFrameTime << endl;
+		file << "LockCalibration: " << lockCalibration << endl;
 
 		file.close();
 		return 0;
@@ -425,9 +545,63 @@ void Config::print(ostream& os) const
 	case 1: os << "Average"; break;
 	case 2: os << "Linear"; break;
 	case 3: os << "Exponential, " << expBlendValue << '%'; break;
+	case 4: os << "Multi-band"; break;
+	case 5: os << "Seam cut"; break;
 	default: os << "<ERROR>"; break;
 	}
 	os << endl;
+	os << "Stitch Threads: ";
+	if (stitchThreads == 0)
+		os << "Auto";
+	else
+		os << stitchThreads;
+	os << endl;
+	os << "Projection: ";
+	switch (projection)
+	{
+	case 0: os << "Planar"; break;
+	case 1: os << "Cylindrical"; break;
+	case 2: os << "Spherical"; break;
+	default: os << "<ERROR>"; break;
+	}
+	if (projection != 0)
+	{
+		os << ", focal length ";
+		if (focalLength == 0)
+			os << "Auto";
+		else
+			os << focalLength;
+	}
+	os << endl;
+	os << "Tile Reuse: ";
+	if (tileThreshold == 0)
+		os << "Off";
+	else
+		os << "Threshold " << tileThreshold;
+	os << endl;
+	os << "Huge Pages: " << hugePages << endl;
+	os << "Max Warp Error: " << maxWarpError / 100.0 << " px" << endl;
+	os << "Stitch Block: ";
+	if (stitchBlock == 0)
+		os << "Auto";
+	else
+		os << stitchBlock << " columns";
+	os << endl;
+	os << "Gain Compensation: " << gainCompensation << endl;
+	os << "Record Format: " << (recordFormat == 1 ? "I420 (YUV4MPEG2)" : "MPEG-1") << endl;
+	os << "Offline Frames: ";
+	if (offlineFrames == 0)
+		os << "Auto";
+	else
+		os << offlineFrames;
+	os << endl;
+	os << "Target Frame Time: ";
+	if (targetFrameTime == 0)
+		os << "Off";
+	else
+		os << targetFrameTime << " ms";
+	os << endl;
+	os << "Lock Calibration: " << lockCalibration << endl;
 
 	// Homographier
 	os << endl;
@@ -768,6 +942,8 @@ void Config::changeAlphaBlend()
 			<< "2 - Constant (Average)" << endl
 			<< "3 - Linear" << endl
 			<< "4 - Exponential" <<endl
+			<< "5 - Multi-band" <<endl
+			<< "6 - Seam cut" <<endl
 			<< endl
 			<< "Type: ";
 		string inputStr;
@@ -775,7 +951,7 @@ void Config::changeAlphaBlend()
 		choice = atoi(inputStr.c_str());
 
 		// Read until we get a valid input
-		failed = (choice < 1 || choice > 4);
+		failed = (choice < 1 || choice > 6);
 	} while (failed);
 	
 	alphaBlend = choice - 1;
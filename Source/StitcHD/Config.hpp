@@ -46,6 +46,18 @@ public:
 	int expBlendValue;
 	int frameTint;
 	bool maxTint;
+	int stitchThreads;			// 0 = one per processor, 1 = single-threaded
+	int projection;				// 0 = planar, 1 = cylindrical, 2 = spherical
+	int focalLength;			// In pixels of the first camera, 0 = its frame width
+	int tileThreshold;			// Mean source change (0 - 255) which re-renders a tile, 0 = re-render every frame. Sampled, so small or faint motion can be missed
+	bool hugePages;				// Back the stitch buffers with large pages when the system allows it
+	int maxWarpError;			// Hundredths of a pixel the warp maps may be off by, 0 = project every pixel
+	int stitchBlock;			// Canvas columns a stitch thread renders at a time, 0 = tune at startup
+	bool gainCompensation;		// Match each camera's exposure to its neighbours' where they overlap
+	int recordFormat;			// 0 = MPEG-1 through VideoWriter, 1 = uncompressed I420 (YUV4MPEG2)
+	int offlineFrames;			// Frames stitched at once from video files, 0 = one per processor
+	int targetFrameTime;		// ms per frame the quality governor holds the display to, 0 = full quality always
+	bool lockCalibration;		// Freeze the homographies once found, stop the homographiers and stitch from a compiled plan
 
 	// Related to homographiers
 	int hmgCount;
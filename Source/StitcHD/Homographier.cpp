@@ -41,6 +41,12 @@ using namespace cv;
 using namespace cv::gpu;
 #endif
 
+// Limits on a measured gain, and the brightest channel value still
+// measured, as clipped pixels say nothing about exposure
+static const double MinGain = 0.5;
+static const double MaxGain = 2.0;
+static const int GainClip = 250;
+
 Homographier::Homographier(int id,
 		const Config& c,
 		HANDLE startEvent,
@@ -56,6 +62,7 @@ Homographier::Homographier(int id,
 	threadHandle = INVALID_HANDLE_VALUE;
 	doneEvent = NULL;
 	homography = Mat::eye(3, 3, CV_64FC1);
+	gain = Scalar(1, 1, 1);
 	matchesFrame = Mat(0,0,0);
 	maskA = Mat();
 	maskB = Mat();
@@ -178,6 +185,14 @@ int Homographier::run()
 				{
 					float alpha = float(config.hmgTransitionAlpha) / 100.0;
 					homography = (newH * alpha + homography * (1.0 - alpha) );
+
+					// The exposure eases in at the same rate
+					Scalar newGain;
+					if (config.gainCompensation && measureGain(homography, newGain))
+					{
+						for (int c=0; c<3; c++)
+							gain[c] = newGain[c] * alpha + gain[c] * (1.0 - alpha);
+					}
 				}
 			}
 			catch (Exception &e)
@@ -537,6 +552,60 @@ Mat Homographier::findHomography(Mat &image1, Mat &image2)
     return homography;
 }
 
+bool Homographier::measureGain(const Mat& h, Scalar& newGain)
+{
+	if (maskA.size() != frameA.size())
+		return false;
+
+	Scalar sumA, sumB;
+	int samples = 0;
+
+	for (int y = GainStep / 2; y < frameA.rows; y += GainStep)
+	{
+		const uchar* maskRow = maskA.ptr(y);
+		const Vec3b* rowA = frameA.ptr<Vec3b>(y);
+
+		for (int x = GainStep / 2; x < frameA.cols; x += GainStep)
+		{
+			if (maskRow[x] == 0)
+				continue;
+
+			double z = h.at<HOM_MAT_TYPE>(2, 0) * x + h.at<HOM_MAT_TYPE>(2, 1) * y + h.at<HOM_MAT_TYPE>(2, 2);
+			if (z <= 0)
+				continue;
+
+			int xB = cvRound((h.at<HOM_MAT_TYPE>(0, 0) * x + h.at<HOM_MAT_TYPE>(0, 1) * y + h.at<HOM_MAT_TYPE>(0, 2)) / z);
+			int yB = cvRound((h.at<HOM_MAT_TYPE>(1, 0) * x + h.at<HOM_MAT_TYPE>(1, 1) * y + h.at<HOM_MAT_TYPE>(1, 2)) / z);
+			if (xB < 0 || yB < 0 || xB >= frameB.cols || yB >= frameB.rows)
+				continue;
+
+			const Vec3b& a = rowA[x];
+			const Vec3b& b = frameB.at<Vec3b>(yB, xB);
+
+			bool clipped = false;
+			for (int c=0; c<3; c++)
+				clipped = clipped || a[c] >= GainClip || b[c] >= GainClip;
+			if (clipped)
+				continue;
+
+			for (int c=0; c<3; c++)
+			{
+				sumA[c] += a[c];
+				sumB[c] += b[c];
+			}
+			samples++;
+		}
+	}
+
+	if (samples < MinGainSamples)
+		return false;
+
+	for (int c=0; c<3; c++)
+		newGain[c] = sumB[c] > 0 ? min(max(sumA[c] / sumB[c], MinGain), MaxGain) : 1;
+
+	return true;
+}
+
 Mat Homographier::mat2Grayscale(Mat& image)
 {
 	Mat grayscale;
@@ -35,6 +35,7 @@ public:
 	Config config;
 	HANDLE doneEvent;
 	Mat homography;
+	Scalar gain;		// Brings frame B's exposure to frame A's, per channel
 	Mat frameA, frameB;
 	Mat maskA, maskB;
 	Mat matchesFrame;
@@ -56,6 +57,14 @@ public:
 	Mat findHomography_GPU(Mat &image1, Mat &image2);
 #endif
 
+	// Compares frameA and frameB where homography h says they overlap,
+	// sampling frame A every GainStep pixels inside the maskA the last
+	// findHomography left. Returns false if too little of the overlap could
+	// be compared.
+	bool measureGain(const Mat& h, Scalar& newGain);
+	static const int GainStep = 8;
+	static const int MinGainSamples = 64;
+
 private:
 	
 	bool running;
@@ -19,6 +19,7 @@ along with StitcHD.  If not, see <http://www.gnu.org/licenses/>.
 #include <limits>
 #include <ctime>
 #include <iostream>
+#include <cstring>
 
 #include "ImageStitcher.hpp"
 #include "Timer.hpp"
@@ -45,71 +46,156 @@ Point ImageStitcher::applyHomographyToPoint(Point point, Mat &homography)
     return applyHomographyToPoint(point.x, point.y, homography);
 }
 
-#if COMPILE_GPU == 1
-Mat ImageStitcher::stitchImages_GPU(Mat* images, Mat* homographies, const Config& config)
+ImageStitcher::ImageStitcher()
+	:planLocked(false),
+	viewScale(1),
+	viewSourceBuilds(-1),
+	viewSourceWeightBuilds(-1),
+	pyramids(NULL),
+	multiBand(false),
+	blockTiles(1),
+	tileThreshold(0),
+	outputIndex(0),
+	pixelTarget(NULL),
+	pixelTargetContext(NULL),
+	pixelTargetFormat(Bgrx),
+	pixelTargetWritten(false)
 {
-	switch (config.camCount)
+	for (int i=0; i<OutputBuffers; i++)
 	{
-	// We don't need to stitch if there's just one frame
-	case 1:
-		return images[0];
-
-	// Stitch multiple
-	case 2:
-	case 3:
-	case 4:
-		break;
-	default:
-		cout << "Frame count not supported by ImageStitcher." << endl;
-		return Mat(0,0,0);
+		outputs[i].plan = NULL;
+		outputs[i].builds = -1;
+		outputs[i].weightBuilds = -1;
+		outputs[i].multiBand = false;
 	}
 
-	vector<Mat> frames;
-	vector<Mat> hmgs;
+	for (int i=0; i<MAX_CAMERAS; i++)
+		viewLevels[i] = 0;
 
-	for (int i=0; i<config.camCount; i++)
-	{
-		frames.push_back(images[i]);
-	}
+	tileCounters.tiles = 0;
+	tileCounters.reused = 0;
+	tileCounters.totalTiles = 0;
+	tileCounters.totalReused = 0;
+}
+
+int ImageStitcher::cameraHomographies(Mat* homographies, int camCount, vector<Mat>& hmgs)
+{
+	hmgs.clear();
 
 	// Create an identity matrix for the first image's transformation
 	hmgs.push_back(Mat::eye(3, 3, homographies[0].type())); 
 
-	if (config.camCount >= 2)
+	if (camCount >= 2)
 	{
 		if (homographies[0].rows == 0 || homographies[0].cols == 0)
-			return Mat(0,0,0);
+			return -1;
 
 		hmgs.push_back(homographies[0]);
 	}
 
-	if (config.camCount >= 3)
+	if (camCount >= 3)
 	{
 		if (homographies[1].rows == 0 || homographies[1].cols == 0)
-			return Mat(0,0,0);
+			return -1;
 
 		hmgs.push_back(homographies[1]);
 	}
 
-	if (config.camCount >= 4)
+	if (camCount >= 4)
 	{
 		if (homographies[2].rows == 0 || homographies[2].cols == 0)
-			return Mat(0,0,0);
+			return -1;
 		if (homographies[3].rows == 0 || homographies[3].cols == 0)
-			return Mat(0,0,0);
+			return -1;
 
 		hmgs.push_back( (homographies[0] * homographies[2] + homographies[1] * homographies[3]) / 2.0f );
 	}
 
+	return 0;
+}
+
+void ImageStitcher::cameraGains(const Scalar* gains, int camCount, Scalar* cameraGains)
+{
+	// Each gain brings the second frame of a Homographier's pair to the first
+	cameraGains[0] = Scalar(1, 1, 1);
+
+	for (int c=0; c<3; c++)
+	{
+		if (camCount >= 2)
+			cameraGains[1][c] = gains[0][c];
+		if (camCount >= 3)
+			cameraGains[2][c] = gains[1][c];
+		if (camCount >= 4)
+			cameraGains[3][c] = (gains[0][c] * gains[2][c] + gains[1][c] * gains[3][c]) / 2;
+	}
+}
+
+#if COMPILE_GPU == 1
+Mat ImageStitcher::stitchImages_GPU(Mat* images, Mat* homographies, const Config& config)
+{
+	Rect view;
+	double scale = 1;
+	Size canvasSize;
+
+	return stitchView_GPU(images, homographies, NULL, config, view, scale, canvasSize);
+}
+
+Mat ImageStitcher::stitchView_GPU(Mat* images, Mat* homographies, const Scalar* gains, const Config& config, Rect& view, double& scale, Size& canvasSize)
+{
+	switch (config.camCount)
+	{
+	// We don't need to stitch if there's just one frame
+	case 1:
+		view = Rect(0, 0, images[0].cols, images[0].rows);
+		scale = 1;
+		canvasSize = images[0].size();
+		return images[0];
+
+	// Stitch multiple
+	case 2:
+	case 3:
+	case 4:
+		break;
+	default:
+		cout << "Frame count not supported by ImageStitcher." << endl;
+		return Mat(0,0,0);
+	}
+
+	vector<Mat> frames;
+	vector<Mat> hmgs;
+
+	for (int i=0; i<config.camCount; i++)
+	{
+		frames.push_back(images[i]);
+	}
+
+	if (cameraHomographies(homographies, config.camCount, hmgs))
+		return Mat(0,0,0);
+
 	try
 	{
 		GpuStitch::StitchParams params;
 		params.interpolate = config.interpolate;
-		params.alphaBlend = config.alphaBlend;
+		// The GPU has no multi-band or seam cut blending, linear is the nearest
+		params.alphaBlend = (config.alphaBlend >= 4) ? 2 : config.alphaBlend;
 		params.expBlendValue = config.expBlendValue;
 		params.shift = config.frameTint;
 		params.hardShift = config.maxTint;
-		return GpuStitch::stitch_gpu(frames, hmgs, params);
+		params.projection = config.projection;
+		params.focalLength = config.focalLength > 0 ? config.focalLength : images[0].cols;
+
+		if (gains != NULL)
+		{
+			Scalar frameGains[MAX_CAMERAS];
+			cameraGains(gains, config.camCount, frameGains);
+
+			for (int i=0; i<config.camCount; i++)
+				for (int c=0; c<3; c++)
+					params.gains[i][c] = float(frameGains[i][c]);
+		}
+
+		scale = min(max(scale, 1.0 / MaxViewReduction), 1.0);
+		return GpuStitch::stitch_gpu(frames, hmgs, params, view, scale, canvasSize);
 	}
 	catch (Exception)
 	{
@@ -120,340 +206,778 @@ Mat ImageStitcher::stitchImages_GPU(Mat* images, Mat* homographies, const Config
 
 Mat ImageStitcher::stitchImages(Mat* images, Mat* homographies, const Config& config)
 {
+	Rect view;
+	double scale = 1;
+	Size canvasSize;
+
+	return stitchView(images, homographies, NULL, config, view, scale, canvasSize);
+}
+
+Mat ImageStitcher::stitchView(Mat* images, Mat* homographies, const Scalar* gains, const Config& config, Rect& view, double& scale, Size& canvasSize)
+{
+	if (pool.start(config.stitchThreads))
+		cout << "Could not start the stitch threads, stitching on one thread." << endl;
+
+	arena.setHugePages(config.hugePages);
+	pixelTargetWritten = false;
+
 	switch (config.camCount)
 	{
 	// We don't need to stitch if there's just one frame
 	case 1:
+		view = Rect(0, 0, images[0].cols, images[0].rows);
+		scale = 1;
+		canvasSize = images[0].size();
 		return images[0];
 
-	// Stitch two frames together
+	// Stitch multiple
 	case 2:
-		return stitchTwoImages(images[0], images[1], homographies[0]);
-
-	// Stitch four frames together
+	case 3:
 	case 4:
-		return stitchFourImages(images, homographies);
+		break;
 	default:
 		cout << "Frame count not supported by ImageStitcher." << endl;
 		return Mat(0,0,0);
 	}
+
+	vector<Mat> hmgs;
+
+	if (cameraHomographies(homographies, config.camCount, hmgs))
+		return Mat(0,0,0);
+
+	Scalar frameGains[MAX_CAMERAS];
+	if (gains != NULL)
+		cameraGains(gains, config.camCount, frameGains);
+
+	return stitchFrames(images, hmgs, gains != NULL ? frameGains : NULL, config, view, scale, canvasSize);
 }
 
-Mat ImageStitcher::stitchTwoImages(Mat& image1, Mat& image2, Mat& homography)
+Rect ImageStitcher::canvasExtent(Mat* images, const vector<Mat>& hmgs)
 {
-	if (homography.rows == 0 || homography.cols == 0)
+	// A frame seen at a grazing angle can project almost to infinity,
+	// so the canvas is capped a few frames beyond the first
+	double limitX = MaxCanvasReach * images[0].cols;
+	double limitY = MaxCanvasReach * images[0].rows;
+
+	double minX = 0;
+	double minY = 0;
+	double maxX = images[0].cols - 1;
+	double maxY = images[0].rows - 1;
+
+	for (int i=1; i<hmgs.size(); i++)
 	{
-		return Mat(0,0,0);
-	}
+		Mat inv = hmgs[i].inv();
 
-	int shiftX = fabs(homography.at<HOM_MAT_TYPE>(0, 2)) * 2;
-	int shiftY = fabs(homography.at<HOM_MAT_TYPE>(1, 2)) * 2;
+		int cornersX[4] = { 0, images[i].cols - 1, 0, images[i].cols - 1 };
+		int cornersY[4] = { 0, 0, images[i].rows - 1, images[i].rows - 1 };
 
-	int cols = image1.cols + image2.cols;
-	cols *= 2.5;
-	int rows = image1.rows + image2.rows;
-	rows *= 2.5;
-	Mat canvas = Mat::zeros(Size(rows, cols), CV_8UC3);
-	
-	Vec3b image1Pixel(0, 0, 0);
-	Vec3b image2Pixel(0, 0, 0);
-	Vec3b combined;
+		for (int j=0; j<4; j++)
+		{
+			double z = inv.at<HOM_MAT_TYPE>(2, 0) * cornersX[j] + inv.at<HOM_MAT_TYPE>(2, 1) * cornersY[j] + inv.at<HOM_MAT_TYPE>(2, 2);
 
-	int minXColorPixel = canvas.cols - 1;
-	int minYColorPixel = canvas.rows - 1;
-	int maxXColorPixel = 0;
-	int maxYColorPixel = 0;
+			if (z <= 0)
+			{
+				// Beyond the horizon
+				minX = -limitX;
+				minY = -limitY;
+				maxX = images[0].cols - 1 + limitX;
+				maxY = images[0].rows - 1 + limitY;
+				continue;
+			}
 
-	bool inImage1, inImage2;
+			double x = (inv.at<HOM_MAT_TYPE>(0, 0) * cornersX[j] + inv.at<HOM_MAT_TYPE>(0, 1) * cornersY[j] + inv.at<HOM_MAT_TYPE>(0, 2)) / z;
+			double y = (inv.at<HOM_MAT_TYPE>(1, 0) * cornersX[j] + inv.at<HOM_MAT_TYPE>(1, 1) * cornersY[j] + inv.at<HOM_MAT_TYPE>(1, 2)) / z;
 
-	for (int r = 0; r < canvas.rows; r++) {
-		for (int c = 0; c < canvas.cols; c++) {
-			Point transformedPoint = applyHomographyToPoint(c - shiftX, r - shiftY, homography);
+			minX = min(minX, x);
+			minY = min(minY, y);
+			maxX = max(maxX, x);
+			maxY = max(maxY, y);
+		}
+	}
 
-			inImage1 = true;
-			inImage2 = true;
+	int left = cvFloor(max(minX, -limitX));
+	int top = cvFloor(max(minY, -limitY));
+	int right = cvCeil(min(maxX, images[0].cols - 1 + limitX));
+	int bottom = cvCeil(min(maxY, images[0].rows - 1 + limitY));
 
-			if (c - shiftX < 0 || c - shiftX >= image1.cols
-					|| r - shiftY < 0 || r - shiftY >= image1.rows)
-				inImage1 = false;
-			else
-				image1Pixel = image1.at<Vec3b>(r - shiftY, c - shiftX);
+	return Rect(left, top, right - left + 1, bottom - top + 1);
+}
 
-			if (transformedPoint.x < 0 || transformedPoint.x >= image2.cols
-					|| transformedPoint.y < 0 || transformedPoint.y >= image2.rows)
-				inImage2 = false;
-			else
-				image2Pixel = image2.at<Vec3b>(transformedPoint.y, transformedPoint.x);
+Rect ImageStitcher::projectedExtent(Mat* images, const vector<Mat>& hmgs, const Projection& projection)
+{
+	// The canvas stops where the projection stops reaching the first frame's plane.
+	// A cylinder's height still grows without bound, so that is capped as before.
+	double reach = projection.focal * Projection::maxAngle();
+	double limitU0 = projection.center.x - reach;
+	double limitU1 = projection.center.x + reach;
+	double limitV0 = -MaxCanvasReach * images[0].rows;
+	double limitV1 = images[0].rows - 1 + MaxCanvasReach * images[0].rows;
+
+	if (projection.type == Projection::Spherical)
+	{
+		limitV0 = max(limitV0, projection.center.y - reach);
+		limitV1 = min(limitV1, projection.center.y + reach);
+	}
 
-			if (inImage1 && inImage2)
-			{
-				combined = Vec3b(
-					(image1Pixel[0] + image2Pixel[0])/2.0f,
-					(image1Pixel[1] + image2Pixel[1])/2.0f,
-					(image1Pixel[2] + image2Pixel[2])/2.0f );
-			}
-			else if (inImage1)
+	double minU = limitU1;
+	double minV = limitV1;
+	double maxU = limitU0;
+	double maxV = limitV0;
+
+	for (int i=0; i<hmgs.size(); i++)
+	{
+		Mat inv = hmgs[i].inv();
+
+		for (int j=0; j<4*EdgeSamples; j++)
+		{
+			// Walk round the frame's edges
+			int edge = j / EdgeSamples;
+			double t = double(j % EdgeSamples) / EdgeSamples;
+			double w = images[i].cols - 1;
+			double h = images[i].rows - 1;
+
+			double pX, pY;
+			switch (edge)
 			{
-				combined = image1Pixel;
+			case 0: pX = t * w; pY = 0; break;
+			case 1: pX = w; pY = t * h; break;
+			case 2: pX = (1 - t) * w; pY = h; break;
+			default: pX = 0; pY = (1 - t) * h; break;
 			}
-			else if (inImage2)
+
+			double z = inv.at<HOM_MAT_TYPE>(2, 0) * pX + inv.at<HOM_MAT_TYPE>(2, 1) * pY + inv.at<HOM_MAT_TYPE>(2, 2);
+
+			if (z <= 0)
 			{
-				combined = image2Pixel;
+				// Beyond the horizon
+				minU = limitU0;
+				minV = limitV0;
+				maxU = limitU1;
+				maxV = limitV1;
+				continue;
 			}
+
+			double x = (inv.at<HOM_MAT_TYPE>(0, 0) * pX + inv.at<HOM_MAT_TYPE>(0, 1) * pY + inv.at<HOM_MAT_TYPE>(0, 2)) / z;
+			double y = (inv.at<HOM_MAT_TYPE>(1, 0) * pX + inv.at<HOM_MAT_TYPE>(1, 1) * pY + inv.at<HOM_MAT_TYPE>(1, 2)) / z;
+
+			double u, v;
+			projection.fromPlane(x, y, u, v);
+
+			minU = min(minU, u);
+			minV = min(minV, v);
+			maxU = max(maxU, u);
+			maxV = max(maxV, v);
+		}
+	}
+
+	int left = cvFloor(max(minU, limitU0));
+	int top = cvFloor(max(minV, limitV0));
+	int right = cvCeil(min(maxU, limitU1));
+	int bottom = cvCeil(min(maxV, limitV1));
+
+	return Rect(left, top, right - left + 1, bottom - top + 1);
+}
+
+bool ImageStitcher::lockPlan(Mat* images, Mat* homographies, const Config& config)
+{
+	planLocked = false;
+
+	if (config.camCount < 2 || config.camCount > MAX_CAMERAS)
+		return false;
+
+	vector<Mat> hmgs;
+
+	if (cameraHomographies(homographies, config.camCount, hmgs))
+		return false;
+
+	preparePlan(images, hmgs, config);
+
+	if (!plan.weightsMatch(config.alphaBlend, config.expBlendValue, config.interpolate))
+		plan.buildWeights(config.alphaBlend, config.expBlendValue, config.interpolate);
+
+	planLocked = true;
+	return true;
+}
+
+void ImageStitcher::preparePlan(Mat* images, vector<Mat>& hmgs, const Config& config)
+{
+	vector<Size> srcSizes;
+	for (int i=0; i<hmgs.size(); i++)
+		srcSizes.push_back(images[i].size());
+
+	if (planLocked && plan.sourcesMatch(srcSizes))
+		return;
+
+	Projection projection(config.projection,
+		config.focalLength > 0 ? config.focalLength : images[0].cols,
+		Point2d(images[0].cols / 2.0, images[0].rows / 2.0));
+
+	// Only the area the frames cover is allocated and rendered
+	Rect extent;
+
+	if (projection.type == Projection::Planar)
+	{
+		extent = canvasExtent(images, hmgs);
+
+		Mat translation = (Mat_<HOM_MAT_TYPE>(3,3) << 1, 0, extent.x, 0, 1, extent.y, 0, 0, 1);
+
+		for (int i=0; i<hmgs.size(); i++)
+			hmgs[i] = hmgs[i] * translation;
+	}
+	else
+	{
+		extent = projectedExtent(images, hmgs, projection);
+		projection.offset = Point2d(extent.x, extent.y);
+	}
+
+	// Config holds it in hundredths of a pixel
+	double maxWarpError = config.maxWarpError / 100.0;
+
+	if (!plan.matches(hmgs, srcSizes, extent.size(), projection, maxWarpError))
+		plan.build(hmgs, srcSizes, extent.size(), projection, maxWarpError);
+}
+
+Mat ImageStitcher::stitchFrames(Mat* images, vector<Mat>& hmgs, const Scalar* gains, const Config& config, Rect& view, double& scale, Size& canvasSize)
+{
+	preparePlan(images, hmgs, config);
+	canvasSize = plan.canvasSize;
+
+	// Seam cut blending picks up seams as the finder finishes them
+	bool seamCut = (config.alphaBlend == 5);
+	Mat seams;
+
+	if (seamCut && seamFinder.takeSeams(seams))
+		plan.setSeams(seams);
+
+	if (!plan.weightsMatch(config.alphaBlend, config.expBlendValue, config.interpolate))
+		plan.buildWeights(config.alphaBlend, config.expBlendValue, config.interpolate);
+
+	// Maximum tinting paints each frame a solid colour, otherwise frames 1-3
+	// get frameTint added to their red, green and blue channels respectively
+	static const int hardShiftColors[MAX_CAMERAS][3] = {
+		{ 255, 255, 255 },
+		{ 0, 0, 255 },
+		{ 0, 255, 0 },
+		{ 255, 0, 0 }
+	};
+
+	for (int i=0; i<hmgs.size(); i++)
+	{
+		WarpKernels::Params& params = warpParams[i];
+		params.interpolate = config.interpolate;
+		params.flat = config.maxTint;
+
+		for (int c=0; c<3; c++)
+		{
+			if (config.maxTint)
+				params.tint[c] = hardShiftColors[i][c];
 			else
+				params.tint[c] = (c == 3 - i) ? config.frameTint : 0;
+
+			// Applied as the frame is sampled, so it costs no pass of its own
+			params.gain[c] = (gains != NULL && !config.maxTint) ? cvRound(gains[i][c] * WarpKernels::GainOne) : WarpKernels::GainOne;
+		}
+
+		warpFunctions[i] = WarpKernels::specialize(params);
+	}
+
+	multiBand = (config.alphaBlend == 4);
+
+	// Only samples the canvas now and then, the seams are found elsewhere
+	if (seamCut)
+		seamFinder.update(plan, images, warpParams);
+
+	int block = config.stitchBlock > 0 ? config.stitchBlock : blockWidth(config);
+	blockTiles = max(1, block / StitchPlan::TileSize);
+
+	// Find what moved since the last frame
+	tileThreshold = config.tileThreshold;
+	for (int i=0; i<hmgs.size(); i++)
+	{
+		if (tileThreshold > 0)
+			detectors[i].update(images[i], tileThreshold);
+		else
+			detectors[i].reset();
+	}
+
+	// Only what's on screen is rendered when there's a view
+	Rect canvasRect(Point(0, 0), plan.canvasSize);
+	view &= canvasRect;
+	scale = min(max(scale, 1.0 / MaxViewReduction), 1.0);
+
+	if (view.area() == 0 || (view == canvasRect && scale == 1))
+	{
+		view = canvasRect;
+		scale = 1;
+		return renderPlan(plan, images);
+	}
+
+	// Each camera is read from the smallest pyramid level with at least a
+	// pixel per view pixel, so that a reduced view reads less and aliases less
+	int levels[MAX_CAMERAS];
+	Mat sources[MAX_CAMERAS];
+	bool levelsChanged = false;
+
+	for (int i=0; i<plan.camCount; i++)
+	{
+		levels[i] = 0;
+
+		if (pyramids != NULL && scale < 1)
+		{
+			double footprint = plan.footprint(i, view, scale);
+			while (levels[i] + 1 < pyramids[i].size() && footprint >= 2)
 			{
-				combined = Vec3b(0,0,0);
+				levels[i]++;
+				footprint /= 2;
 			}
+		}
 
-			if (!(combined[0]==0 && combined[1]==0 && combined[2]==0)) {
-				if (c < minXColorPixel) {
-					minXColorPixel = c;
-				}
+		sources[i] = levels[i] > 0 ? pyramids[i][levels[i]] : images[i];
+		levelsChanged |= levels[i] != viewLevels[i];
+	}
 
-				if (c > maxXColorPixel) {
-					maxXColorPixel = c;
-				}
+	if (viewSourceBuilds != plan.builds || viewSourceWeightBuilds != plan.weightBuilds
+		|| view != viewRect || scale != viewScale || levelsChanged)
+	{
+		viewPlan.buildView(plan, view, scale, levels);
+
+		viewRect = view;
+		viewScale = scale;
+		viewSourceBuilds = plan.builds;
+		viewSourceWeightBuilds = plan.weightBuilds;
+		for (int i=0; i<plan.camCount; i++)
+			viewLevels[i] = levels[i];
+	}
 
-				if (r < minYColorPixel) {
-					minYColorPixel = r;
-				}
+	return renderPlan(viewPlan, sources);
+}
 
-				if (r > maxYColorPixel) {
-					maxYColorPixel = r;
-				}
-			}
+int ImageStitcher::pyramidLevels(double scale)
+{
+	// Enough halvings to get down to scale, rounding up, so there's a level
+	// to spare for frames the homographies shrink unless scale is a power of 2
+	int levels = 1;
+	while (scale < 1 && levels < MaxPyramidLevels)
+	{
+		levels++;
+		scale *= 2;
+	}
 
-			canvas.at<Vec3b>(r, c) = combined;
-		}
+	return levels;
+}
+
+void ImageStitcher::setPyramids(const vector<Mat>* newPyramids)
+{
+	pyramids = newPyramids;
+}
+
+const int ImageStitcher::blockCandidates[BlockCandidates] = { 32, 64, 128, 256, 512, 4096 };
+volatile int ImageStitcher::tunedBlockWidth = 0;
+volatile LONG ImageStitcher::tunerStarted = 0;
+
+void ImageStitcher::startBlockTuner(const Config& config)
+{
+	if (InterlockedExchange(&tunerStarted, 1) != 0)
+		return;
+
+	HANDLE threadHandle = CreateThread(
+		NULL,				// default security attributes
+		0,					// use default stack size
+		RunBlockTuner,		// thread function name
+		new Config(config),	// argument to thread function
+		0,					// use default creation flags
+		NULL);				// returns the thread identifier
+
+	if (threadHandle == NULL)
+		cout << "Could not start the stitch block tuner, using " << DefaultBlockWidth << " columns." << endl;
+	else
+		CloseHandle(threadHandle);
+}
 
+DWORD WINAPI ImageStitcher::RunBlockTuner(LPVOID arg)
+{
+	Config* config = (Config*)arg;
+	tunedBlockWidth = tuneBlockWidth(*config);
+	delete config;
+	return 0;
+}
+
+int ImageStitcher::blockWidth(const Config& config)
+{
+	if (tunedBlockWidth > 0)
+		return tunedBlockWidth;
+
+	startBlockTuner(config);
+	return DefaultBlockWidth;
+}
+
+int ImageStitcher::tuneBlockWidth(const Config& config)
+{
+	// The configured cameras, with noise for pixels, as only the memory
+	// traffic matters. A single camera gets a copy of itself.
+	int camCount = min(max(config.camCount, 2), MAX_CAMERAS);
+	Mat images[MAX_CAMERAS];
+	vector<Mat> hmgs;
+
+	for (int i=0; i<camCount; i++)
+	{
+		int size = i < config.camCount ? i : 0;
+		images[i].create(config.camSizes[size][1], config.camSizes[size][0], CV_8UC3);
+		randu(images[i], Scalar::all(0), Scalar::all(256));
+		hmgs.push_back(tuningHomography(i, images[i].size()));
 	}
 
-	if (minXColorPixel > 0)
-		minXColorPixel--;
-	else if (minXColorPixel < 0)
-		minXColorPixel = 0;
+	// Every tile is rendered every time
+	Config tuning = config;
+	tuning.camCount = camCount;
+	tuning.tileThreshold = 0;
 
-	if (minYColorPixel > 0)
-		minYColorPixel--;
-	else if (minYColorPixel < 0)
-		minYColorPixel = 0;
+	// Seam cut would start a SeamFinder thread, and costs linear's per pixel
+	if (tuning.alphaBlend == 5)
+		tuning.alphaBlend = 2;
 
-	if (maxXColorPixel < canvas.rows - 1)
-		maxXColorPixel++;
-	else if (maxXColorPixel > canvas.rows - 1)
-		maxXColorPixel = canvas.rows - 1;
+	ImageStitcher stitcher;
+	stitcher.pool.start(config.stitchThreads);
 
-	if (maxYColorPixel < canvas.cols - 1)
-		maxYColorPixel++;
-	else if (maxYColorPixel > canvas.cols - 1)
-		maxYColorPixel = canvas.cols - 1;
+	int best = blockCandidates[0];
+	double bestTime = 0;
 
-	if (minXColorPixel >= maxXColorPixel || minYColorPixel >= maxYColorPixel)
+	for (int c = 0; c < BlockCandidates; c++)
 	{
-		return Mat(0,0,0);
+		tuning.stitchBlock = blockCandidates[c];
+		double fastest = 0;
+
+		// The first run also builds the plan, so the fastest run counts
+		for (int run = 0; run <= TuningRuns; run++)
+		{
+			vector<Mat> frameHmgs;
+			for (int i=0; i<camCount; i++)
+				frameHmgs.push_back(hmgs[i].clone());
+
+			Rect view;
+			double scale = 1;
+			Size canvasSize;
+
+			int64 start = getTickCount();
+			stitcher.stitchFrames(images, frameHmgs, NULL, tuning, view, scale, canvasSize);
+			double time = double(getTickCount() - start);
+
+			if (run == 0 || time < fastest)
+				fastest = time;
+		}
+
+		if (c == 0 || fastest < bestTime)
+		{
+			best = blockCandidates[c];
+			bestTime = fastest;
+		}
 	}
 
-	Mat output;
-	canvas.colRange(minXColorPixel, maxXColorPixel).rowRange(minYColorPixel, maxYColorPixel).copyTo(output);
-	
-	return output;
+	cout << "Stitch block: " << best << " columns, "
+		<< bestTime * 1000 / getTickFrequency() << " ms per frame" << endl;
+
+	return best;
 }
 
-Mat ImageStitcher::stitchFourImages(Mat* images, Mat* hmgs)
+Mat ImageStitcher::tuningHomography(int camera, Size frame)
 {
-	// All the homographies must be valid
-	if (hmgs[0].rows == 0 || hmgs[0].cols == 0)
-		return Mat(0,0,0);
-	if (hmgs[1].rows == 0 || hmgs[1].cols == 0)
-		return Mat(0,0,0);
-	if (hmgs[2].rows == 0 || hmgs[2].cols == 0)
-		return Mat(0,0,0);
+	if (camera == 0)
+		return Mat::eye(3, 3, DataType<HOM_MAT_TYPE>::type);
+
+	// Laid out two across with a fifth of each frame overlapping, and
+	// turned a few degrees one way or the other
+	double offsetX = (camera % 2) * 0.8 * frame.width;
+	double offsetY = (camera / 2) * 0.8 * frame.height;
+	double angle = (camera % 2 ? 6 : -6) * CV_PI / 180;
+	double cx = frame.width / 2.0;
+	double cy = frame.height / 2.0;
+
+	Mat toCentre = (Mat_<HOM_MAT_TYPE>(3,3) << 1, 0, -offsetX - cx, 0, 1, -offsetY - cy, 0, 0, 1);
+	Mat rotation = (Mat_<HOM_MAT_TYPE>(3,3) << cos(angle), -sin(angle), 0, sin(angle), cos(angle), 0, 0, 0, 1);
+	Mat fromCentre = (Mat_<HOM_MAT_TYPE>(3,3) << 1, 0, cx, 0, 1, cy, 0, 0, 1);
+
+	return fromCentre * rotation * toCentre;
+}
 
-	Mat hmg1 = hmgs[0];
-	Mat hmg2 = hmgs[1];
-	Mat hmg3 = ((hmgs[0] * hmgs[2]) + (hmgs[1] * hmgs[3])) / 2.0;
-
-	// Create the canvas
-	int rows = max(images[0].rows, images[1].rows) + max(images[2].rows, images[3].rows);
-	rows *= 2.5;
-	int cols = max(images[0].cols, images[2].cols) + max(images[1].cols, images[3].cols);
-	cols *= 2.5;
-	Mat canvas = Mat::zeros(Size(rows, cols), CV_8UC3);
-	
-	Vec3b image0Pixel(0, 0, 0);
-	Vec3b image1Pixel(0, 0, 0);
-	Vec3b image2Pixel(0, 0, 0);
-	Vec3b image3Pixel(0, 0, 0);
-	Vec3b combined;
-
-	int minXColorPixel = canvas.cols - 1;
-	int minYColorPixel = canvas.rows - 1;
-	int maxXColorPixel = 0;
-	int maxYColorPixel = 0;
-
-	bool inImage0, inImage1, inImage2, inImage3;
-
-	for (int r = 0; r < canvas.rows; r++) {
-		for (int c = 0; c < canvas.cols; c++) {
-			Point image1point = applyHomographyToPoint(c, r, hmg1);
-			Point image2point = applyHomographyToPoint(c, r, hmg2);
-			Point image3point = applyHomographyToPoint(c, r, hmg3);
-			
-			inImage0 = true;
-			inImage1 = true;
-			inImage2 = true;
-			inImage3 = true;
-
-			// Image 0
-			if (c < 0 || c >= images[0].cols
-					|| r < 0 || r >= images[0].rows)
-				inImage0 = false;
-			else
-				image0Pixel = images[0].at<Vec3b>(r, c);
+int ImageStitcher::getAllocations() const
+{
+	int allocations = arena.allocations();
+#if COMPILE_GPU == 1
+	allocations += GpuStitch::allocations();
+#endif
+	return allocations;
+}
 
-			// Image 1
-			if (image1point.x < 0 || image1point.x >= images[1].cols
-					|| image1point.y < 0 || image1point.y >= images[1].rows)
-				inImage1 = false;
-			else
-				image1Pixel = images[1].at<Vec3b>(image1point.y, image1point.x);
-			
-			// Image 2
-			if (image2point.x < 0 || image2point.x >= images[2].cols
-					|| image2point.y < 0 || image2point.y >= images[2].rows)
-				inImage2 = false;
-			else
-				image2Pixel = images[2].at<Vec3b>(image2point.y, image2point.x);
+void ImageStitcher::setPixelTarget(PixelTargetFunction function, void* context, PixelFormat format)
+{
+	pixelTarget = function;
+	pixelTargetContext = context;
+	pixelTargetFormat = format;
+}
 
-			// Image 3
-			if (image3point.x < 0 || image3point.x >= images[3].cols
-					|| image3point.y < 0 || image3point.y >= images[3].rows)
-				inImage3 = false;
-			else
-				image3Pixel = images[3].at<Vec3b>(image3point.y, image3point.x);
+int ImageStitcher::findDirtyTiles(const StitchPlan& plan, const Output& output)
+{
+	int tiles = plan.tileCols * plan.tileRows;
 
-			combined = averagePixel(inImage0, inImage1, inImage2, inImage3, image0Pixel, image1Pixel, image2Pixel, image3Pixel);
+	// Anything but the sources changing means starting over
+	bool reuse = tileThreshold > 0 && &plan == output.plan
+		&& plan.builds == output.builds && plan.weightBuilds == output.weightBuilds
+		&& multiBand == output.multiBand
+		&& output.canvas.rows == plan.canvasSize.height && output.canvas.cols == plan.canvasSize.width;
 
-			if (!(combined[0]==0 && combined[1]==0 && combined[2]==0)) {
-				if (c < minXColorPixel) {
-					minXColorPixel = c;
-				}
+	for (int i = 0; i < plan.camCount && reuse; i++)
+		reuse = sameParams(warpParams[i], output.params[i]);
 
-				if (c > maxXColorPixel) {
-					maxXColorPixel = c;
-				}
+	dirtyTiles.assign(tiles, 1);
+	if (!reuse)
+		return tiles;
 
-				if (r < minYColorPixel) {
-					minYColorPixel = r;
-				}
+	int dirty = 0;
 
-				if (r > maxYColorPixel) {
-					maxYColorPixel = r;
-				}
-			}
+	for (int t = 0; t < tiles; t++) {
+		bool changed = false;
+
+		// The output was last rendered OutputBuffers frames ago. The
+		// detectors watch the frames themselves, not their pyramid levels.
+		for (int i = 0; i < plan.camCount && !changed; i++)
+		{
+			Rect source = plan.tileSources[t * plan.camCount + i];
+			int level = plan.levels[i];
+			Rect frameSource(source.x << level, source.y << level, source.width << level, source.height << level);
 
-			canvas.at<Vec3b>(r, c) = combined;
+			changed = detectors[i].changed(frameSource, OutputBuffers);
 		}
 
+		dirtyTiles[t] = changed;
+		if (changed)
+			dirty++;
 	}
 
-	if (minXColorPixel > 0)
-		minXColorPixel--;
-	else if (minXColorPixel < 0)
-		minXColorPixel = 0;
+	return dirty;
+}
+
+bool ImageStitcher::sameParams(const WarpKernels::Params& a, const WarpKernels::Params& b)
+{
+	return a.interpolate == b.interpolate && a.flat == b.flat
+		&& a.gain[0] == b.gain[0] && a.gain[1] == b.gain[1] && a.gain[2] == b.gain[2]
+		&& a.tint[0] == b.tint[0] && a.tint[1] == b.tint[1] && a.tint[2] == b.tint[2];
+}
 
-	if (minYColorPixel > 0)
-		minYColorPixel--;
-	else if (minYColorPixel < 0)
-		minYColorPixel = 0;
+Mat ImageStitcher::renderPlan(const StitchPlan& plan, Mat* images)
+{
+	if (plan.tileRows < 1)
+		return Mat(0,0,0);
 
-	if (maxXColorPixel < canvas.rows - 1)
-		maxXColorPixel++;
-	else if (maxXColorPixel > canvas.rows - 1)
-		maxXColorPixel = canvas.rows - 1;
+	outputIndex = (outputIndex + 1) % OutputBuffers;
+	Output& output = outputs[outputIndex];
 
-	if (maxYColorPixel < canvas.cols - 1)
-		maxYColorPixel++;
-	else if (maxYColorPixel > canvas.cols - 1)
-		maxYColorPixel = canvas.cols - 1;
+	// Both come back as they were left unless the geometry grew
+	output.canvas = arena.get(outputIndex, plan.canvasSize, CV_8UC3);
+	bandSums = arena.get(SumsSlot, Size(3 * plan.canvasSize.width, plan.tileRows), CV_32SC1);
 
-	if (minXColorPixel >= maxXColorPixel || minYColorPixel >= maxYColorPixel)
+	if (output.canvas.empty() || bandSums.empty())
 	{
+		output.plan = NULL;
 		return Mat(0,0,0);
 	}
 
-	Mat output;
-	canvas.colRange(minXColorPixel, maxXColorPixel).rowRange(minYColorPixel, maxYColorPixel).copyTo(output);
-	
-	return output;
+	int tiles = plan.tileCols * plan.tileRows;
+	int dirty = findDirtyTiles(plan, output);
+
+	tileCounters.tiles = tiles;
+	tileCounters.reused = tiles - dirty;
+	tileCounters.totalTiles += tiles;
+	tileCounters.totalReused += tiles - dirty;
+
+	// Tiles which aren't dirty keep what they had, the rest are all written,
+	// so the canvas is never cleared
+	RenderJob job;
+	job.stitcher = this;
+	job.plan = &plan;
+	job.images = images;
+	job.canvas = &output.canvas;
+	job.dirtyTiles = &dirtyTiles[0];
+	job.sums = &bandSums;
+	job.target = NULL;
+	job.targetStep = 0;
+	job.targetFormat = pixelTargetFormat;
+
+	if (pixelTarget != NULL)
+		job.target = pixelTarget(pixelTargetContext, plan.canvasSize, job.targetStep);
+
+	// Each band is written to the target while it is still in the cache,
+	// unless the blender has yet to finish it
+	job.pack = job.target != NULL && !multiBand;
+
+	// One row of tiles per job
+	if (dirty > 0)
+		pool.run(renderBand, &job, plan.tileRows);
+	else
+		job.pack = false;
+
+	if (multiBand)
+		blender.blend(plan, images, warpParams, output.canvas, pool);
+
+	if (job.target != NULL && !job.pack)
+		pool.run(packBand, &job, plan.tileRows);
 
+	pixelTargetWritten = job.target != NULL;
+
+	output.plan = &plan;
+	output.builds = plan.builds;
+	output.weightBuilds = plan.weightBuilds;
+	output.multiBand = multiBand;
+	for (int i = 0; i < plan.camCount; i++)
+		output.params[i] = warpParams[i];
+
+	return output.canvas;
 }
 
-Vec3b ImageStitcher::averagePixel(bool b0, bool b1, bool b2, bool b3, Vec3b p0, Vec3b p1, Vec3b p2, Vec3b p3)
+void ImageStitcher::renderBand(void* context, int band)
 {
-	if (b0 && b1 && b2 && b3)
-		return Vec3b(
-			(p0[0] + p1[0] + p2[0] + p3[0]) / 4.0f,
-			(p0[1] + p1[1] + p2[1] + p3[1]) / 4.0f,
-			(p0[2] + p1[2] + p2[2] + p3[2]) / 4.0f);
-	else if (b0 && b1 && b2)
-		return Vec3b(
-			(p0[0] + p1[0] + p2[0]) / 3.0f,
-			(p0[1] + p1[1] + p2[1]) / 3.0f,
-			(p0[2] + p1[2] + p2[2]) / 3.0f);
-	else if (b0 && b1 && b3)
-		return Vec3b(
-			(p0[0] + p1[0] + p3[0]) / 3.0f,
-			(p0[1] + p1[1] + p3[1]) / 3.0f,
-			(p0[2] + p1[2] + p3[2]) / 3.0f);
-	else if (b0 && b2 && b3)
-		return Vec3b(
-			(p0[0] + p2[0] + p3[0]) / 3.0f,
-			(p0[1] + p2[1] + p3[1]) / 3.0f,
-			(p0[2] + p2[2] + p3[2]) / 3.0f);
-	else if (b1 && b2 && b3)
-		return Vec3b(
-			(p1[0] + p2[0] + p3[0]) / 3.0f,
-			(p1[1] + p2[1] + p3[1]) / 3.0f,
-			(p1[2] + p2[2] + p3[2]) / 3.0f);
-	else if (b0 && b1)
-		return Vec3b(
-			(p0[0] + p1[0]) / 2.0f,
-			(p0[1] + p1[1]) / 2.0f,
-			(p0[2] + p1[2]) / 2.0f);
-	else if (b0 && b2)
-		return Vec3b(
-			(p0[0] + p2[0]) / 2.0f,
-			(p0[1] + p2[1]) / 2.0f,
-			(p0[2] + p2[2]) / 2.0f);
-	else if (b0 && b3)
-		return Vec3b(
-			(p0[0] + p3[0]) / 2.0f,
-			(p0[1] + p3[1]) / 2.0f,
-			(p0[2] + p3[2]) / 2.0f);
-	else if (b1 && b2)
-		return Vec3b(
-			(p1[0] + p2[0]) / 2.0f,
-			(p1[1] + p2[1]) / 2.0f,
-			(p1[2] + p2[2]) / 2.0f);
-	else if (b1 && b3)
-		return Vec3b(
-			(p1[0] + p3[0]) / 2.0f,
-			(p1[1] + p3[1]) / 2.0f,
-			(p1[2] + p3[2]) / 2.0f);
-	else if (b2 && b3)
-		return Vec3b(
-			(p2[0] + p3[0]) / 2.0f,
-			(p2[1] + p3[1]) / 2.0f,
-			(p2[2] + p3[2]) / 2.0f);
-	else if (b0)
-		return p0;
-	else if (b1)
-		return p1;
-	else if (b2)
-		return p2;
-	else if (b3)
-		return p3;
-	else
-		return Vec3b(0,0,0);
+	RenderJob* job = (RenderJob*)context;
+
+	int rowStart = band * StitchPlan::TileSize;
+	int rowEnd = min(rowStart + StitchPlan::TileSize, job->canvas->rows);
+	const unsigned char* dirty = job->dirtyTiles + band * job->plan->tileCols;
+
+	job->stitcher->renderRows(*job->plan, job->images, *job->canvas, rowStart, rowEnd, dirty, job->sums->ptr<int>(band));
+
+	if (job->pack)
+		packRows(*job, rowStart, rowEnd);
+}
+
+void ImageStitcher::packBand(void* context, int band)
+{
+	RenderJob* job = (RenderJob*)context;
+
+	int rowStart = band * StitchPlan::TileSize;
+	int rowEnd = min(rowStart + StitchPlan::TileSize, job->canvas->rows);
+
+	packRows(*job, rowStart, rowEnd);
+}
+
+void ImageStitcher::packRows(const RenderJob& job, int rowStart, int rowEnd)
+{
+	if (job.targetFormat == Bgrx)
+	{
+		for (int r = rowStart; r < rowEnd; r++)
+			WarpKernels::packBgrx(job.canvas->ptr(r), job.canvas->cols, job.target + r * job.targetStep);
+		return;
+	}
+
+	// Bands start on even rows, so the row pairs of the chroma never span two
+	int chromaStep = (job.canvas->cols + 1) / 2;
+	unsigned char* u = job.target + job.canvas->rows * job.targetStep;
+	unsigned char* v = u + ((job.canvas->rows + 1) / 2) * chromaStep;
+
+	for (int r = rowStart; r < rowEnd; r += 2)
+	{
+		int bottom = min(r + 1, rowEnd - 1);
+
+		WarpKernels::packI420(job.canvas->ptr(r), job.canvas->ptr(bottom), job.canvas->cols,
+			job.target + r * job.targetStep, job.target + bottom * job.targetStep,
+			u + (r / 2) * chromaStep, v + (r / 2) * chromaStep);
+	}
+}
+
+void ImageStitcher::renderRows(const StitchPlan& plan, Mat* images, Mat& canvas, int rowStart, int rowEnd, const unsigned char* dirty, int* sums)
+{
+	// One row of weighted sums per channel
+	WarpKernels::Accumulator acc;
+	acc.b = sums;
+	acc.g = acc.b + canvas.cols;
+	acc.r = acc.g + canvas.cols;
+
+	WarpKernels::Source sources[MAX_CAMERAS];
+	for (int i = 0; i < plan.camCount; i++) {
+		sources[i].data = images[i].data;
+		sources[i].step = images[i].step;
+		sources[i].cols = images[i].cols;
+		sources[i].rows = images[i].rows;
+	}
+
+	// The first segment of each row which might reach the next block. The
+	// blocks go left to right, so they only move forward.
+	int firstSegments[StitchPlan::TileSize];
+	for (int r = rowStart; r < rowEnd; r++)
+		firstSegments[r - rowStart] = plan.rowSegments[r];
+
+	for (int tile = 0; tile < plan.tileCols; ) {
+		if (!dirty[tile]) {
+			tile++;
+			continue;
+		}
+
+		// A run of dirty tiles up to a block wide is rendered in one go
+		int runEnd = tile + 1;
+		while (runEnd < plan.tileCols && runEnd - tile < blockTiles && dirty[runEnd])
+			runEnd++;
+
+		int runBegin = tile * StitchPlan::TileSize;
+		int runStop = min(runEnd * StitchPlan::TileSize, canvas.cols);
+		tile = runEnd;
+
+		for (int r = rowStart; r < rowEnd; r++) {
+			uchar* canvasRow = canvas.ptr(r);
+			int& firstSegment = firstSegments[r - rowStart];
+
+			while (firstSegment < plan.rowSegments[r + 1] && plan.segments[firstSegment].end <= runBegin)
+				firstSegment++;
+
+			for (int s = firstSegment; s < plan.rowSegments[r + 1]; s++) {
+				const StitchPlan::Segment& segment = plan.segments[s];
+				if (segment.begin >= runStop)
+					break;
+
+				int begin = max(segment.begin, runBegin);
+				int count = min(segment.end, runStop) - begin;
+
+				// No frame reaches these pixels
+				if (segment.count == 0) {
+					memset(canvasRow + 3 * begin, 0, 3 * count);
+					continue;
+				}
+
+				// Only one frame, nothing to blend
+				if (segment.count == 1) {
+					int i = segment.camera;
+					const WarpKernels::Params& params = warpParams[i];
+
+					if (plan.translated[i] && !params.flat && !WarpKernels::adjusts(params)) {
+						const Point& t = plan.translations[i];
+						memcpy(canvasRow + 3 * begin, images[i].ptr(r + t.y) + 3 * (begin + t.x), 3 * count);
+					}
+					else {
+						warpFunctions[i].warp(sources[i], plan.warpMap(i, begin, r), count, params, canvasRow + 3 * begin);
+					}
+					continue;
+				}
+
+				// Left for the multi-band blender
+				if (multiBand)
+					continue;
+
+				WarpKernels::Accumulator segmentAcc;
+				segmentAcc.b = acc.b + begin;
+				segmentAcc.g = acc.g + begin;
+				segmentAcc.r = acc.r + begin;
+
+				fill(segmentAcc.b, segmentAcc.b + count, 0);
+				fill(segmentAcc.g, segmentAcc.g + count, 0);
+				fill(segmentAcc.r, segmentAcc.r + count, 0);
+
+				// Blend the frames which overlap here
+				for (int i = 0; i < plan.camCount; i++) {
+					if (!(segment.cameras & (1 << i)))
+						continue;
+
+					const unsigned short* weights = plan.weightMaps[i].ptr<unsigned short>(r) + begin;
+					warpFunctions[i].accumulate(sources[i], plan.warpMap(i, begin, r), weights, count, warpParams[i], segmentAcc);
+				}
+
+				WarpKernels::resolve(segmentAcc, count, canvasRow + 3 * begin);
+			}
+		}
+	}
 }
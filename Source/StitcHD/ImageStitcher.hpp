@@ -20,6 +20,13 @@ along with StitcHD.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "Config.hpp"
 #include "Timer.hpp"
+#include "StitchPlan.hpp"
+#include "WorkerPool.hpp"
+#include "WarpKernels.hpp"
+#include "MultiBandBlender.hpp"
+#include "SeamFinder.hpp"
+#include "ChangeDetector.hpp"
+#include "StitchArena.hpp"
 
 #include <vector>
 using namespace std;
@@ -31,25 +38,256 @@ using namespace cv;
 class ImageStitcher {
 public:
 
+	ImageStitcher();
+
 	/// Stitch camCount images together
-    static Mat stitchImages(Mat* images, Mat* homographies, const Config& config);
+    Mat stitchImages(Mat* images, Mat* homographies, const Config& config);
+
+	/// Stitch only the view rectangle of the canvas, scaled by scale (1/16 to 1).
+	/// An empty view is the whole canvas. view and scale are set to what was
+	/// actually rendered, and canvasSize to the size of the whole canvas.
+	/// gains holds each Homographier's gain along with its homography, or is
+	/// NULL to leave the frames' exposure alone.
+	Mat stitchView(Mat* images, Mat* homographies, const Scalar* gains, const Config& config, Rect& view, double& scale, Size& canvasSize);
 	
 #if COMPILE_GPU == 1
     static Mat stitchImages_GPU(Mat* images, Mat* homographies, const Config& config);
+    static Mat stitchView_GPU(Mat* images, Mat* homographies, const Scalar* gains, const Config& config, Rect& view, double& scale, Size& canvasSize);
 #endif
 
-	/// Stitch two images together
-	static Mat stitchTwoImages(Mat& image1, Mat& image2, Mat& homography);
+	/// The warp tables for the current homographies
+	const StitchPlan& getPlan() const { return plan; }
+
+	/// How many canvas tiles were stitched. Reused tiles were kept from the
+	/// frame before because nothing they show changed.
+	struct TileCounters
+	{
+		int tiles;				// In the last frame
+		int reused;
+		long long totalTiles;	// In every frame so far
+		long long totalReused;
+	};
+
+	const TileCounters& getTileCounters() const { return tileCounters; }
+
+	/// Frame-sized buffers allocated so far. Stays put while the output
+	/// geometry does.
+	int getAllocations() const;
+
+	/// Gets a buffer for size pixels of output in the target's format, e.g.
+	/// a QImage's bits. Returns the first row and sets step, or returns NULL
+	/// to skip.
+	typedef unsigned char* (*PixelTargetFunction)(void* context, Size size, int& step);
+
+	/// Bgrx is WarpKernels::packBgrx's format. I420 is the Y, U and V planes
+	/// one after another, with rows of step bytes for Y and (size.width + 1) / 2
+	/// for U and V, as WarpKernels::packI420 writes them.
+	enum PixelFormat
+	{
+		Bgrx,
+		I420
+	};
 
-	/// Stitch four images together
-	static Mat stitchFourImages(Mat* images, Mat* homographies);
+	/// The CPU stitcher also writes its output to the target as it renders,
+	/// in format. NULL turns it off.
+	void setPixelTarget(PixelTargetFunction function, void* context, PixelFormat format = Bgrx);
+
+	/// True if the last stitch wrote the pixel target
+	bool wrotePixelTarget() const { return pixelTargetWritten; }
+
+	/// Reduced copies of the frames for scaled views: pyramids[i][l] is
+	/// camera i's frame at 1 / 2^l size, pyramids[i][0] the frame itself.
+	/// The CPU stitcher reads each camera from the smallest level that still
+	/// has a pixel for every pixel of the view. NULL for none.
+	void setPyramids(const vector<Mat>* pyramids);
+
+	/// Times the stitch block widths on a background thread, once per
+	/// process, so the first frames aren't held up by it. Stitches use
+	/// DefaultBlockWidth until it finishes. The first stitch with
+	/// config.stitchBlock 0 starts it if nothing has before.
+	static void startBlockTuner(const Config& config);
+
+	/// Builds the plan and blend weights for these homographies now, and
+	/// keeps them until unlockPlan(): later stitches skip finding the canvas
+	/// and comparing homographies, and go straight to the tables. Projection
+	/// settings changed while locked wait for the unlock. Returns false if
+	/// the homographies can't be stitched.
+	bool lockPlan(Mat* images, Mat* homographies, const Config& config);
+	void unlockPlan() { planLocked = false; }
+	bool isPlanLocked() const { return planLocked; }
+
+	/// How many pyramid levels, counting the frame, a view at scale can use
+	static int pyramidLevels(double scale);
+	static const int MaxPyramidLevels = 5;
 
 private:
 
+	// Rebuilt only when the homographies change, or never while locked
+	StitchPlan plan;
+	bool planLocked;
+
+	// The plan sampled down to the last view, rebuilt when the view or plan changes
+	StitchPlan viewPlan;
+	Rect viewRect;
+	double viewScale;
+	int viewSourceBuilds;
+	int viewSourceWeightBuilds;
+	int viewLevels[MAX_CAMERAS];
+
+	// Pyramids of the frames being stitched, NULL if there are none
+	const vector<Mat>* pyramids;
+
+	// Smallest view scale is 1 / MaxViewReduction
+	static const int MaxViewReduction = 16;
+
+	// Threads which render the canvas in row bands
+	WorkerPool pool;
+
+	// Each band is rendered blockTiles tiles across at a time, so that the
+	// frame pixels a block samples stay in the cache while its rows are
+	// rendered. The widths the tuner tries, in columns.
+	int blockTiles;
+	static const int BlockCandidates = 6;
+	static const int blockCandidates[BlockCandidates];
+
+	// Block width the tuner picked for this machine, 0 until it has finished
+	static volatile int tunedBlockWidth;
+	static volatile LONG tunerStarted;
+	static const int DefaultBlockWidth = 128;
+
+	// The tuned block width, or DefaultBlockWidth while the tuner runs
+	static int blockWidth(const Config& config);
+
+	// Times a synthetic stitch like config's with each candidate block
+	// width. Returns the fastest.
+	static int tuneBlockWidth(const Config& config);
+	static const int TuningRuns = 3;
+
+	// Tuner thread entry point, arg being a copy of the config to delete
+	static DWORD WINAPI RunBlockTuner(LPVOID arg);
+
+	// A canvas-to-frame homography for tuning, rotated about the frame's
+	// centre like a real camera rig, so that canvas rows cross frame rows
+	static Mat tuningHomography(int camera, Size frame);
+
+	// Sampling options for the warp kernels, one set per camera
+	WarpKernels::Params warpParams[MAX_CAMERAS];
+
+	// The kernels compiled for each camera's params, picked once per frame
+	WarpKernels::Specialized warpFunctions[MAX_CAMERAS];
+
+	// Blends the overlaps when alphaBlend is 4, in which case renderRows skips them
+	MultiBandBlender blender;
+	bool multiBand;
+
+	// Finds the seams for alphaBlend 5 in the background
+	SeamFinder seamFinder;
+
+	// Spots which parts of each camera's frames changed
+	ChangeDetector detectors[MAX_CAMERAS];
+	int tileThreshold;
+
+	// The canvases are double-buffered, so the frame handed out last stays
+	// intact while the next is rendered. Each remembers what it was rendered
+	// with, as its unchanged tiles are kept when it is reused.
+	static const int OutputBuffers = 2;
+
+	struct Output
+	{
+		Mat canvas;
+		const StitchPlan* plan;
+		int builds;
+		int weightBuilds;
+		bool multiBand;
+		WarpKernels::Params params[MAX_CAMERAS];
+	};
+
+	Output outputs[OutputBuffers];
+	int outputIndex;
+
+	// Holds the canvases and the blend sums, so that nothing frame-sized is
+	// allocated while the output geometry stays the same
+	StitchArena arena;
+	enum { SumsSlot = OutputBuffers };
+
+	// One row of weighted sums per channel, per band
+	Mat bandSums;
+
+	// Where the output is also written as 32-bit pixels
+	PixelTargetFunction pixelTarget;
+	void* pixelTargetContext;
+	PixelFormat pixelTargetFormat;
+	bool pixelTargetWritten;
+
+	// One flag per tile of the plan being rendered, set if it needs rendering
+	vector<unsigned char> dirtyTiles;
+	TileCounters tileCounters;
+
+	// Flags the tiles of output whose sources changed since it was last
+	// rendered, or all of them if it can't be reused, and returns how many
+	// were flagged
+	int findDirtyTiles(const StitchPlan& plan, const Output& output);
+
+	static bool sameParams(const WarpKernels::Params& a, const WarpKernels::Params& b);
+
+	// Everything a worker needs to render one band
+	struct RenderJob
+	{
+		ImageStitcher* stitcher;
+		const StitchPlan* plan;
+		Mat* images;
+		Mat* canvas;
+		const unsigned char* dirtyTiles;
+		Mat* sums;
+		unsigned char* target;
+		int targetStep;
+		PixelFormat targetFormat;
+		bool pack;			// renderBand writes the target
+	};
+
+	// Renders a row of tiles
+	static void renderBand(void* context, int band);
+
+	// Writes a row of tiles to the target
+	static void packBand(void* context, int band);
+	static void packRows(const RenderJob& job, int rowStart, int rowEnd);
+
+	// The canvas-to-frame homography of every camera, from the Homographiers' results
+	static int cameraHomographies(Mat* homographies, int camCount, vector<Mat>& hmgs);
+
+	// The gain which matches every camera's exposure to the first's, chained
+	// through the Homographiers' gains the same way as the homographies
+	static void cameraGains(const Scalar* gains, int camCount, Scalar* cameraGains);
+
+	// Stitch the view of any number of frames with the CPU kernels. gains
+	// holds one per camera, or is NULL.
+	Mat stitchFrames(Mat* images, vector<Mat>& hmgs, const Scalar* gains, const Config& config, Rect& view, double& scale, Size& canvasSize);
+
+	// Finds the canvas for hmgs and (re)builds the plan if it isn't the
+	// plan for it. A locked plan is kept as long as the frame sizes match.
+	void preparePlan(Mat* images, vector<Mat>& hmgs, const Config& config);
+
+	// How many frame sizes the canvas may extend beyond the first frame
+	static const int MaxCanvasReach = 2;
+
+	// Bounding box of every frame's corners projected onto the first frame
+	static Rect canvasExtent(Mat* images, const vector<Mat>& hmgs);
+
+	// Bounding box of every frame's edges on a curved canvas
+	static Rect projectedExtent(Mat* images, const vector<Mat>& hmgs, const Projection& projection);
+
+	// Points sampled along each edge of a frame, as its edges bend on a curved canvas
+	static const int EdgeSamples = 16;
+
+	// Warps and blends images into a canvas using the plan's warp maps
+	Mat renderPlan(const StitchPlan& plan, Mat* images);
+
+	// Renders the dirty tiles of canvas rows [rowStart, rowEnd), dirty holding
+	// the flags of their row of tiles, a block at a time
+	void renderRows(const StitchPlan& plan, Mat* images, Mat& canvas, int rowStart, int rowEnd, const unsigned char* dirty, int* sums);
+
     static Point applyHomographyToPoint(int, int, Mat &homography);
     static Point applyHomographyToPoint(Point point, Mat &homography);
-
-	static Vec3b averagePixel(bool, bool, bool, bool, Vec3b, Vec3b, Vec3b, Vec3b);
 };
 
 #endif // IMAGESTITCHER_H
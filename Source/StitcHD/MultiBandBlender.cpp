@@ -0,0 +1,405 @@
+/*
+This file is part of StitcHD.
+
+StitcHD is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+StitcHD is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with StitcHD.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "MultiBandBlender.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include <opencv2/imgproc/imgproc.hpp>
+
+MultiBandBlender::MultiBandBlender()
+	:builds(0),
+	planSource(NULL),
+	planBuilds(-1),
+	planWeightBuilds(-1)
+{
+}
+
+void MultiBandBlender::blend(const StitchPlan& plan, Mat* images, const WarpKernels::Params* params, Mat& canvas, WorkerPool& pool)
+{
+	if (&plan != planSource || plan.builds != planBuilds || plan.weightBuilds != planWeightBuilds)
+		buildRegions(plan);
+
+	if (regions.empty())
+		return;
+
+	WarpKernels::Source sources[MAX_CAMERAS];
+	for (int i = 0; i < plan.camCount; i++) {
+		sources[i].data = images[i].data;
+		sources[i].step = images[i].step;
+		sources[i].cols = images[i].cols;
+		sources[i].rows = images[i].rows;
+	}
+
+	BlendJob job;
+	job.blender = this;
+	job.plan = &plan;
+	job.sources = &sources[0];
+	job.params = params;
+	job.canvas = &canvas;
+
+	// Each stage only reads what the one before it wrote
+	pool.run(pyramidJob, &job, pyramidJobs.size());
+	pool.run(levelJob, &job, levelJobs.size());
+	pool.run(collapseJob, &job, regions.size());
+}
+
+void MultiBandBlender::pyramidJob(void* context, int job)
+{
+	BlendJob* blendJob = (BlendJob*)context;
+	MultiBandBlender* blender = blendJob->blender;
+	const Point& p = blender->pyramidJobs[job];
+
+	blender->buildPyramid(*blendJob, blender->regions[p.x], p.y);
+}
+
+void MultiBandBlender::levelJob(void* context, int job)
+{
+	BlendJob* blendJob = (BlendJob*)context;
+	MultiBandBlender* blender = blendJob->blender;
+	const Point& p = blender->levelJobs[job];
+
+	blender->blendLevel(blender->regions[p.x], p.y);
+}
+
+void MultiBandBlender::collapseJob(void* context, int job)
+{
+	BlendJob* blendJob = (BlendJob*)context;
+	blendJob->blender->collapse(*blendJob, blendJob->blender->regions[job]);
+}
+
+void MultiBandBlender::buildRegions(const StitchPlan& plan)
+{
+	planSource = &plan;
+	planBuilds = plan.builds;
+	planWeightBuilds = plan.weightBuilds;
+	builds++;
+
+	regions.clear();
+	pyramidJobs.clear();
+	levelJobs.clear();
+
+	// Far enough for the coarsest level not to see the edge of a region
+	const int margin = 2 << MaxLevels;
+
+	int rows = plan.canvasSize.height;
+	int cols = plan.canvasSize.width;
+
+	for (int bandStart = 0; bandStart < rows; bandStart += BandRows)
+	{
+		int bandEnd = min(bandStart + BandRows, rows);
+
+		// The overlapping columns of this band
+		int x0 = cols;
+		int x1 = 0;
+		int y0 = bandEnd;
+		int y1 = bandStart;
+
+		for (int r = bandStart; r < bandEnd; r++)
+		{
+			for (int s = plan.rowSegments[r]; s < plan.rowSegments[r + 1]; s++)
+			{
+				const StitchPlan::Segment& segment = plan.segments[s];
+				if (segment.count < 2)
+					continue;
+
+				x0 = min(x0, segment.begin);
+				x1 = max(x1, segment.end);
+				y0 = min(y0, r);
+				y1 = max(y1, r + 1);
+			}
+		}
+
+		if (x0 >= x1)
+			continue;
+
+		// Join onto the region above unless that would widen either a lot,
+		// as where a vertical seam meets a horizontal one
+		if (!regions.empty() && regions.back().coreEnd == bandStart)
+		{
+			Region& above = regions.back();
+			int aboveX0 = above.rect.x;
+			int aboveX1 = above.rect.x + above.rect.width;
+			int width = max(aboveX1, x1) - min(aboveX0, x0);
+
+			if (4 * width <= 5 * min(aboveX1 - aboveX0, x1 - x0))
+			{
+				above.rect = Rect(min(aboveX0, x0), above.rect.y, width, y1 - above.rect.y);
+				above.coreEnd = y1;
+				continue;
+			}
+		}
+
+		Region region;
+		region.rect = Rect(x0, y0, x1 - x0, y1 - y0);
+		region.coreStart = y0;
+		region.coreEnd = y1;
+		regions.push_back(region);
+	}
+
+	for (int i=0; i<regions.size(); i++)
+	{
+		Region& region = regions[i];
+
+		// Until now rect held just the overlap
+		int left = max(region.rect.x - margin, 0);
+		int top = max(region.rect.y - margin, 0);
+		int right = min(region.rect.x + region.rect.width + margin, cols);
+		int bottom = min(region.rect.y + region.rect.height + margin, rows);
+		region.rect = Rect(left, top, right - left, bottom - top);
+
+		// Stop before the levels get smaller than the filter
+		region.levels = MaxLevels;
+		while (region.levels > 1 && (min(region.rect.width, region.rect.height) >> (region.levels - 1)) < 4)
+			region.levels--;
+
+		buildMasks(plan, region);
+
+		for (int slot=0; slot<region.cameras.size(); slot++)
+			pyramidJobs.push_back(Point(i, slot));
+		for (int level=0; level<region.levels; level++)
+			levelJobs.push_back(Point(i, level));
+	}
+}
+
+void MultiBandBlender::buildMasks(const StitchPlan& plan, Region& region)
+{
+	const Rect& rect = region.rect;
+	const unsigned char none = 255;
+
+	// The seam runs where the heaviest camera changes
+	Mat owners(rect.size(), CV_8U);
+	int cameras = 0;
+
+	for (int y = 0; y < rect.height; y++)
+	{
+		unsigned char* ownerRow = owners.ptr(y);
+
+		for (int x = 0; x < rect.width; x++)
+		{
+			int owner = none;
+			int heaviest = 0;
+
+			for (int i = 0; i < plan.camCount; i++)
+			{
+				int weight = plan.weightMaps[i].ptr<unsigned short>(rect.y + y)[rect.x + x];
+				if (weight > heaviest)
+				{
+					heaviest = weight;
+					owner = i;
+				}
+				if (weight > 0)
+					cameras |= 1 << i;
+			}
+
+			ownerRow[x] = owner;
+		}
+	}
+
+	region.cameras.clear();
+	for (int i = 0; i < plan.camCount; i++)
+		if (cameras & (1 << i))
+			region.cameras.push_back(i);
+
+	int slots = region.cameras.size();
+	int levels = region.levels;
+
+	region.sourceMaps.resize(slots);
+	region.masks.assign(slots, vector<Mat>(levels));
+	region.pyramids.assign(slots, vector<Mat>(levels));
+	region.expanded.assign(slots, vector<Mat>(levels));
+	region.warped.resize(slots);
+	region.blended.resize(levels);
+	region.blendedExpanded.resize(levels);
+
+	vector<Size> sizes(levels);
+	sizes[0] = rect.size();
+	for (int level = 1; level < levels; level++)
+		sizes[level] = Size((sizes[level - 1].width + 1) / 2, (sizes[level - 1].height + 1) / 2);
+
+	for (int slot = 0; slot < slots; slot++)
+	{
+		int i = region.cameras[slot];
+		Mat& sourceMap = region.sourceMaps[slot];
+		Mat& mask = region.masks[slot][0];
+
+		sourceMap.create(rect.size(), CV_8U);
+		mask.create(rect.size(), CV_32F);
+
+		// A camera fills the parts it can't see with the seam owner's pixels,
+		// so that its pyramid doesn't drag black in from outside its frame
+		for (int y = 0; y < rect.height; y++)
+		{
+			const unsigned short* weights = plan.weightMaps[i].ptr<unsigned short>(rect.y + y) + rect.x;
+			const unsigned char* ownerRow = owners.ptr(y);
+			unsigned char* sourceRow = sourceMap.ptr(y);
+			float* maskRow = mask.ptr<float>(y);
+
+			for (int x = 0; x < rect.width; x++)
+			{
+				sourceRow[x] = weights[x] > 0 ? i : ownerRow[x];
+				maskRow[x] = ownerRow[x] == i ? 1.0f : 0.0f;
+			}
+		}
+
+		for (int level = 1; level < levels; level++)
+			pyrDown(region.masks[slot][level - 1], region.masks[slot][level], sizes[level]);
+
+		for (int level = 0; level < levels; level++)
+		{
+			region.pyramids[slot][level].create(sizes[level], CV_32FC3);
+			region.expanded[slot][level].create(sizes[level], CV_32FC3);
+		}
+		region.warped[slot].create(rect.size(), CV_8UC3);
+	}
+
+	// Normalize each level so that the blended pyramid keeps its brightness
+	for (int level = 0; level < levels; level++)
+	{
+		Mat total = Mat::zeros(sizes[level], CV_32F);
+		for (int slot = 0; slot < slots; slot++)
+			add(total, region.masks[slot][level], total);
+
+		for (int slot = 0; slot < slots; slot++)
+		{
+			Mat& mask = region.masks[slot][level];
+
+			for (int y = 0; y < mask.rows; y++)
+			{
+				float* maskRow = mask.ptr<float>(y);
+				const float* totalRow = total.ptr<float>(y);
+
+				for (int x = 0; x < mask.cols; x++)
+					maskRow[x] = totalRow[x] > 0 ? maskRow[x] / totalRow[x] : 0.0f;
+			}
+		}
+
+		region.blended[level].create(sizes[level], CV_32FC3);
+		region.blendedExpanded[level].create(sizes[level], CV_32FC3);
+	}
+}
+
+void MultiBandBlender::buildPyramid(const BlendJob& job, Region& region, int slot)
+{
+	const Rect& rect = region.rect;
+	const Mat& sourceMap = region.sourceMaps[slot];
+	Mat& warped = region.warped[slot];
+	vector<Mat>& pyramid = region.pyramids[slot];
+	vector<Mat>& expanded = region.expanded[slot];
+
+	for (int y = 0; y < rect.height; y++)
+	{
+		const unsigned char* sourceRow = sourceMap.ptr(y);
+		unsigned char* warpedRow = warped.ptr(y);
+
+		// Warp each run of pixels taken from the same camera
+		for (int x = 0; x < rect.width; )
+		{
+			int c = sourceRow[x];
+			int end = x + 1;
+			while (end < rect.width && sourceRow[end] == c)
+				end++;
+
+			if (c >= job.plan->camCount)
+				memset(warpedRow + 3 * x, 0, 3 * (end - x));
+			else
+			{
+				WarpKernels::warp(job.sources[c], job.plan->warpMap(c, rect.x + x, rect.y + y), end - x, job.params[c], warpedRow + 3 * x);
+			}
+
+			x = end;
+		}
+	}
+
+	warped.convertTo(pyramid[0], CV_32FC3);
+
+	// Gaussian pyramid
+	for (int level = 1; level < region.levels; level++)
+		pyrDown(pyramid[level - 1], pyramid[level], pyramid[level].size());
+
+	// Laplacian pyramid, in place. Level k only needs level k+1 to still be Gaussian.
+	for (int level = 0; level < region.levels - 1; level++)
+	{
+		pyrUp(pyramid[level + 1], expanded[level], pyramid[level].size());
+		subtract(pyramid[level], expanded[level], pyramid[level]);
+	}
+}
+
+void MultiBandBlender::blendLevel(Region& region, int level)
+{
+	Mat& blended = region.blended[level];
+	blended.setTo(Scalar::all(0));
+
+	for (int slot = 0; slot < region.cameras.size(); slot++)
+	{
+		const Mat& laplacian = region.pyramids[slot][level];
+		const Mat& mask = region.masks[slot][level];
+
+		for (int y = 0; y < blended.rows; y++)
+		{
+			const float* maskRow = mask.ptr<float>(y);
+			const float* laplacianRow = laplacian.ptr<float>(y);
+			float* blendedRow = blended.ptr<float>(y);
+
+			for (int x = 0; x < blended.cols; x++)
+			{
+				float m = maskRow[x];
+				if (m == 0)
+					continue;
+
+				blendedRow[3 * x] += m * laplacianRow[3 * x];
+				blendedRow[3 * x + 1] += m * laplacianRow[3 * x + 1];
+				blendedRow[3 * x + 2] += m * laplacianRow[3 * x + 2];
+			}
+		}
+	}
+}
+
+void MultiBandBlender::collapse(const BlendJob& job, Region& region)
+{
+	vector<Mat>& blended = region.blended;
+
+	for (int level = region.levels - 2; level >= 0; level--)
+	{
+		pyrUp(blended[level + 1], region.blendedExpanded[level], blended[level].size());
+		add(blended[level], region.blendedExpanded[level], blended[level]);
+	}
+
+	const Rect& rect = region.rect;
+	const StitchPlan& plan = *job.plan;
+
+	// Only the overlaps are written, the canvas already has the rest
+	for (int r = region.coreStart; r < region.coreEnd; r++)
+	{
+		const float* blendedRow = blended[0].ptr<float>(r - rect.y);
+		unsigned char* canvasRow = job.canvas->ptr(r);
+
+		for (int s = plan.rowSegments[r]; s < plan.rowSegments[r + 1]; s++)
+		{
+			const StitchPlan::Segment& segment = plan.segments[s];
+			if (segment.count < 2)
+				continue;
+
+			int begin = max(segment.begin, rect.x);
+			int end = min(segment.end, rect.x + rect.width);
+
+			for (int c = 3 * begin; c < 3 * end; c++)
+				canvasRow[c] = saturate_cast<uchar>(blendedRow[c - 3 * rect.x]);
+		}
+	}
+}
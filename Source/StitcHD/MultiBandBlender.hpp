@@ -0,0 +1,123 @@
+/*
+This file is part of StitcHD.
+
+StitcHD is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+StitcHD is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with StitcHD.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MULTIBANDBLENDER_HPP
+#define MULTIBANDBLENDER_HPP
+
+#include "Config.hpp"
+#include "StitchPlan.hpp"
+#include "WorkerPool.hpp"
+#include "WarpKernels.hpp"
+
+#include <vector>
+using namespace std;
+
+#include <opencv2/core/core.hpp>
+using namespace cv;
+
+// Multi-band (Laplacian pyramid) blending of the overlaps between frames.
+// Each frame is split into frequency bands; low bands are blended across a
+// wide area and high bands across a narrow one, which evens out exposure
+// without ghosting fine detail. Pyramids are only built over rectangles
+// around the overlaps, and every buffer is kept from one frame to the next.
+class MultiBandBlender
+{
+public:
+
+	MultiBandBlender();
+
+	// Pyramid levels, counting the full resolution one
+	static const int MaxLevels = 5;
+
+	// Blends the pixels of canvas which more than one frame covers, leaving
+	// the rest as they are. The plan's weights must be built for alphaBlend 4.
+	void blend(const StitchPlan& plan, Mat* images, const WarpKernels::Params* params, Mat& canvas, WorkerPool& pool);
+
+	// Number of times the regions and masks have been rebuilt
+	int builds;
+
+private:
+
+	// A rectangle of the canvas which is blended on its own
+	struct Region
+	{
+		Rect rect;			// Blended area, overlap plus margin
+		int coreStart;		// Canvas rows [coreStart, coreEnd) are written back
+		int coreEnd;
+		int levels;
+		vector<int> cameras;
+
+		// Camera sampled at each pixel for each entry in cameras. A camera's
+		// own pixels where it has any, the seam owner's elsewhere, 255 if none.
+		vector<Mat> sourceMaps;
+
+		// Seam masks smoothed down the pyramid and normalized so that they
+		// add up to 1 at every pixel, per camera per level (CV_32F)
+		vector<vector<Mat> > masks;
+
+		// Per camera per level: Gaussian then Laplacian pyramids (CV_32FC3)
+		vector<vector<Mat> > pyramids;
+		vector<vector<Mat> > expanded;
+		vector<Mat> warped;
+
+		// The blended pyramid, collapsed in place
+		vector<Mat> blended;
+		vector<Mat> blendedExpanded;
+	};
+
+	vector<Region> regions;
+
+	// The plan the regions were built for
+	const StitchPlan* planSource;
+	int planBuilds;
+	int planWeightBuilds;
+
+	// Canvas rows per region before merging
+	static const int BandRows = 128;
+
+	// What the current call to blend is working on
+	struct BlendJob
+	{
+		MultiBandBlender* blender;
+		const StitchPlan* plan;
+		const WarpKernels::Source* sources;
+		const WarpKernels::Params* params;
+		Mat* canvas;
+	};
+
+	// (region, index) pairs for the parallel stages
+	vector<Point> pyramidJobs;
+	vector<Point> levelJobs;
+
+	void buildRegions(const StitchPlan& plan);
+	void buildMasks(const StitchPlan& plan, Region& region);
+
+	static void pyramidJob(void* context, int job);
+	static void levelJob(void* context, int job);
+	static void collapseJob(void* context, int job);
+
+	// Warps the camera into region.warped and builds its Laplacian pyramid
+	void buildPyramid(const BlendJob& job, Region& region, int slot);
+
+	// Adds up the Laplacians of one level, weighted by the masks
+	void blendLevel(Region& region, int level);
+
+	// Collapses the blended pyramid and writes the overlaps back to the canvas
+	void collapse(const BlendJob& job, Region& region);
+};
+
+#endif // MULTIBANDBLENDER_HPP
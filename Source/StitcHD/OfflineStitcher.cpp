@@ -0,0 +1,385 @@
+/*
+This file is part of StitcHD.
+
+StitcHD is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+StitcHD is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with StitcHD.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "OfflineStitcher.hpp"
+#include "Homographier.hpp"
+#include "WorkerPool.hpp"
+
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include <iostream>
+using namespace std;
+
+OfflineStitcher::OfflineStitcher(const Config& c)
+	:config(c)
+{
+	running = false;
+	writer = NULL;
+	rawWriter = NULL;
+	written = 0;
+
+	// Each slot stitches on its own thread, so the slots are the parallelism
+	config.stitchThreads = 1;
+
+	for (int i=0; i<MAX_CAMERAS; i++)
+	{
+		hmgs[i] = Mat::eye(3, 3, CV_64FC1);
+		gains[i] = Scalar(1, 1, 1);
+	}
+}
+
+OfflineStitcher::~OfflineStitcher()
+{
+	stopSlots();
+
+	delete writer;
+	delete rawWriter;
+}
+
+int OfflineStitcher::run(const vector<string>& inputFiles, const string& outputFile)
+{
+	if (inputFiles.size() != config.camCount)
+	{
+		cout << "ERROR: Need " << config.camCount << " video files, got " << inputFiles.size() << '.' << endl;
+		return -1;
+	}
+
+	captures.clear();
+	captures.resize(inputFiles.size());
+	for (int i=0; i<inputFiles.size(); i++)
+	{
+		if (!captures[i].open(inputFiles[i]))
+		{
+			cout << "ERROR: Could not open " << inputFiles[i] << endl;
+			return -1;
+		}
+	}
+
+	if (startSlots())
+		return -1;
+
+	written = 0;
+
+	// The first frame set calibrates, and is stitched here so that the
+	// one-time setup in ImageStitcher happens before the slots run at once
+	Slot& first = slots[0];
+	if (!readFrames(first) || !calibrate(first.frames))
+	{
+		stopSlots();
+		return -1;
+	}
+
+	stitch(first);
+
+	double fps = captures[0].get(CV_CAP_PROP_FPS);
+	if (fps <= 0)
+		fps = 20;
+
+	outputSize = first.panorama.size();
+	if (!openOutput(outputFile, outputSize, fps))
+	{
+		stopSlots();
+		return -1;
+	}
+
+	first.frame = 0;
+	first.busy = true;
+	SetEvent(first.doneEvent);
+
+	// Frame n waits for its slot's last frame, n - slots, to be written
+	long long n = 1;
+	for ( ; ; n++)
+	{
+		Slot& slot = slots[n % slots.size()];
+		finish(slot);
+
+		if (!readFrames(slot))
+			break;
+
+		slot.frame = n;
+		slot.busy = true;
+		SetEvent(slot.startEvent);
+	}
+
+	// Whatever is still in flight, oldest first
+	for (int i=1; i<slots.size(); i++)
+		finish(slots[(n + i) % slots.size()]);
+
+	stopSlots();
+
+	delete writer;
+	writer = NULL;
+	delete rawWriter;
+	rawWriter = NULL;
+
+	return written;
+}
+
+int OfflineStitcher::slotCount() const
+{
+	if (config.offlineFrames > 0)
+		return config.offlineFrames;
+
+	return WorkerPool::processorCount();
+}
+
+bool OfflineStitcher::readFrames(Slot& slot)
+{
+	for (int i=0; i<captures.size(); i++)
+	{
+		// read() hands back the capture's own buffer, which the next read reuses
+		Mat frame;
+		if (!captures[i].read(frame) || frame.rows <= 0 || frame.cols <= 0)
+			return false;
+
+		if (config.camInverted[i])
+			flip(frame, slot.frames[i], -1);
+		else
+			frame.copyTo(slot.frames[i]);
+	}
+
+	return true;
+}
+
+bool OfflineStitcher::calibrate(Mat* frames)
+{
+	for (int i=0; i<config.hmgCount; i++)
+	{
+		Homographier homographier(i,
+			config,
+			NULL,
+			NULL,
+			config.hmgDirections[i][0],
+			config.hmgDirections[i][1]);
+
+		frames[config.hmgTargets[i][0]].copyTo(homographier.frameA);
+		frames[config.hmgTargets[i][1]].copyTo(homographier.frameB);
+
+		Mat h;
+		try
+		{
+			h = homographier.findHomography(homographier.frameA, homographier.frameB);
+		}
+		catch (Exception &e)
+		{
+			cout << "ERROR: " << e.msg << endl;
+		}
+
+		if (h.rows <= 0 || h.cols <= 0)
+		{
+			cout << "ERROR: No homography for cameras " << config.hmgTargets[i][0]
+				<< " and " << config.hmgTargets[i][1] << '.' << endl;
+			return false;
+		}
+
+		hmgs[i] = h;
+
+		Scalar gain;
+		if (config.gainCompensation && homographier.measureGain(h, gain))
+			gains[i] = gain;
+	}
+
+	return true;
+}
+
+void OfflineStitcher::stitch(Slot& slot)
+{
+	Rect view;
+	double scale = 1;
+	Size canvasSize;
+
+	// hmgs and gains are only read while the slots run
+	slot.panorama = slot.stitcher->stitchView(slot.frames, hmgs,
+		config.gainCompensation ? gains : NULL, config, view, scale, canvasSize);
+}
+
+bool OfflineStitcher::openOutput(const string& outputFile, Size size, double fps)
+{
+	if (config.recordFormat == 1)
+	{
+		rawWriter = new Y4mWriter();
+		if (!rawWriter->open(outputFile, size, (int)(fps + 0.5)))
+		{
+			cout << "ERROR: Could not open " << outputFile << endl;
+			return false;
+		}
+	}
+	else
+	{
+		writer = new VideoWriter(outputFile, CV_FOURCC('P','I','M','1'), fps, size);
+		if (!writer->isOpened())
+		{
+			cout << "ERROR: Could not open " << outputFile << endl;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void OfflineStitcher::finish(Slot& slot)
+{
+	if (!slot.busy)
+		return;
+
+	WaitForSingleObject(slot.doneEvent, INFINITE);
+	slot.busy = false;
+
+	if (slot.panorama.rows <= 0 || slot.panorama.cols <= 0)
+	{
+		cout << "Frame " << slot.frame << " could not be stitched." << endl;
+		return;
+	}
+
+	// The panorama is the stitcher's own canvas, which stays put until the
+	// slot's next frame, so it is written without a copy. The output keeps
+	// the first frame's size, like a recording does.
+	if (rawWriter != NULL)
+	{
+		rawWriter->write(slot.panorama);
+	}
+	else if (slot.panorama.size() == outputSize)
+	{
+		*writer << slot.panorama;
+	}
+	else
+	{
+		Mat resized;
+		resize(slot.panorama, resized, outputSize);
+		*writer << resized;
+	}
+
+	written++;
+}
+
+int OfflineStitcher::startSlots()
+{
+	stopSlots();
+
+	// The threads hold pointers into slots, so it is sized once
+	slots.resize(slotCount());
+	running = true;
+
+	for (int i=0; i<slots.size(); i++)
+	{
+		slots[i].owner = this;
+		slots[i].stitcher = NULL;
+		slots[i].frame = -1;
+		slots[i].busy = false;
+		slots[i].threadHandle = NULL;
+		slots[i].startEvent = NULL;
+		slots[i].doneEvent = NULL;
+	}
+
+	for (int i=0; i<slots.size(); i++)
+	{
+		slots[i].stitcher = new ImageStitcher();
+
+		slots[i].startEvent = CreateEvent(
+			NULL,               // default security attributes
+			false,				// manual-reset?
+			false,              // initial state
+			NULL				// object name
+			);
+
+		slots[i].doneEvent = CreateEvent(
+			NULL,               // default security attributes
+			false,				// manual-reset?
+			false,              // initial state
+			NULL				// object name
+			);
+
+		if (slots[i].startEvent == NULL || slots[i].doneEvent == NULL)
+		{
+			printf("CreateEvent failed (%d)\n", GetLastError());
+			stopSlots();
+			return -1;
+		}
+	}
+
+	for (int i=0; i<slots.size(); i++)
+	{
+		slots[i].threadHandle = CreateThread(
+			NULL,				// default security attributes
+			0,					// use default stack size
+			StartThread,		// thread function name
+			&slots[i],			// argument to thread function
+			0,					// use default creation flags
+			NULL);				// returns the thread identifier
+
+		if (slots[i].threadHandle == NULL)
+		{
+			cout << "Could not start OfflineStitcher thread " << i << '.' << endl;
+			stopSlots();
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+void OfflineStitcher::stopSlots()
+{
+	running = false;
+
+	for (int i=0; i<slots.size(); i++)
+	{
+		if (slots[i].threadHandle == NULL)
+			continue;
+
+		SetEvent(slots[i].startEvent);
+		WaitForSingleObject(slots[i].threadHandle, INFINITE);
+		CloseHandle(slots[i].threadHandle);
+	}
+
+	for (int i=0; i<slots.size(); i++)
+	{
+		if (slots[i].startEvent != NULL)
+			CloseHandle(slots[i].startEvent);
+		if (slots[i].doneEvent != NULL)
+			CloseHandle(slots[i].doneEvent);
+		delete slots[i].stitcher;
+	}
+
+	slots.clear();
+}
+
+int OfflineStitcher::runSlot(Slot& slot)
+{
+	while (true)
+	{
+		WaitForSingleObject(slot.startEvent, INFINITE);
+
+		if (!running)
+			break;
+
+		try
+		{
+			stitch(slot);
+		}
+		catch (Exception &e)
+		{
+			cout << "ERROR: " << e.msg << endl;
+			slot.panorama = Mat();
+		}
+
+		SetEvent(slot.doneEvent);
+	}
+
+	return 0;
+}
@@ -0,0 +1,122 @@
+/*
+This file is part of StitcHD.
+
+StitcHD is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+StitcHD is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with StitcHD.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef OFFLINESTITCHER_HPP
+#define OFFLINESTITCHER_HPP
+
+#include "Config.hpp"
+#include "ImageStitcher.hpp"
+#include "Y4mWriter.hpp"
+
+#include <Windows.h>
+
+#include <string>
+#include <vector>
+using namespace std;
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+using namespace cv;
+
+// Stitches video files, one per camera, as fast as the machine allows
+// rather than keeping pace with live cameras. The homographies and gains
+// are found once, from the first frames, and shared read-only. Several
+// frame sets are then stitched at once, each by a slot with its own
+// ImageStitcher and thread. Frame n goes to slot n % slots once frame
+// n - slots has been written, so the slots make up a reorder buffer and
+// the panoramas come out in the order the frames were read.
+class OfflineStitcher
+{
+public:
+
+	OfflineStitcher(const Config& config);
+	~OfflineStitcher();
+
+	// Stitches inputFiles, one per camera, into outputFile. Returns the
+	// number of panoramas written, or -1 if nothing could be.
+	int run(const vector<string>& inputFiles, const string& outputFile);
+
+	// Frames stitched at once, from config.offlineFrames
+	int slotCount() const;
+
+private:
+
+	Config config;
+
+	// Shared by every slot, fixed before any of them start
+	Mat hmgs[MAX_CAMERAS];
+	Scalar gains[MAX_CAMERAS];
+
+	struct Slot
+	{
+		OfflineStitcher* owner;
+		ImageStitcher* stitcher;
+		Mat frames[MAX_CAMERAS];
+		Mat panorama;
+		long long frame;	// Which frame set the slot holds, -1 if none
+		bool busy;			// Being stitched, or stitched and not written yet
+		HANDLE threadHandle;
+		HANDLE startEvent;
+		HANDLE doneEvent;
+	};
+
+	vector<Slot> slots;
+	volatile bool running;
+
+	vector<VideoCapture> captures;
+
+	// One of them is open while run() writes
+	VideoWriter* writer;
+	Y4mWriter* rawWriter;
+	Size outputSize;
+	int written;
+
+	// Reads the next frame of every capture into slot.frames
+	bool readFrames(Slot& slot);
+
+	// Finds the homographies and gains from a frame set
+	bool calibrate(Mat* frames);
+
+	// Stitches the slot's frames on the calling thread
+	void stitch(Slot& slot);
+
+	// Opens the output for panoramas of size, at fps
+	bool openOutput(const string& outputFile, Size size, double fps);
+
+	// Waits for the slot's frames if they are in flight, and writes them
+	void finish(Slot& slot);
+
+	int startSlots();
+	void stopSlots();
+
+	// Thread entry point
+	static DWORD WINAPI StartThread(LPVOID arg)
+	{
+		Slot* slot = (Slot*)arg;
+		return slot->owner->runSlot(*slot);
+	}
+
+	// Thread function
+	int runSlot(Slot& slot);
+
+	// Not copyable
+	OfflineStitcher(const OfflineStitcher&);
+	OfflineStitcher& operator=(const OfflineStitcher&);
+};
+
+#endif // OFFLINESTITCHER_HPP
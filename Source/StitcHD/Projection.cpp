@@ -0,0 +1,108 @@
+/*
+This file is part of StitcHD.
+
+StitcHD is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+StitcHD is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with StitcHD.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Projection.hpp"
+
+#include <cmath>
+
+Projection::Projection()
+	:type(Planar),
+	focal(1),
+	center(0, 0),
+	offset(0, 0)
+{
+}
+
+Projection::Projection(int type, double focal, Point2d center)
+	:type(type),
+	focal(focal),
+	center(center),
+	offset(0, 0)
+{
+}
+
+double Projection::maxAngle()
+{
+	// 85 degrees, beyond which the plane is too stretched to sample
+	return 85.0 * CV_PI / 180.0;
+}
+
+bool Projection::operator==(const Projection& other) const
+{
+	if (type != other.type)
+		return false;
+
+	// The rest doesn't affect a planar canvas
+	if (type == Planar)
+		return true;
+
+	return focal == other.focal && center == other.center && offset == other.offset;
+}
+
+bool Projection::toPlane(double u, double v, double& x, double& y) const
+{
+	if (type == Planar)
+	{
+		x = u + offset.x;
+		y = v + offset.y;
+		return true;
+	}
+
+	double theta = (u + offset.x - center.x) / focal;
+	double height = (v + offset.y - center.y) / focal;
+
+	if (fabs(theta) > maxAngle())
+		return false;
+
+	if (type == Cylindrical)
+	{
+		// The ray (sin theta, height, cos theta) meets the plane z = 1
+		x = center.x + focal * tan(theta);
+		y = center.y + focal * height / cos(theta);
+		return true;
+	}
+
+	// Spherical, height is the elevation angle and the ray is
+	// (sin theta * cos phi, sin phi, cos theta * cos phi)
+	if (fabs(height) > maxAngle())
+		return false;
+
+	x = center.x + focal * tan(theta);
+	y = center.y + focal * tan(height) / cos(theta);
+	return true;
+}
+
+void Projection::fromPlane(double x, double y, double& u, double& v) const
+{
+	if (type == Planar)
+	{
+		u = x;
+		v = y;
+		return;
+	}
+
+	double pX = (x - center.x) / focal;
+	double pY = (y - center.y) / focal;
+	double radius = sqrt(1 + pX * pX);
+
+	u = center.x + focal * atan(pX);
+
+	if (type == Cylindrical)
+		v = center.y + focal * pY / radius;
+	else
+		v = center.y + focal * atan2(pY, radius);
+}
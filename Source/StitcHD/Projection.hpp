@@ -0,0 +1,61 @@
+/*
+This file is part of StitcHD.
+
+StitcHD is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+StitcHD is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with StitcHD.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PROJECTION_HPP
+#define PROJECTION_HPP
+
+#include <opencv2/core/core.hpp>
+using namespace cv;
+
+// Maps canvas pixels onto the image plane of the first camera, which every
+// homography is relative to. A planar canvas is that plane itself, and
+// stretches without bound towards 90 degrees off the first camera's axis.
+// Cylindrical and spherical canvases measure angles instead, so they don't.
+class Projection
+{
+public:
+
+	enum Type
+	{
+		Planar = 0,
+		Cylindrical = 1,
+		Spherical = 2
+	};
+
+	Projection();
+	Projection(int type, double focal, Point2d center);
+
+	int type;
+	double focal;		// In pixels of the first frame
+	Point2d center;		// Principal point of the first frame
+	Point2d offset;		// Projected coordinates of canvas pixel (0, 0)
+
+	// Furthest a curved canvas reaches from the first camera's axis, in radians
+	static double maxAngle();
+
+	bool operator==(const Projection& other) const;
+	bool operator!=(const Projection& other) const { return !(*this == other); }
+
+	// The point on the first frame's plane which canvas pixel (u, v) shows.
+	// False if it's too far round to reach the plane.
+	bool toPlane(double u, double v, double& x, double& y) const;
+
+	// Projected coordinates of a point on the first frame's plane, without the offset
+	void fromPlane(double x, double y, double& u, double& v) const;
+};
+
+#endif // PROJECTION_HPP
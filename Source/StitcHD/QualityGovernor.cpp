@@ -0,0 +1,142 @@
+/*
+This file is part of StitcHD.
+
+StitcHD is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+StitcHD is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with StitcHD.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "QualityGovernor.hpp"
+
+#include <iostream>
+using namespace std;
+
+// Weight of each new frame in the running averages
+static const double AverageWeight = 0.125;
+
+QualityGovernor::QualityGovernor()
+{
+	level = Full;
+	frameTime = 0;
+	captureTime = 0;
+	stitchTime = 0;
+	averaged = false;
+	settleFrames = 0;
+	overFrames = 0;
+	underFrames = 0;
+}
+
+void QualityGovernor::update(int targetTime, int frameMs, int captureMs, int stitchMs)
+{
+	// Timer::msTime gives -1 for times it couldn't measure
+	if (frameMs < 0 || captureMs < 0 || stitchMs < 0)
+		return;
+
+	// The frames just after a change pay for it, e.g. rebuilding the weights
+	if (settleFrames > 0)
+	{
+		settleFrames--;
+		return;
+	}
+
+	if (!averaged)
+	{
+		frameTime = frameMs;
+		captureTime = captureMs;
+		stitchTime = stitchMs;
+		averaged = true;
+	}
+	else
+	{
+		frameTime += (frameMs - frameTime) * AverageWeight;
+		captureTime += (captureMs - captureTime) * AverageWeight;
+		stitchTime += (stitchMs - stitchTime) * AverageWeight;
+	}
+
+	if (targetTime <= 0)
+	{
+		if (level != Full)
+			setLevel(Full);
+		return;
+	}
+
+	// Cheaper stitching only helps if the stitch is a good part of the
+	// frame. Cameras slower than the target are left alone.
+	if (frameTime > targetTime && stitchTime * 4 >= frameTime)
+	{
+		underFrames = 0;
+		if (++overFrames >= StepDownFrames && level + 1 < LevelCount)
+			setLevel(Level(level + 1));
+	}
+	else if (frameTime * 100 < targetTime * Headroom)
+	{
+		overFrames = 0;
+		if (++underFrames >= StepUpFrames && level > Full)
+			setLevel(Level(level - 1));
+	}
+	else
+	{
+		overFrames = 0;
+		underFrames = 0;
+	}
+}
+
+void QualityGovernor::apply(const Config& config, Config& governed) const
+{
+	governed = config;
+
+	if (level >= NoInterpolation)
+		governed.interpolate = false;
+
+	// Multi-band and seam cut cost more than linear. Exponential and the
+	// others are baked into the weights, so they cost the same.
+	if (level >= LinearBlend && governed.alphaBlend >= 4)
+		governed.alphaBlend = 2;
+}
+
+double QualityGovernor::viewScale() const
+{
+	if (level >= HalfScale)
+		return 0.5;
+	if (level >= ThreeQuarterScale)
+		return 0.75;
+	return 1;
+}
+
+const char* QualityGovernor::levelName(Level level)
+{
+	switch (level)
+	{
+	case Full:				return "Full";
+	case NoInterpolation:	return "No interpolation";
+	case LinearBlend:		return "Linear blend";
+	case ThreeQuarterScale:	return "3/4 scale";
+	case HalfScale:			return "1/2 scale";
+	case FewerHomographies:	return "Fewer homographies";
+	default:				return "Unknown";
+	}
+}
+
+void QualityGovernor::setLevel(Level newLevel)
+{
+	level = newLevel;
+	overFrames = 0;
+	underFrames = 0;
+
+	// Start the averages over once the change has settled, so that the
+	// next step is judged on this level's frames alone
+	settleFrames = SettleFrames;
+	averaged = false;
+
+	cout << "Quality level: " << levelName(level) << endl;
+}
@@ -0,0 +1,98 @@
+/*
+This file is part of StitcHD.
+
+StitcHD is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+StitcHD is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with StitcHD.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef QUALITYGOVERNOR_HPP
+#define QUALITYGOVERNOR_HPP
+
+#include "Config.hpp"
+
+// Holds the stitcher to config.targetFrameTime when the machine can't
+// keep up at full quality. Each level gives up one more thing: first
+// interpolation, then the costlier blends, then output resolution, then
+// homographier cycles, which compete with the stitch for the processors.
+// It steps down after a few frames over the target, and back up after a
+// longer run of frames with headroom to spare, so that it doesn't bounce
+// between two levels.
+class __declspec(dllexport) QualityGovernor
+{
+public:
+
+	enum Level
+	{
+		Full,
+		NoInterpolation,
+		LinearBlend,
+		ThreeQuarterScale,
+		HalfScale,
+		FewerHomographies,
+		LevelCount
+	};
+
+	QualityGovernor();
+
+	// Takes one frame's timings in ms: the whole frame, from the last one
+	// to this one, and the parts spent waiting for cameras and stitching.
+	// A targetTime of 0 turns the governor off.
+	void update(int targetTime, int frameTime, int captureTime, int stitchTime);
+
+	// Copies config into governed, less what the current level gives up
+	void apply(const Config& config, Config& governed) const;
+
+	// Scale of the displayed view at the current level
+	double viewScale() const;
+
+	// Whether the homographiers should pause between cycles for as long as
+	// each cycle takes
+	bool fewerHomographies() const { return level >= FewerHomographies; }
+
+	Level getLevel() const { return level; }
+	static const char* levelName(Level level);
+
+	// Running averages of the timings given to update()
+	int averageFrameTime() const { return (int)(frameTime + 0.5); }
+	int averageCaptureTime() const { return (int)(captureTime + 0.5); }
+	int averageStitchTime() const { return (int)(stitchTime + 0.5); }
+
+	// Frames over the target before stepping down, and with headroom
+	// before stepping up
+	static const int StepDownFrames = 8;
+	static const int StepUpFrames = 30;
+
+	// Stepping up needs the average frame under this % of the target
+	static const int Headroom = 70;
+
+	// Frames left out of the averages after each change of level
+	static const int SettleFrames = 2;
+
+private:
+
+	Level level;
+
+	double frameTime;
+	double captureTime;
+	double stitchTime;
+	bool averaged;
+	int settleFrames;
+
+	int overFrames;
+	int underFrames;
+
+	void setLevel(Level newLevel);
+};
+
+#endif // QUALITYGOVERNOR_HPP
@@ -0,0 +1,110 @@
+/*
+This file is part of StitcHD.
+
+StitcHD is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+StitcHD is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with StitcHD.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "ScanlineWarp.hpp"
+#include "Homographier.hpp"
+
+#include <cmath>
+#include <algorithm>
+using namespace std;
+
+ScanlineWarp::ScanlineWarp(const Mat& homography, double maxError)
+	:maxError(maxError)
+{
+	for (int r=0; r<3; r++)
+		for (int c=0; c<3; c++)
+			h[r][c] = homography.at<HOM_MAT_TYPE>(r, c);
+}
+
+int ScanlineWarp::runLength(double z, double dz, double curvature) const
+{
+	if (maxError <= 0 || z <= 0)
+		return 1;
+
+	// An affine row is exact however far apart the knots are
+	if (curvature == 0)
+		return MaxRun;
+
+	// Along the row x(t) = (a + b t) / (c + d t), so x'' = 2 d (ad - bc) / z^3,
+	// and a chord over n pixels is off by at most n^2 |x''| / 8. The
+	// denominator is smallest at one end, so the far end is checked too.
+	double n = sqrt(4 * maxError * z * z * z / curvature);
+
+	if (dz < 0)
+	{
+		double zEnd = z + dz * min(n, double(MaxRun));
+		if (zEnd <= 0)
+			return 1;
+		n = sqrt(4 * maxError * zEnd * zEnd * zEnd / curvature);
+	}
+
+	return n < 1 ? 1 : (n > MaxRun ? MaxRun : int(n));
+}
+
+void ScanlineWarp::row(int y, int x0, int count, Point2f* map) const
+{
+	// Per pixel step, and value at x0, of both numerators and the denominator
+	double dX = h[0][0];
+	double dY = h[1][0];
+	double dZ = h[2][0];
+	double X = h[0][0] * x0 + h[0][1] * y + h[0][2];
+	double Y = h[1][0] * x0 + h[1][1] * y + h[1][2];
+	double Z = h[2][0] * x0 + h[2][1] * y + h[2][2];
+
+	// |d (ad - bc)| for each coordinate, which is the same all along the row
+	double cX = fabs(dZ * (X * dZ - dX * Z));
+	double cY = fabs(dZ * (Y * dZ - dY * Z));
+	double curvature = max(cX, cY);
+
+	int i = 0;
+	while (i < count)
+	{
+		double scale = 1. / Z;
+		double x = X * scale;
+		double y = Y * scale;
+		map[i] = Point2f(float(x), float(y));
+
+		int run = min(runLength(Z, dZ, curvature), count - 1 - i);
+
+		if (run <= 1)
+		{
+			X += dX;
+			Y += dY;
+			Z += dZ;
+			i++;
+			continue;
+		}
+
+		// The knot at the end of the run
+		double endX = X + dX * run;
+		double endY = Y + dY * run;
+		double endZ = Z + dZ * run;
+		double endScale = 1. / endZ;
+
+		double stepX = (endX * endScale - x) / run;
+		double stepY = (endY * endScale - y) / run;
+
+		for (int k = 1; k < run; k++)
+			map[i + k] = Point2f(float(x + stepX * k), float(y + stepY * k));
+
+		X = endX;
+		Y = endY;
+		Z = endZ;
+		i += run;
+	}
+}
@@ -0,0 +1,54 @@
+/*
+This file is part of StitcHD.
+
+StitcHD is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+StitcHD is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with StitcHD.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef SCANLINEWARP_HPP
+#define SCANLINEWARP_HPP
+
+#include <opencv2/core/core.hpp>
+using namespace cv;
+
+// Maps runs of canvas pixels through a homography without a full projection
+// per pixel. Along a row the numerators and the denominator change by a
+// constant step, so they are stepped rather than recomputed. Where the
+// mapping is near enough to affine, only knots are projected and the
+// coordinates between them are interpolated linearly.
+class ScanlineWarp
+{
+public:
+
+	// maxError is the furthest, in frame pixels, an interpolated coordinate
+	// may be from the exact one. 0 projects every pixel.
+	ScanlineWarp(const Mat& homography, double maxError);
+
+	// Longest run interpolated between two knots
+	static const int MaxRun = 64;
+
+	// The frame coordinates of pixels (x0, y) .. (x0 + count - 1, y)
+	void row(int y, int x0, int count, Point2f* map) const;
+
+private:
+
+	double h[3][3];
+	double maxError;
+
+	// How far past a pixel whose denominator is z the next knot may be.
+	// curvature is what the row's second derivative scales with.
+	int runLength(double z, double dz, double curvature) const;
+};
+
+#endif // SCANLINEWARP_HPP
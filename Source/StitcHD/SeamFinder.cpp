@@ -0,0 +1,482 @@
+/*
+This file is part of StitcHD.
+
+StitcHD is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+StitcHD is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with StitcHD.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "SeamFinder.hpp"
+
+#include <cfloat>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+using namespace std;
+
+// Cost of the samples outside an overlap, which seams can't cross
+static const float Unreachable = FLT_MAX;
+
+// Added to every step of a seam, so that of two equally good seams the
+// shorter wins, and to a seam that has to jump across a row
+static const float StepCost = 1;
+static const float JumpCost = 3 * 255;
+
+SeamFinder::SeamFinder()
+	:requests(0),
+	running(false),
+	threadHandle(NULL),
+	requestEvent(NULL),
+	seamsMutex(NULL),
+	busy(false),
+	inputCount(0),
+	inputBuilds(-1),
+	framesSinceCheck(0)
+{
+}
+
+SeamFinder::~SeamFinder()
+{
+	stop();
+}
+
+int SeamFinder::start()
+{
+	if (running)
+		return 0;
+
+	requestEvent = CreateEvent(
+		NULL,               // default security attributes
+		false,				// manual-reset?
+		false,              // initial state
+		NULL				// object name
+		);
+
+	if (requestEvent == NULL)
+	{
+		printf("CreateEvent failed (%d)\n", GetLastError());
+		return -1;
+	}
+
+	seamsMutex = CreateMutex(
+		NULL,			// default security attributes
+		false,			// initial state
+		NULL);			// name
+
+	if (seamsMutex == NULL)
+	{
+		printf("CreateMutex error: %d\n", GetLastError());
+		CloseHandle(requestEvent);
+		requestEvent = NULL;
+		return -1;
+	}
+
+	busy = false;
+	running = true;
+
+	threadHandle = CreateThread(
+		NULL,				// default security attributes
+		0,					// use default stack size
+		StartThread,		// thread function name
+		this,				// argument to thread function
+		0,					// use default creation flags
+		NULL);				// returns the thread identifier
+
+	if (threadHandle == NULL)
+	{
+		cout << "Could not start the SeamFinder thread." << endl;
+		running = false;
+		CloseHandle(requestEvent);
+		CloseHandle(seamsMutex);
+		requestEvent = NULL;
+		seamsMutex = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+int SeamFinder::stop()
+{
+	if (!running)
+		return 0;
+
+	running = false;
+
+	// Lets a seam in progress finish
+	SetEvent(requestEvent);
+	WaitForSingleObject(threadHandle, INFINITE);
+
+	CloseHandle(threadHandle);
+	CloseHandle(requestEvent);
+	CloseHandle(seamsMutex);
+	threadHandle = NULL;
+	requestEvent = NULL;
+	seamsMutex = NULL;
+
+	// Whatever the input was, it gets sampled again
+	busy = false;
+	inputBuilds = -1;
+
+	return 0;
+}
+
+bool SeamFinder::update(const StitchPlan& plan, Mat* images, const WarpKernels::Params* params)
+{
+	if (plan.camCount < 2 || start())
+		return false;
+
+	bool planChanged = plan.builds != inputBuilds;
+
+	if (!planChanged && ++framesSinceCheck < CheckFrames)
+		return false;
+
+	WaitForSingleObject(seamsMutex, INFINITE);
+	bool working = busy;
+	ReleaseMutex(seamsMutex);
+
+	// Tried again next frame
+	if (working)
+		return false;
+
+	framesSinceCheck = 0;
+
+	sample(plan, images, params);
+
+	if (!planChanged && !overlapsChanged(plan.camCount))
+		return false;
+
+	inputCount = plan.camCount;
+	for (int i=0; i<inputCount; i++)
+	{
+		samples[i].copyTo(inputSamples[i]);
+		coverage[i].copyTo(inputCoverage[i]);
+	}
+
+	inputBuilds = plan.builds;
+	requests++;
+
+	WaitForSingleObject(seamsMutex, INFINITE);
+	busy = true;
+	ReleaseMutex(seamsMutex);
+
+	SetEvent(requestEvent);
+
+	return true;
+}
+
+bool SeamFinder::takeSeams(Mat& labels)
+{
+	if (!running)
+		return false;
+
+	WaitForSingleObject(seamsMutex, INFINITE);
+	bool ready = !seams.empty();
+	if (ready)
+	{
+		labels = seams;
+		seams.release();
+	}
+	ReleaseMutex(seamsMutex);
+
+	return ready;
+}
+
+void SeamFinder::sample(const StitchPlan& plan, Mat* images, const WarpKernels::Params* params)
+{
+	Size size((plan.canvasSize.width + Scale - 1) / Scale, (plan.canvasSize.height + Scale - 1) / Scale);
+
+	for (int i=0; i<plan.camCount; i++)
+	{
+		samples[i].create(size, CV_8UC3);
+		coverage[i].create(size, CV_8U);
+
+		const Mat& image = images[i];
+		const WarpKernels::Params& p = params[i];
+
+		for (int r = 0; r < size.height; r++)
+		{
+			int y = min(r * Scale + Scale / 2, plan.canvasSize.height - 1);
+			unsigned char* sampleRow = samples[i].ptr<unsigned char>(r);
+			unsigned char* coverageRow = coverage[i].ptr<unsigned char>(r);
+
+			for (int c = 0; c < size.width; c++)
+			{
+				int x = min(c * Scale + Scale / 2, plan.canvasSize.width - 1);
+				WarpKernels::Map map = plan.warpMap(i, x, y);
+
+				float tX, tY;
+				WarpKernels::unpackMap(map.xy, map.fractions[0], tX, tY);
+
+				coverageRow[c] = WarpKernels::inFrame(tX, tY, image.cols, image.rows, p.interpolate);
+				if (!coverageRow[c])
+				{
+					sampleRow[3*c] = sampleRow[3*c + 1] = sampleRow[3*c + 2] = 0;
+					continue;
+				}
+
+				// The nearest pixel, with the gain the stitch will give it
+				const unsigned char* pixel = image.ptr<unsigned char>(int(tY + 0.5f)) + 3 * int(tX + 0.5f);
+
+				for (int k=0; k<3; k++)
+				{
+					int v = (pixel[k] * p.gain[k] + (1 << (WarpKernels::GainBits - 1))) >> WarpKernels::GainBits;
+					sampleRow[3*c + k] = (unsigned char)min(v, 255);
+				}
+			}
+		}
+	}
+}
+
+bool SeamFinder::overlapsChanged(int camCount) const
+{
+	if (inputCount != camCount || inputSamples[0].size() != samples[0].size())
+		return true;
+
+	int overlaps = 0;
+	int changes = 0;
+
+	for (int r = 0; r < samples[0].rows; r++)
+	{
+		for (int c = 0; c < samples[0].cols; c++)
+		{
+			int covered = 0;
+			bool changed = false;
+
+			for (int i=0; i<camCount; i++)
+			{
+				if (!coverage[i].ptr<unsigned char>(r)[c])
+					continue;
+
+				covered++;
+
+				const unsigned char* now = samples[i].ptr<unsigned char>(r) + 3 * c;
+				const unsigned char* then = inputSamples[i].ptr<unsigned char>(r) + 3 * c;
+				int difference = abs(now[0] - then[0]) + abs(now[1] - then[1]) + abs(now[2] - then[2]);
+
+				if (difference > ChangeLevel)
+					changed = true;
+			}
+
+			if (covered < 2)
+				continue;
+
+			overlaps++;
+			if (changed)
+				changes++;
+		}
+	}
+
+	return changes * ChangeFraction > overlaps;
+}
+
+int SeamFinder::run()
+{
+	while (true)
+	{
+		WaitForSingleObject(requestEvent, INFINITE);
+
+		if (!running)
+			break;
+
+		Mat labels;
+		findSeams(labels);
+
+		WaitForSingleObject(seamsMutex, INFINITE);
+		seams = labels;
+		busy = false;
+		ReleaseMutex(seamsMutex);
+	}
+
+	return 0;
+}
+
+void SeamFinder::findSeams(Mat& labels) const
+{
+	// A new Mat every time, as the last one may still be in use
+	Size size = inputSamples[0].size();
+	labels = Mat(size, CV_8U, Scalar::all(StitchPlan::NoCamera));
+
+	Mat cost(size, CV_32F);
+	Mat transposed;
+	vector<int> seam;
+
+	for (int k=0; k<inputCount; k++)
+	{
+		// Camera k takes what only it covers. The centres of that and of
+		// what only the cameras before it cover say which way the overlap
+		// runs, and which side of the seam is k's.
+		double newX = 0, newY = 0, oldX = 0, oldY = 0;
+		int newCount = 0, oldCount = 0, overlapCount = 0;
+
+		for (int r = 0; r < size.height; r++)
+		{
+			const unsigned char* mine = inputCoverage[k].ptr<unsigned char>(r);
+			unsigned char* label = labels.ptr<unsigned char>(r);
+
+			for (int c = 0; c < size.width; c++)
+			{
+				bool taken = label[c] != StitchPlan::NoCamera;
+
+				if (mine[c] && !taken)
+				{
+					label[c] = k;
+					newX += c;
+					newY += r;
+					newCount++;
+				}
+				else if (!mine[c] && taken)
+				{
+					oldX += c;
+					oldY += r;
+					oldCount++;
+				}
+				else if (mine[c])
+				{
+					overlapCount++;
+				}
+			}
+		}
+
+		// If either covers all of the other, the cameras before keep it
+		if (overlapCount == 0 || newCount == 0 || oldCount == 0)
+			continue;
+
+		double dX = newX / newCount - oldX / oldCount;
+		double dY = newY / newCount - oldY / oldCount;
+
+		// Where the frames differ least, the cut shows least
+		for (int r = 0; r < size.height; r++)
+		{
+			const unsigned char* mine = inputCoverage[k].ptr<unsigned char>(r);
+			const unsigned char* label = labels.ptr<unsigned char>(r);
+			float* costRow = cost.ptr<float>(r);
+
+			for (int c = 0; c < size.width; c++)
+			{
+				if (!mine[c] || label[c] == k)
+				{
+					costRow[c] = Unreachable;
+					continue;
+				}
+
+				const unsigned char* a = inputSamples[k].ptr<unsigned char>(r) + 3 * c;
+				const unsigned char* b = inputSamples[label[c]].ptr<unsigned char>(r) + 3 * c;
+				costRow[c] = StepCost + abs(a[0] - b[0]) + abs(a[1] - b[1]) + abs(a[2] - b[2]);
+			}
+		}
+
+		// Side by side cameras are cut from top to bottom, stacked ones
+		// from left to right
+		bool across = fabs(dX) >= fabs(dY);
+		bool after = across ? dX > 0 : dY > 0;
+
+		if (across)
+		{
+			cutSeam(cost, seam);
+		}
+		else
+		{
+			transpose(cost, transposed);
+			cutSeam(transposed, seam);
+		}
+
+		for (int r = 0; r < size.height; r++)
+		{
+			const float* costRow = cost.ptr<float>(r);
+			unsigned char* label = labels.ptr<unsigned char>(r);
+
+			for (int c = 0; c < size.width; c++)
+			{
+				if (costRow[c] == Unreachable)
+					continue;
+
+				int along = across ? c : r;
+				int cut = across ? seam[r] : seam[c];
+
+				if (after ? along > cut : along < cut)
+					label[c] = k;
+			}
+		}
+	}
+}
+
+void SeamFinder::cutSeam(const Mat& cost, vector<int>& seam)
+{
+	// Cheapest total cost of a seam from the top to each sample
+	Mat total(cost.size(), CV_32F);
+
+	for (int r = 0; r < cost.rows; r++)
+	{
+		const float* costRow = cost.ptr<float>(r);
+		const float* above = r > 0 ? total.ptr<float>(r - 1) : NULL;
+		float* totalRow = total.ptr<float>(r);
+
+		// A seam which can't step from the row above jumps from its best
+		float jump = 0;
+		if (above != NULL)
+		{
+			float best = Unreachable;
+			for (int c = 0; c < cost.cols; c++)
+				best = min(best, above[c]);
+
+			if (best != Unreachable)
+				jump = best + JumpCost;
+		}
+
+		for (int c = 0; c < cost.cols; c++)
+		{
+			if (costRow[c] == Unreachable)
+			{
+				totalRow[c] = Unreachable;
+				continue;
+			}
+
+			float best = Unreachable;
+			if (above != NULL)
+			{
+				for (int x = max(c - 1, 0); x <= min(c + 1, cost.cols - 1); x++)
+					best = min(best, above[x]);
+			}
+
+			totalRow[c] = costRow[c] + (best != Unreachable ? best : jump);
+		}
+	}
+
+	// Back up from the cheapest end
+	seam.assign(cost.rows, -1);
+	int column = -1;
+
+	for (int r = cost.rows - 1; r >= 0; r--)
+	{
+		const float* totalRow = total.ptr<float>(r);
+		int best = -1;
+
+		if (column >= 0)
+		{
+			for (int x = max(column - 1, 0); x <= min(column + 1, cost.cols - 1); x++)
+				if (totalRow[x] != Unreachable && (best < 0 || totalRow[x] < totalRow[best]))
+					best = x;
+		}
+
+		if (best < 0)
+		{
+			for (int x = 0; x < cost.cols; x++)
+				if (totalRow[x] != Unreachable && (best < 0 || totalRow[x] < totalRow[best]))
+					best = x;
+		}
+
+		seam[r] = best;
+		column = best;
+	}
+}
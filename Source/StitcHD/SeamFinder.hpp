@@ -0,0 +1,132 @@
+/*
+This file is part of StitcHD.
+
+StitcHD is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+StitcHD is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with StitcHD.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef SEAMFINDER_HPP
+#define SEAMFINDER_HPP
+
+#include "Config.hpp"
+#include "StitchPlan.hpp"
+#include "WarpKernels.hpp"
+
+#include <Windows.h>
+
+#include <vector>
+using namespace std;
+
+#include <opencv2/core/core.hpp>
+using namespace cv;
+
+// Finds seams through the overlaps for seam cut blending, on a thread of
+// its own. The stitcher samples its canvas every Scale pixels and hands the
+// samples over when the plan or the overlaps change; the thread cuts each
+// overlap along the path where the frames differ least, and the stitcher
+// picks up the labels once they are done. Nothing waits on the thread.
+class SeamFinder
+{
+public:
+
+	SeamFinder();
+	~SeamFinder();
+
+	// Canvas pixels per sample, across and down
+	static const int Scale = 4;
+
+	int start();
+	int stop();
+
+	// Called every frame. Resamples the plan's canvas when the plan changed,
+	// or every CheckFrames frames, and hands it to the thread if the plan
+	// changed or the overlaps look different from the last seams' samples.
+	// Returns true if it did. Does nothing while the thread is busy.
+	bool update(const StitchPlan& plan, Mat* images, const WarpKernels::Params* params);
+
+	// Takes the newest seams if there are any new ones, as
+	// StitchPlan::setSeams wants them
+	bool takeSeams(Mat& labels);
+
+	// Frames between checks of the overlaps
+	static const int CheckFrames = 8;
+
+	// A sample changed if its channels moved by more than ChangeLevel in
+	// all, and the overlaps did if more than one in ChangeFraction did
+	static const int ChangeLevel = 48;
+	static const int ChangeFraction = 50;
+
+	// Number of times seams have been requested
+	int requests;
+
+private:
+
+	volatile bool running;
+	HANDLE threadHandle;
+	HANDLE requestEvent;
+
+	// Guards busy and seams
+	HANDLE seamsMutex;
+
+	// Set while the thread works on input. Only the thread touches input
+	// then; otherwise only the stitcher does.
+	bool busy;
+
+	// Finished labels not taken yet, empty if none
+	Mat seams;
+
+	// The last samples handed over, per camera: the canvas as the camera
+	// shows it (CV_8UC3) and where it can (CV_8U, 1 or 0)
+	int inputCount;
+	Mat inputSamples[MAX_CAMERAS];
+	Mat inputCoverage[MAX_CAMERAS];
+
+	// The stitcher's latest samples
+	Mat samples[MAX_CAMERAS];
+	Mat coverage[MAX_CAMERAS];
+
+	// The plan the input was sampled from, and frames since the last check
+	int inputBuilds;
+	int framesSinceCheck;
+
+	// Samples the plan's canvas into samples and coverage
+	void sample(const StitchPlan& plan, Mat* images, const WarpKernels::Params* params);
+
+	// True if the samples differ noticeably from the input where cameras overlap
+	bool overlapsChanged(int camCount) const;
+
+	// Labels each sample of the input with the camera to show there. Each
+	// camera in turn takes what it alone covers, and cuts its overlap with
+	// the cameras before it.
+	void findSeams(Mat& labels) const;
+
+	// The cheapest path down cost, one column per row, -1 on rows it
+	// can't reach. Steps one column at most between rows.
+	static void cutSeam(const Mat& cost, vector<int>& seam);
+
+	// Thread entry point
+	static DWORD WINAPI StartThread(LPVOID arg)
+	{
+		return ((SeamFinder*)arg)->run();
+	}
+
+	// Thread function
+	int run();
+
+	// Not copyable
+	SeamFinder(const SeamFinder&);
+	SeamFinder& operator=(const SeamFinder&);
+};
+
+#endif // SEAMFINDER_HPP
@@ -0,0 +1,151 @@
+/*
+This file is part of StitcHD.
+
+StitcHD is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+StitcHD is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with StitcHD.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "StitchArena.hpp"
+
+#include <iostream>
+using namespace std;
+
+StitchArena::StitchArena()
+	:allocationCount(0),
+	hugePages(false)
+{
+	for (int i=0; i<MaxSlots; i++)
+	{
+		buffers[i].data = NULL;
+		buffers[i].size = 0;
+		buffers[i].largePages = false;
+	}
+}
+
+StitchArena::~StitchArena()
+{
+	release();
+}
+
+void StitchArena::setHugePages(bool enable)
+{
+	if (enable && !hugePages && !enableLargePages())
+		cout << "Large pages aren't available, using normal pages." << endl;
+
+	hugePages = enable;
+}
+
+Mat StitchArena::get(int slot, Size size, int type)
+{
+	if (slot < 0 || slot >= MaxSlots || size.width <= 0 || size.height <= 0)
+		return Mat();
+
+	size_t step = size.width * CV_ELEM_SIZE(type);
+	size_t needed = step * size.height;
+	Buffer& buffer = buffers[slot];
+
+	if (needed > buffer.size)
+	{
+		freeBuffer(buffer);
+
+		buffer.data = allocate(needed, hugePages, buffer.size, buffer.largePages);
+		allocationCount++;
+
+		if (buffer.data == NULL)
+		{
+			cout << "Could not allocate " << needed << " bytes for the stitcher." << endl;
+			buffer.size = 0;
+			return Mat();
+		}
+	}
+
+	return Mat(size.height, size.width, type, buffer.data, step);
+}
+
+void StitchArena::release()
+{
+	for (int i=0; i<MaxSlots; i++)
+		freeBuffer(buffers[i]);
+}
+
+size_t StitchArena::bytes() const
+{
+	size_t total = 0;
+	for (int i=0; i<MaxSlots; i++)
+		total += buffers[i].size;
+	return total;
+}
+
+void* StitchArena::allocate(size_t size, bool largePages, size_t& allocated, bool& gotLargePages)
+{
+	if (largePages)
+	{
+		size_t page = GetLargePageMinimum();
+
+		if (page > 0)
+		{
+			allocated = (size + page - 1) / page * page;
+			void* data = VirtualAlloc(NULL, allocated, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+
+			if (data != NULL)
+			{
+				gotLargePages = true;
+				return data;
+			}
+		}
+	}
+
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	size_t page = info.dwPageSize;
+
+	allocated = (size + page - 1) / page * page;
+	gotLargePages = false;
+	return VirtualAlloc(NULL, allocated, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+}
+
+void StitchArena::freeBuffer(Buffer& buffer)
+{
+	if (buffer.data != NULL)
+		VirtualFree(buffer.data, 0, MEM_RELEASE);
+
+	buffer.data = NULL;
+	buffer.size = 0;
+	buffer.largePages = false;
+}
+
+bool StitchArena::enableLargePages()
+{
+	static int enabled = -1;
+	if (enabled >= 0)
+		return enabled == 1;
+
+	enabled = 0;
+
+	HANDLE token;
+	if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token))
+		return false;
+
+	TOKEN_PRIVILEGES privileges;
+	privileges.PrivilegeCount = 1;
+	privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+
+	if (LookupPrivilegeValue(NULL, SE_LOCK_MEMORY_NAME, &privileges.Privileges[0].Luid)
+		&& AdjustTokenPrivileges(token, FALSE, &privileges, 0, NULL, NULL)
+		&& GetLastError() == ERROR_SUCCESS)
+		enabled = 1;
+
+	CloseHandle(token);
+	return enabled == 1;
+}
@@ -0,0 +1,81 @@
+/*
+This file is part of StitcHD.
+
+StitcHD is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+StitcHD is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with StitcHD.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef STITCHARENA_HPP
+#define STITCHARENA_HPP
+
+#include <Windows.h>
+
+#include <opencv2/core/core.hpp>
+using namespace cv;
+
+// Owns the frame-sized buffers the stitcher writes every frame, so that once
+// the output geometry settles no memory is allocated per frame. Buffers are
+// page-aligned, taken straight from VirtualAlloc, and only grow.
+class StitchArena
+{
+public:
+
+	StitchArena();
+	~StitchArena();
+
+	// Slots are independent buffers
+	static const int MaxSlots = 8;
+
+	// Use large pages for buffers allocated from now on, if the account may
+	// lock pages in memory. Falls back to normal pages otherwise.
+	void setHugePages(bool enable);
+
+	// A Mat header over slot's buffer, growing it if it is too small. The
+	// contents are kept if it isn't reallocated. The header doesn't own the
+	// memory, which stays valid until the slot grows or the arena is freed.
+	Mat get(int slot, Size size, int type);
+
+	void release();
+
+	// Buffers (re)allocated since the arena was created
+	int allocations() const { return allocationCount; }
+
+	// Bytes currently held
+	size_t bytes() const;
+
+private:
+
+	struct Buffer
+	{
+		void* data;
+		size_t size;
+		bool largePages;
+	};
+
+	Buffer buffers[MaxSlots];
+	int allocationCount;
+	bool hugePages;
+
+	static void* allocate(size_t size, bool largePages, size_t& allocated, bool& gotLargePages);
+	static void freeBuffer(Buffer& buffer);
+
+	// The lock-memory privilege large pages need. Asked for once.
+	static bool enableLargePages();
+
+	// Not copyable
+	StitchArena(const StitchArena&);
+	StitchArena& operator=(const StitchArena&);
+};
+
+#endif // STITCHARENA_HPP
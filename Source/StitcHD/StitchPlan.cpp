@@ -0,0 +1,651 @@
+/*
+This file is part of StitcHD.
+
+StitcHD is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+StitcHD is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with StitcHD.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "StitchPlan.hpp"
+#include "Homographier.hpp"
+#include "ScanlineWarp.hpp"
+
+#include <algorithm>
+
+StitchPlan::StitchPlan()
+	:canvasSize(0, 0),
+	camCount(0),
+	tileCols(0),
+	tileRows(0),
+	builds(0),
+	weightBuilds(0),
+	weightBlend(-1),
+	weightExpValue(-1),
+	weightInterpolate(false),
+	maxWarpError(0)
+{
+}
+
+bool StitchPlan::sameHomography(const Mat& a, const Mat& b)
+{
+	if (a.rows != 3 || a.cols != 3 || b.rows != 3 || b.cols != 3)
+		return false;
+
+	for (int r=0; r<3; r++)
+		for (int c=0; c<3; c++)
+			if (a.at<HOM_MAT_TYPE>(r, c) != b.at<HOM_MAT_TYPE>(r, c))
+				return false;
+
+	return true;
+}
+
+bool StitchPlan::matches(const vector<Mat>& newHmgs, const vector<Size>& newSrcSizes, Size newCanvasSize, const Projection& newProjection, double newMaxWarpError) const
+{
+	if (builds == 0 || newCanvasSize != canvasSize || newProjection != projection || newMaxWarpError != maxWarpError)
+		return false;
+
+	if (newHmgs.size() != hmgs.size() || newSrcSizes.size() != srcSizes.size())
+		return false;
+
+	for (int i=0; i<hmgs.size(); i++)
+	{
+		if (newSrcSizes[i] != srcSizes[i])
+			return false;
+		if (!sameHomography(newHmgs[i], hmgs[i]))
+			return false;
+	}
+
+	return true;
+}
+
+void StitchPlan::build(const vector<Mat>& newHmgs, const vector<Size>& newSrcSizes, Size newCanvasSize, const Projection& newProjection, double newMaxWarpError)
+{
+	camCount = newHmgs.size();
+	canvasSize = newCanvasSize;
+	srcSizes = newSrcSizes;
+	projection = newProjection;
+	maxWarpError = newMaxWarpError;
+
+	hmgs.resize(camCount);
+	warpCoords.resize(camCount);
+	warpFractions.resize(camCount);
+
+	// Each row is worked out in floats, then packed
+	vector<Point2f> mapRow(canvasSize.width);
+
+	for (int i=0; i<camCount; i++)
+	{
+		newHmgs[i].copyTo(hmgs[i]);
+
+		const Mat& h = hmgs[i];
+		warpCoords[i].create(canvasSize, CV_16SC2);
+		warpFractions[i].create(canvasSize, CV_16U);
+
+		ScanlineWarp warp(h, maxWarpError);
+
+		for (int r = 0; r < canvasSize.height; r++)
+		{
+			if (projection.type == Projection::Planar)
+				warp.row(r, 0, canvasSize.width, &mapRow[0]);
+			else
+				projectRow(h, r, &mapRow[0]);
+
+			WarpKernels::packMap(&mapRow[0].x, canvasSize.width, warpCoords[i].ptr<short>(r), warpFractions[i].ptr<unsigned short>(r));
+		}
+	}
+
+	// Find the cameras which only shift the canvas by whole pixels
+	translated.resize(camCount);
+	translations.resize(camCount);
+
+	for (int i=0; i<camCount; i++)
+	{
+		const Mat& h = hmgs[i];
+		double tX = h.at<HOM_MAT_TYPE>(0, 2);
+		double tY = h.at<HOM_MAT_TYPE>(1, 2);
+
+		translated[i] = projection.type == Projection::Planar
+			&& h.at<HOM_MAT_TYPE>(0, 0) == 1 && h.at<HOM_MAT_TYPE>(0, 1) == 0
+			&& h.at<HOM_MAT_TYPE>(1, 0) == 0 && h.at<HOM_MAT_TYPE>(1, 1) == 1
+			&& h.at<HOM_MAT_TYPE>(2, 0) == 0 && h.at<HOM_MAT_TYPE>(2, 1) == 0 && h.at<HOM_MAT_TYPE>(2, 2) == 1
+			&& tX == floor(tX) && tY == floor(tY);
+		translations[i] = translated[i] ? Point(int(tX), int(tY)) : Point(0, 0);
+	}
+
+	levels.assign(camCount, 0);
+
+	weightBlend = -1;
+	weightMaps.clear();
+	segments.clear();
+	rowSegments.clear();
+	tileSources.clear();
+
+	builds++;
+}
+
+void StitchPlan::projectRow(const Mat& h, int r, Point2f* mapRow) const
+{
+	// The projection's trigonometry is paid here, once per plan
+	for (int c = 0; c < canvasSize.width; c++)
+	{
+		double x, y;
+		double z = 0;
+
+		if (projection.toPlane(c, r, x, y))
+			z = h.at<HOM_MAT_TYPE>(2, 0) * x + h.at<HOM_MAT_TYPE>(2, 1) * y + h.at<HOM_MAT_TYPE>(2, 2);
+
+		// Behind the frame or off the plane, nothing to sample
+		if (z <= 0)
+		{
+			mapRow[c] = Point2f(-1, -1);
+			continue;
+		}
+
+		double scale = 1./z;
+		mapRow[c].x = (h.at<HOM_MAT_TYPE>(0, 0) * x + h.at<HOM_MAT_TYPE>(0, 1) * y + h.at<HOM_MAT_TYPE>(0, 2)) * scale;
+		mapRow[c].y = (h.at<HOM_MAT_TYPE>(1, 0) * x + h.at<HOM_MAT_TYPE>(1, 1) * y + h.at<HOM_MAT_TYPE>(1, 2)) * scale;
+	}
+}
+
+WarpKernels::Map StitchPlan::warpMap(int i, int x, int y) const
+{
+	WarpKernels::Map map = { warpCoords[i].ptr<short>(y) + 2 * x, warpFractions[i].ptr<unsigned short>(y) + x };
+	return map;
+}
+
+bool StitchPlan::rowSpan(const Mat& h, Size src, int y, int width, int& begin, int& end)
+{
+	// Along the row each condition on the source coordinates is linear in x:
+	// z > 0, 0.5 <= X/z < cols - 0.5 and 0.5 <= Y/z < rows - 0.5
+	double x0 = h.at<HOM_MAT_TYPE>(0, 1) * y + h.at<HOM_MAT_TYPE>(0, 2);
+	double y0 = h.at<HOM_MAT_TYPE>(1, 1) * y + h.at<HOM_MAT_TYPE>(1, 2);
+	double z0 = h.at<HOM_MAT_TYPE>(2, 1) * y + h.at<HOM_MAT_TYPE>(2, 2);
+	double dx = h.at<HOM_MAT_TYPE>(0, 0);
+	double dy = h.at<HOM_MAT_TYPE>(1, 0);
+	double dz = h.at<HOM_MAT_TYPE>(2, 0);
+
+	// Each condition is slope * x + offset >= 0
+	double slopes[5] = {
+		dz,
+		dx - 0.5 * dz,
+		(src.width - 0.5) * dz - dx,
+		dy - 0.5 * dz,
+		(src.height - 0.5) * dz - dy
+	};
+	double offsets[5] = {
+		z0,
+		x0 - 0.5 * z0,
+		(src.width - 0.5) * z0 - x0,
+		y0 - 0.5 * z0,
+		(src.height - 0.5) * z0 - y0
+	};
+
+	double lo = 0;
+	double hi = width - 1;
+
+	for (int i=0; i<5; i++)
+	{
+		if (slopes[i] > 0)
+			lo = max(lo, -offsets[i] / slopes[i]);
+		else if (slopes[i] < 0)
+			hi = min(hi, -offsets[i] / slopes[i]);
+		else if (offsets[i] < 0)
+			return false;
+	}
+
+	if (lo > hi)
+		return false;
+
+	// A pixel of slack on each side for the map's rounding
+	begin = max(0, cvFloor(lo) - 1);
+	end = min(width, cvCeil(hi) + 2);
+
+	return begin < end;
+}
+
+void StitchPlan::buildView(const StitchPlan& source, Rect view, double scale, const int* newLevels)
+{
+	camCount = source.camCount;
+	canvasSize = Size(max(1, cvRound(view.width * scale)), max(1, cvRound(view.height * scale)));
+	projection = source.projection;
+	maxWarpError = source.maxWarpError;
+	srcSizes = source.srcSizes;
+
+	// The source canvas pixel each view pixel shows
+	vector<int> columns(canvasSize.width);
+	vector<int> rows(canvasSize.height);
+
+	for (int c = 0; c < canvasSize.width; c++)
+		columns[c] = view.x + min(int((c + 0.5) / scale), view.width - 1);
+	for (int r = 0; r < canvasSize.height; r++)
+		rows[r] = view.y + min(int((r + 0.5) / scale), view.height - 1);
+
+	Mat viewToSource = (Mat_<HOM_MAT_TYPE>(3,3) << 1 / scale, 0, view.x, 0, 1 / scale, view.y, 0, 0, 1);
+
+	hmgs.resize(camCount);
+	warpCoords.resize(camCount);
+	warpFractions.resize(camCount);
+	weightMaps.resize(camCount);
+	translated.resize(camCount);
+	translations.resize(camCount);
+	levels.assign(camCount, 0);
+
+	vector<Point2f> mapRow(canvasSize.width);
+
+	for (int i=0; i<camCount; i++)
+	{
+		hmgs[i] = source.hmgs[i] * viewToSource;
+
+		// Each pyramid level halves the frame, rounding up like pyrDown, and
+		// pixel centres stay where they were
+		int level = newLevels != NULL ? newLevels[i] : 0;
+		float shrink = float(1 << level);
+		float offset = 0.5f / shrink - 0.5f;
+
+		if (level > 0)
+		{
+			levels[i] = level;
+
+			for (int l=0; l<level; l++)
+				srcSizes[i] = Size((srcSizes[i].width + 1) / 2, (srcSizes[i].height + 1) / 2);
+
+			Mat toLevel = (Mat_<HOM_MAT_TYPE>(3,3) << 1 / shrink, 0, offset, 0, 1 / shrink, offset, 0, 0, 1);
+			hmgs[i] = toLevel * hmgs[i];
+		}
+
+		// Samples the source plan could take are kept inside the smaller frame
+		float maxX = srcSizes[i].width - 1.5f - 2.0f / WarpKernels::MapScale;
+		float maxY = srcSizes[i].height - 1.5f - 2.0f / WarpKernels::MapScale;
+
+		warpCoords[i].create(canvasSize, CV_16SC2);
+		warpFractions[i].create(canvasSize, CV_16U);
+		weightMaps[i].create(canvasSize, CV_16U);
+
+		for (int r = 0; r < canvasSize.height; r++)
+		{
+			const Point_<short>* sourceCoords = source.warpCoords[i].ptr<Point_<short> >(rows[r]);
+			const unsigned short* sourceFractions = source.warpFractions[i].ptr<unsigned short>(rows[r]);
+			const unsigned short* sourceWeights = source.weightMaps[i].ptr<unsigned short>(rows[r]);
+			Point_<short>* coords = warpCoords[i].ptr<Point_<short> >(r);
+			unsigned short* fractions = warpFractions[i].ptr<unsigned short>(r);
+			unsigned short* weights = weightMaps[i].ptr<unsigned short>(r);
+
+			for (int c = 0; c < canvasSize.width; c++)
+			{
+				coords[c] = sourceCoords[columns[c]];
+				fractions[c] = sourceFractions[columns[c]];
+				weights[c] = sourceWeights[columns[c]];
+			}
+
+			if (level == 0)
+				continue;
+
+			for (int c = 0; c < canvasSize.width; c++)
+			{
+				float tX, tY;
+				WarpKernels::unpackMap(&coords[c].x, fractions[c], tX, tY);
+
+				mapRow[c].x = min(max(tX / shrink + offset, 0.5f), maxX);
+				mapRow[c].y = min(max(tY / shrink + offset, 0.5f), maxY);
+			}
+
+			WarpKernels::packMap(&mapRow[0].x, canvasSize.width, &coords[0].x, fractions);
+		}
+
+		// Rows can still be copied straight at full scale
+		translated[i] = source.translated[i] && scale == 1 && level == 0;
+		translations[i] = translated[i] ? source.translations[i] + view.tl() : Point(0, 0);
+	}
+
+	weightBlend = source.weightBlend;
+	weightExpValue = source.weightExpValue;
+	weightInterpolate = source.weightInterpolate;
+
+	segments.clear();
+	rowSegments.resize(canvasSize.height + 1);
+
+	for (int r = 0; r < canvasSize.height; r++)
+	{
+		rowSegments[r] = segments.size();
+
+		for (int c = 0; c < canvasSize.width; c++)
+		{
+			int cameras = 0;
+			for (int i=0; i<camCount; i++)
+				if (weightMaps[i].ptr<unsigned short>(r)[c] > 0)
+					cameras |= 1 << i;
+
+			extendSegments(rowSegments[r], c, cameras);
+		}
+	}
+
+	rowSegments[canvasSize.height] = segments.size();
+
+	buildTiles();
+
+	builds++;
+	weightBuilds++;
+}
+
+double StitchPlan::footprint(int i, Rect view, double scale) const
+{
+	// Finite differences a view pixel apart, on a grid over the view
+	int step = max(1, cvRound(1 / scale));
+	double total = 0;
+	int samples = 0;
+
+	for (int gy = 0; gy < FootprintSamples; gy++)
+	{
+		for (int gx = 0; gx < FootprintSamples; gx++)
+		{
+			int x = view.x + (2 * gx + 1) * view.width / (2 * FootprintSamples);
+			int y = view.y + (2 * gy + 1) * view.height / (2 * FootprintSamples);
+
+			if (x + step >= canvasSize.width || y + step >= canvasSize.height)
+				continue;
+
+			const Mat& weights = weightMaps[i];
+			if (weights.at<unsigned short>(y, x) == 0 || weights.at<unsigned short>(y, x + step) == 0
+				|| weights.at<unsigned short>(y + step, x) == 0)
+				continue;
+
+			Point2f p, right, down;
+			WarpKernels::unpackMap(warpCoords[i].ptr<short>(y) + 2 * x, warpFractions[i].at<unsigned short>(y, x), p.x, p.y);
+			WarpKernels::unpackMap(warpCoords[i].ptr<short>(y) + 2 * (x + step), warpFractions[i].at<unsigned short>(y, x + step), right.x, right.y);
+			WarpKernels::unpackMap(warpCoords[i].ptr<short>(y + step) + 2 * x, warpFractions[i].at<unsigned short>(y + step, x), down.x, down.y);
+
+			// The side of a square with the area one canvas pixel covers
+			double area = (right.x - p.x) * (down.y - p.y) - (right.y - p.y) * (down.x - p.x);
+			total += sqrt(fabs(area)) / step;
+			samples++;
+		}
+	}
+
+	double perCanvasPixel = samples > 0 ? total / samples : 1;
+	return perCanvasPixel / scale;
+}
+
+bool StitchPlan::weightsMatch(int alphaBlend, int expBlendValue, bool interpolate) const
+{
+	if (weightBlend == -1 || alphaBlend != weightBlend || interpolate != weightInterpolate)
+		return false;
+
+	return alphaBlend != 3 || expBlendValue == weightExpValue;
+}
+
+float StitchPlan::blendWeight(int alphaBlend, int expBlendValue, Size src, float x, float y)
+{
+	if (alphaBlend < 2 || alphaBlend > 5)
+		return 1.0f;
+
+	// As in stitch_kernel, the distance is measured from the truncated coordinates
+	int centerX = src.width / 2;
+	int centerY = src.height / 2;
+	int dX = centerX - int(x);
+	int dY = centerY - int(y);
+	float rc = sqrtf(float(dX * dX + dY * dY)) / sqrtf(float(centerX * centerX + centerY * centerY));
+
+	if (alphaBlend != 3)
+	{
+		// Linear blending. Multi-band blending uses it to pick a seam, and
+		// seam cut blending where it has no seam.
+		rc = 1.0 - rc;
+	}
+	else
+	{
+		// Exponential decay blending
+		rc = -(34.0 * expBlendValue + 100.0) * (rc - 0.5) / 50.0 - 1.0;
+		rc = powf(10, rc);
+	}
+
+	return rc;
+}
+
+void StitchPlan::extendSegments(int rowStart, int c, int cameras)
+{
+	if (segments.size() > rowStart && segments.back().cameras == cameras)
+	{
+		segments.back().end = c + 1;
+		return;
+	}
+
+	Segment segment;
+	segment.begin = c;
+	segment.end = c + 1;
+	segment.cameras = cameras;
+	segment.count = 0;
+	segment.camera = -1;
+
+	for (int i=camCount - 1; i>=0; i--)
+	{
+		if (cameras & (1 << i))
+		{
+			segment.count++;
+			segment.camera = i;
+		}
+	}
+
+	segments.push_back(segment);
+}
+
+void StitchPlan::buildWeights(int alphaBlend, int expBlendValue, bool interpolate)
+{
+	weightBlend = alphaBlend;
+	weightExpValue = expBlendValue;
+	weightInterpolate = interpolate;
+
+	weightMaps.resize(camCount);
+	for (int i=0; i<camCount; i++)
+		weightMaps[i].create(canvasSize, CV_16U);
+
+	segments.clear();
+	rowSegments.resize(canvasSize.height + 1);
+
+	int begins[MAX_CAMERAS];
+	int ends[MAX_CAMERAS];
+	float weights[MAX_CAMERAS];
+	float seams[MAX_CAMERAS];
+	int fixedWeights[MAX_CAMERAS];
+
+	bool seamCut = alphaBlend == 5 && !seamLabels.empty();
+
+	for (int r = 0; r < canvasSize.height; r++)
+	{
+		rowSegments[r] = segments.size();
+
+		// Most cameras miss most of a row. Curved canvases test every pixel.
+		for (int i=0; i<camCount; i++)
+		{
+			if (projection.type != Projection::Planar)
+			{
+				begins[i] = 0;
+				ends[i] = canvasSize.width;
+			}
+			else if (!rowSpan(hmgs[i], srcSizes[i], r, canvasSize.width, begins[i], ends[i]))
+			{
+				begins[i] = 0;
+				ends[i] = 0;
+			}
+		}
+
+		for (int c = 0; c < canvasSize.width; c++)
+		{
+			float total = 0;
+
+			for (int i=0; i<camCount; i++)
+			{
+				weights[i] = 0;
+
+				if (c < begins[i] || c >= ends[i])
+					continue;
+
+				// The coordinate the kernels will actually sample
+				Point2f p;
+				WarpKernels::unpackMap(warpCoords[i].ptr<short>(r) + 2 * c, warpFractions[i].ptr<unsigned short>(r)[c], p.x, p.y);
+				if (!WarpKernels::inFrame(p.x, p.y, srcSizes[i].width, srcSizes[i].height, interpolate))
+					continue;
+
+				// Overlay keeps only the first frame
+				if (alphaBlend == 0 && total > 0)
+					continue;
+
+				float m = blendWeight(alphaBlend, expBlendValue, srcSizes[i], p.x, p.y);
+				if (m > 0)
+				{
+					weights[i] = m;
+					total += m;
+				}
+			}
+
+			// The seams decide wherever they label a camera which is there
+			if (seamCut && total > 0)
+			{
+				seamWeights(c, r, seams);
+
+				float seamTotal = 0;
+				for (int i=0; i<camCount; i++)
+				{
+					if (weights[i] == 0)
+						seams[i] = 0;
+					seamTotal += seams[i];
+				}
+
+				if (seamTotal > 0)
+				{
+					for (int i=0; i<camCount; i++)
+						weights[i] = seams[i];
+					total = seamTotal;
+				}
+			}
+
+			// Normalize, rounding down, and give what's left to the heaviest frame
+			// so that the weights add up to exactly WeightOne
+			int fixedTotal = 0;
+			int heaviest = 0;
+
+			for (int i=0; i<camCount; i++)
+			{
+				fixedWeights[i] = total > 0 ? int(weights[i] / total * WarpKernels::WeightOne) : 0;
+				fixedTotal += fixedWeights[i];
+
+				if (weights[i] > weights[heaviest])
+					heaviest = i;
+			}
+
+			if (total > 0)
+				fixedWeights[heaviest] += WarpKernels::WeightOne - fixedTotal;
+
+			int cameras = 0;
+			for (int i=0; i<camCount; i++)
+			{
+				weightMaps[i].ptr<unsigned short>(r)[c] = fixedWeights[i];
+				if (fixedWeights[i] > 0)
+					cameras |= 1 << i;
+			}
+
+			extendSegments(rowSegments[r], c, cameras);
+		}
+	}
+
+	rowSegments[canvasSize.height] = segments.size();
+
+	buildTiles();
+
+	weightBuilds++;
+}
+
+void StitchPlan::setSeams(const Mat& labels)
+{
+	seamLabels = labels;
+
+	// The weights are rebuilt on their next use
+	weightBlend = -1;
+}
+
+void StitchPlan::seamWeights(int x, int y, float* weights) const
+{
+	for (int i=0; i<camCount; i++)
+		weights[i] = 0;
+
+	// The seams may have been found for a canvas of another size, so the
+	// labels are stretched over this one
+	float fX = (x + 0.5f) * seamLabels.cols / canvasSize.width - 0.5f;
+	float fY = (y + 0.5f) * seamLabels.rows / canvasSize.height - 0.5f;
+	int x0 = min(max(cvFloor(fX), 0), seamLabels.cols - 1);
+	int y0 = min(max(cvFloor(fY), 0), seamLabels.rows - 1);
+	int x1 = min(x0 + 1, seamLabels.cols - 1);
+	int y1 = min(y0 + 1, seamLabels.rows - 1);
+	float aX = min(max(fX - x0, 0.0f), 1.0f);
+	float aY = min(max(fY - y0, 0.0f), 1.0f);
+
+	const unsigned char* top = seamLabels.ptr<unsigned char>(y0);
+	const unsigned char* bottom = seamLabels.ptr<unsigned char>(y1);
+
+	unsigned char labels[4] = { top[x0], top[x1], bottom[x0], bottom[x1] };
+	float shares[4] = { (1 - aX) * (1 - aY), aX * (1 - aY), (1 - aX) * aY, aX * aY };
+
+	for (int k=0; k<4; k++)
+	{
+		if (labels[k] < camCount)
+			weights[labels[k]] += shares[k];
+	}
+}
+
+void StitchPlan::buildTiles()
+{
+	tileCols = (canvasSize.width + TileSize - 1) / TileSize;
+	tileRows = (canvasSize.height + TileSize - 1) / TileSize;
+	tileSources.assign(tileCols * tileRows * camCount, Rect());
+
+	for (int t = 0; t < tileCols * tileRows; t++)
+	{
+		Rect tile((t % tileCols) * TileSize, (t / tileCols) * TileSize, TileSize, TileSize);
+		tile &= Rect(0, 0, canvasSize.width, canvasSize.height);
+
+		for (int i=0; i<camCount; i++)
+		{
+			int minX = srcSizes[i].width;
+			int minY = srcSizes[i].height;
+			int maxX = -1;
+			int maxY = -1;
+
+			for (int r = tile.y; r < tile.y + tile.height; r++)
+			{
+				const Point_<short>* coords = warpCoords[i].ptr<Point_<short> >(r);
+				const unsigned short* weights = weightMaps[i].ptr<unsigned short>(r);
+
+				for (int c = tile.x; c < tile.x + tile.width; c++)
+				{
+					if (weights[c] == 0)
+						continue;
+
+					minX = min(minX, int(coords[c].x));
+					minY = min(minY, int(coords[c].y));
+					maxX = max(maxX, int(coords[c].x));
+					maxY = max(maxY, int(coords[c].y));
+				}
+			}
+
+			if (maxX < 0)
+				continue;
+
+			// The whole coordinates are rounded down, and rounding to the nearest
+			// pixel or bilinear sampling reach one past them
+			int left = max(minX - 1, 0);
+			int top = max(minY - 1, 0);
+			int right = min(maxX + 2, srcSizes[i].width);
+			int bottom = min(maxY + 2, srcSizes[i].height);
+
+			tileSources[t * camCount + i] = Rect(left, top, right - left, bottom - top);
+		}
+	}
+}
@@ -0,0 +1,167 @@
+/*
+This file is part of StitcHD.
+
+StitcHD is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+StitcHD is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with StitcHD.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef STITCHPLAN_HPP
+#define STITCHPLAN_HPP
+
+#include "Config.hpp"
+#include "WarpKernels.hpp"
+#include "Projection.hpp"
+
+#include <vector>
+using namespace std;
+
+#include <opencv2/core/core.hpp>
+using namespace cv;
+
+// Everything the CPU stitcher can reuse from one frame to the next.
+// The homographies only change when a Homographier finishes a cycle, so
+// the plan is built once per homography set and reused until they change.
+class StitchPlan
+{
+public:
+
+	StitchPlan();
+
+	// True if the plan was built from exactly these inputs
+	bool matches(const vector<Mat>& hmgs, const vector<Size>& srcSizes, Size canvasSize, const Projection& projection, double maxWarpError) const;
+
+	// True if the plan was built for frames of these sizes
+	bool sourcesMatch(const vector<Size>& sizes) const { return builds > 0 && sizes == srcSizes; }
+
+	// projection maps canvas pixels onto the first frame's plane, and hmgs[i]
+	// maps that plane into the coordinates of frame i. On a planar canvas the
+	// maps may be off by up to maxWarpError frame pixels (see ScanlineWarp).
+	void build(const vector<Mat>& hmgs, const vector<Size>& srcSizes, Size canvasSize, const Projection& projection, double maxWarpError);
+
+	Size canvasSize;
+	int camCount;
+	Projection projection;
+	double maxWarpError;
+
+	// Source coordinates of every canvas pixel, packed as WarpKernels::Map
+	// describes: a CV_16SC2 map of whole pixels and a CV_16U map of fractions
+	// per camera
+	vector<Mat> warpCoords;
+	vector<Mat> warpFractions;
+
+	// Camera i's map from pixel (x, y) on
+	WarpKernels::Map warpMap(int i, int x, int y) const;
+
+	// Cameras whose homography is a whole-pixel translation, and the offset
+	// from canvas to frame coordinates. Their rows can be copied as they are.
+	vector<bool> translated;
+	vector<Point> translations;
+
+	// The columns [begin, end) of canvas row y that homography h can map into
+	// a frame of size src, on a planar canvas. Errs on the wide side.
+	static bool rowSpan(const Mat& h, Size src, int y, int width, int& begin, int& end);
+
+	// True if the blend weights were built for these settings
+	bool weightsMatch(int alphaBlend, int expBlendValue, bool interpolate) const;
+
+	// Bakes the blend weight of every camera at every canvas pixel
+	void buildWeights(int alphaBlend, int expBlendValue, bool interpolate);
+
+	// Seams for seam cut blending (alphaBlend 5): the camera shown at each
+	// point of a grid over the canvas (CV_8U), NoCamera where there is none.
+	// Each camera gets the pixels labelled with it, feathered across one
+	// grid step, and pixels whose label it can't show keep linear weights.
+	// Taken by the next buildWeights; kept through rebuilds of the plan.
+	void setSeams(const Mat& labels);
+	static const unsigned char NoCamera = 255;
+
+	// A plan for part of another plan's canvas, with its weights. Pixel (x, y)
+	// shows pixel view.tl() + (x, y) / scale of the source canvas. If levels
+	// is given, camera i's maps address its frame shrunk 2^levels[i] times.
+	void buildView(const StitchPlan& source, Rect view, double scale, const int* levels = NULL);
+
+	// Frame pixels camera i covers per pixel of the view at scale, on
+	// average over the part of the view it shows
+	double footprint(int i, Rect view, double scale) const;
+	static const int FootprintSamples = 8;
+
+	// The pyramid level each camera's maps address, 0 for the frame itself
+	vector<int> levels;
+
+	// One CV_16U map per camera. The weights of a pixel add up to
+	// WarpKernels::WeightOne, and are 0 wherever a frame can't be sampled.
+	vector<Mat> weightMaps;
+
+	// A run of pixels in one canvas row that the same cameras cover
+	struct Segment
+	{
+		int begin;
+		int end;
+		int cameras;	// Bit i is set if camera i has weight in the run
+		int count;		// Number of bits set
+		int camera;		// The lowest camera in the run
+	};
+
+	// The segments of row r are segments[rowSegments[r]] .. segments[rowSegments[r+1] - 1],
+	// left to right, including the uncovered ones. Built with the weights.
+	vector<Segment> segments;
+	vector<int> rowSegments;
+
+	// The canvas is split into TileSize square tiles, tileCols across and tileRows down
+	static const int TileSize = 32;
+	int tileCols;
+	int tileRows;
+
+	// tileSources[tile * camCount + i] bounds the pixels of frame i that tile
+	// samples, empty if frame i doesn't reach it. Built with the weights.
+	vector<Rect> tileSources;
+
+	// Number of times the plan has been (re)built
+	int builds;
+
+	// Number of times the weights and segments have been (re)built
+	int weightBuilds;
+
+private:
+
+	vector<Mat> hmgs;
+	vector<Size> srcSizes;
+
+	// The settings weightMaps were built for, -1 if they need building
+	int weightBlend;
+	int weightExpValue;
+	bool weightInterpolate;
+
+	// The last seams given to setSeams, empty until then
+	Mat seamLabels;
+
+	// The seam weight of every camera at canvas pixel (x, y), bilinear
+	// between the four nearest labels
+	void seamWeights(int x, int y, float* weights) const;
+
+	// stitch_kernel's weight for a sample at (x, y) in a frame of size src
+	static float blendWeight(int alphaBlend, int expBlendValue, Size src, float x, float y);
+
+	static bool sameHomography(const Mat& a, const Mat& b);
+
+	// Projects canvas row r through a curved projection and homography h
+	void projectRow(const Mat& h, int r, Point2f* mapRow) const;
+
+	// Adds a pixel covered by cameras to the segments of the current row
+	void extendSegments(int rowStart, int c, int cameras);
+
+	// Finds each tile's source rectangles from the warp and weight maps
+	void buildTiles();
+};
+
+#endif // STITCHPLAN_HPP
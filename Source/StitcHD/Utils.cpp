@@ -72,7 +72,7 @@ string timerOutputFileName()
 	return path.string();
 }
 
-string videoOutputFileName()
+string videoOutputFileName(const string& extension)
 {
 	ptime now = second_clock::local_time();
 
@@ -114,7 +114,7 @@ string videoOutputFileName()
 		}
 	}
 
-	path /= to_iso_string(now.time_of_day()) + ".mpeg";
+	path /= to_iso_string(now.time_of_day()) + extension;
 
 	return path.string();
 }
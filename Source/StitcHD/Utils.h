@@ -25,7 +25,8 @@ using namespace std;
 // So, I put it in this separate Utils module
 string timerOutputFileName();
 
-string videoOutputFileName();
+// extension includes the dot
+string videoOutputFileName(const string& extension = ".mpeg");
 
 __declspec(dllexport) string pictureOutputFileName();
 
@@ -32,9 +32,22 @@ VideoStitcher::VideoStitcher(Config& c)
 {
 	running = false;
 	recording = false;
+	recorder = NULL;
+	rawRecorder = NULL;
 	hmgCntlRunning = false;
 	hmgCntlThreadHandle = INVALID_HANDLE_VALUE;
 	hmgLatency = -1;
+	displayScale = 1;
+	viewportScale = 1;
+	fullFrameRequested = false;
+	displayTarget = NULL;
+	displayTargetContext = NULL;
+	displayTargetWritten = false;
+	lastFrameEnd = 0;
+	hmgCycles = 0;
+	hmgSettleCycles = 0;
+	locked = false;
+	lockFailed = false;
 }
 
 VideoStitcher::~VideoStitcher()
@@ -116,6 +129,17 @@ int VideoStitcher::start()
 	if (startCameraCaptures())
 		return -1;
 
+#if COMPILE_GPU != 1
+	// Tunes while the cameras and homographiers get going
+	if (config.stitchBlock == 0)
+		ImageStitcher::startBlockTuner(config);
+#endif
+
+	// config.lockCalibration locks again once the homographiers have run
+	locked = false;
+	lockFailed = false;
+	imageStitcher.unlockPlan();
+
 	if (config.hmgCount > 0)
 		if (startHmgController())
 			return -1;
@@ -213,6 +237,10 @@ int VideoStitcher::startHmgController()
         return -1;
     }
 
+	// Homographiers from before a calibration lock hand on what they found
+	vector<Homographier*> previous = homographiers;
+	homographiers.clear();
+
 	for (int i=0; i<config.hmgCount; i++)
 	{
 		homographiers.push_back(
@@ -224,10 +252,29 @@ int VideoStitcher::startHmgController()
 				config.hmgDirections[i][1])
 			);
 
+		if (i < previous.size())
+		{
+			previous[i]->homography.copyTo(homographiers.back()->homography);
+			homographiers.back()->gain = previous[i]->gain;
+		}
+
 		if (homographiers.back()->start())
 			return -1;
 	}
 
+	for (int i=0; i<previous.size(); i++)
+		delete previous[i];
+
+	// Each cycle moves the homographies hmgTransitionAlpha of the way to
+	// what was found, so fresh ones take a while to get within 1% of it
+	double alpha = config.hmgTransitionAlpha / 100.0;
+	hmgSettleCycles = 1;
+	if (previous.size() > 0)
+		hmgSettleCycles = 0;
+	else if (alpha > 0 && alpha < 1)
+		hmgSettleCycles = min(cvCeil(log(0.01) / log(1.0 - alpha)), MaxHmgSettleCycles);
+
+	hmgCycles = 0;
 	hmgCntlRunning = true;
 	
 	hmgCntlThreadHandle = CreateThread(
@@ -250,6 +297,8 @@ int VideoStitcher::startHmgController()
 
 int VideoStitcher::getImage()
 {
+	clock_t frameStart = clock();
+
 	// Wait for framesMutex
 	DWORD waitResult = WaitForSingleObject( 
 		framesMutex,	// event handle
@@ -272,6 +321,11 @@ int VideoStitcher::getImage()
             return -2;
 	}
 
+	// The captures build the pyramid levels a reduced view will want
+	int pyramidLevels = recording ? 1 : ImageStitcher::pyramidLevels(viewportScale * governor.viewScale());
+	for (int i=0; i<cameraCaptures.size(); i++)
+		cameraCaptures[i]->pyramidLevels = pyramidLevels - 1;
+
 	ResetEvent(stopCapEvent);
 	SetEvent(startCapEvent);
 
@@ -312,23 +366,41 @@ int VideoStitcher::getImage()
 
 	// Get frames
 	
-	Mat frames[MAX_CAMERAS];
 	for (int i=0; i<cameraCaptures.size(); i++)
+	{
 		cameraCaptures[i]->frame.copyTo(frames[i]);
+
+		const vector<Mat>& levels = cameraCaptures[i]->pyramid;
+		pyramids[i].resize(levels.size() + 1);
+		pyramids[i][0] = frames[i];
+		for (int l=0; l<levels.size(); l++)
+			levels[l].copyTo(pyramids[i][l + 1]);
+	}
 	
 	ReleaseMutex(framesMutex);
 
+	clock_t captured = clock();
+
 	for (int i=0; i<cameraCaptures.size(); i++)
 	{
 		if (frames[i].cols <= 0 || frames[i].rows <= 0)
 			return -1;
 	}
 	
-	Mat hmgs[MAX_CAMERAS];
+	// The first frame after the homographiers have found something locks.
+	// A lock that failed waits for the request to change.
+	if (!config.lockCalibration)
+		lockFailed = false;
 
-	for (int i=0; i<homographiers.size(); i++)
+	if (config.lockCalibration && !locked && !lockFailed)
+		lockCalibration();
+	else if (!config.lockCalibration && locked)
+		unlockCalibration();
+
+	for (int i=0; i<homographiers.size() && !locked; i++)
 	{
 		homographiers[i]->homography.copyTo(hmgs[i]);
+		gains[i] = homographiers[i]->gain;
 		
 		if (config.showMatches && homographiers[i]->matchesFrame.rows > 0 && homographiers[i]->matchesFrame.cols > 0)
 		{
@@ -340,24 +412,151 @@ int VideoStitcher::getImage()
 
 
 	Timer::send(Timer::Stitch, 0, Timer::StitchTimeval::Start);
+	clock_t stitchStart = clock();
+
+	// What the quality governor has given up to hold the target frame time
+	governor.apply(config, governedConfig);
 	
+	// The recorder and snapshots need the whole canvas, the display only what it shows
+	displayRect = viewport;
+	displayScale = viewportScale * governor.viewScale();
+	imageStitcher.setPixelTarget(displayTarget, displayTargetContext);
+	imageStitcher.setPyramids(pyramids);
+
+	if (recording || fullFrameRequested)
+	{
+		displayRect = Rect();
+		displayScale = 1;
+		fullFrameRequested = false;
+		imageStitcher.setPixelTarget(NULL, NULL);
+	}
+
+	// The stitcher converts the recording's frames to I420 while they're in the cache
+	if (recording && rawRecorder != NULL)
+		imageStitcher.setPixelTarget(Y4mWriter::pixelTarget, rawRecorder, ImageStitcher::I420);
+
 #if COMPILE_GPU == 1
-	displayFrame = imageStitcher.stitchImages_GPU(frames, hmgs, config);
+	displayFrame = imageStitcher.stitchView_GPU(frames, hmgs, config.gainCompensation ? gains : NULL, governedConfig, displayRect, displayScale, canvasSize);
 #else
-	displayFrame = imageStitcher.stitchImages(frames, hmgs, config);
+	displayFrame = imageStitcher.stitchView(frames, hmgs, config.gainCompensation ? gains : NULL, governedConfig, displayRect, displayScale, canvasSize);
 #endif
 
 	Timer::send(Timer::Stitch, 0, Timer::StitchTimeval::End);
+	clock_t stitchEnd = clock();
+
+#if COMPILE_GPU == 1
+	// The GPU's output comes back as BGR
+	bool targetWritten = false;
+#else
+	bool targetWritten = imageStitcher.wrotePixelTarget();
+#endif
+
+	// While recording, the target is the recorder's
+	displayTargetWritten = targetWritten && !recording;
 
 	if (displayFrame.cols <= 0 || displayFrame.rows <= 0)
 		return -1;
 
-	if (recording)
+	// The frame time runs from the last frame's stitch to this one's, so
+	// that it includes whatever the caller does in between, e.g. display
+	governor.update(config.targetFrameTime,
+		Timer::msTime(lastFrameEnd, stitchEnd),
+		Timer::msTime(frameStart, captured),
+		Timer::msTime(stitchStart, stitchEnd));
+	lastFrameEnd = stitchEnd;
+
+	if (recording && rawRecorder != NULL)
+	{
+		if (targetWritten)
+			rawRecorder->writeFrame();
+		else
+			rawRecorder->write(displayFrame);
+	}
+	else if (recording)
+	{
 		recorder->write(displayFrame);
+	}
 
 	return 0;
 }
 
+int VideoStitcher::lockCalibration()
+{
+	// Nothing to lock until the homographies have settled
+	if (hmgCntlRunning && hmgCycles < hmgSettleCycles)
+		return -1;
+
+	stopHmgController();
+
+	for (int i=0; i<homographiers.size(); i++)
+	{
+		homographiers[i]->homography.copyTo(hmgs[i]);
+		gains[i] = homographiers[i]->gain;
+	}
+
+#if COMPILE_GPU == 1
+	// The GPU stitcher works everything out each frame and has no plan to
+	// compile, so it just keeps the frozen homographies
+	bool compiled = true;
+#else
+	bool compiled = imageStitcher.lockPlan(frames, hmgs, config);
+#endif
+
+	if (!compiled)
+	{
+		cout << "Could not compile a stitch plan, the calibration stays unlocked." << endl;
+		lockFailed = true;
+
+		if (config.hmgCount > 0)
+			return startHmgController();
+		return -1;
+	}
+
+	locked = true;
+	cout << "Calibration locked." << endl;
+	return 0;
+}
+
+int VideoStitcher::unlockCalibration()
+{
+	imageStitcher.unlockPlan();
+	locked = false;
+
+	cout << "Calibration unlocked." << endl;
+
+	if (config.hmgCount > 0)
+		return startHmgController();
+	return 0;
+}
+
+void VideoStitcher::retryCalibrationLock()
+{
+	lockFailed = false;
+}
+
+void VideoStitcher::setViewport(Rect rect, double scale)
+{
+	viewport = rect;
+	viewportScale = scale;
+}
+
+void VideoStitcher::clearViewport()
+{
+	viewport = Rect();
+	viewportScale = 1;
+}
+
+void VideoStitcher::requestFullFrame()
+{
+	fullFrameRequested = true;
+}
+
+void VideoStitcher::setDisplayTarget(ImageStitcher::PixelTargetFunction function, void* context)
+{
+	displayTarget = function;
+	displayTargetContext = context;
+}
+
 int VideoStitcher::stop()
 {
 	if (!running)
@@ -386,7 +585,7 @@ int VideoStitcher::stop()
 	CloseHandle(startCapEvent);
 	CloseHandle(stopCapEvent);
 
-	cout << "Frame resolution: " << displayFrame.cols << "x" << displayFrame.rows << endl;
+	cout << "Frame resolution: " << canvasSize.width << "x" << canvasSize.height << endl;
 
 	return 0;
 }
@@ -463,6 +662,7 @@ int VideoStitcher::runHmgController()
 		// Start the homographiers
 		ResetEvent(stopHmgEvent);
 		SetEvent(startHmgEvent);
+		clock_t cycleStart = clock();
 		
 		// Update the latency
 		latencies[latencyIndex] = clock();
@@ -500,6 +700,17 @@ int VideoStitcher::runHmgController()
 		for (int i=0; i<homographiers.size(); i++)
 			ResetEvent(done[i]);
 
+		hmgCycles++;
+
+		// When the governor is short of time, leave the processors to the
+		// stitch for as long as the cycle took
+		if (governor.fewerHomographies() && hmgCntlRunning)
+		{
+			int cycleTime = Timer::msTime(cycleStart, clock());
+			if (cycleTime > 0)
+				Sleep(cycleTime < MaxHmgPause ? cycleTime : MaxHmgPause);
+		}
+
 	} while(hmgCntlRunning);
 
 	cout << "Ending HmgController." << endl;
@@ -542,7 +753,21 @@ int VideoStitcher::startRecording()
 	if (recording)
 		return -1;
 
-	recorder = new VideoWriter(videoOutputFileName(), CV_FOURCC('P','I','M','1'), 20, Size(displayFrame.cols, displayFrame.rows));
+	if (config.recordFormat == 1)
+	{
+		rawRecorder = new Y4mWriter();
+
+		if (!rawRecorder->open(videoOutputFileName(".y4m"), canvasSize, 20))
+		{
+			delete rawRecorder;
+			rawRecorder = NULL;
+			return -1;
+		}
+	}
+	else
+	{
+		recorder = new VideoWriter(videoOutputFileName(), CV_FOURCC('P','I','M','1'), 20, canvasSize);
+	}
 
 	recording = true;
 
@@ -556,8 +781,16 @@ int VideoStitcher::stopRecording()
 	
 	recording = false;
 
-	recorder->~VideoWriter();
-	recorder = NULL;
+	if (rawRecorder != NULL)
+	{
+		delete rawRecorder;
+		rawRecorder = NULL;
+	}
+	else
+	{
+		recorder->~VideoWriter();
+		recorder = NULL;
+	}
 
 	return true;
 }
\ No newline at end of file
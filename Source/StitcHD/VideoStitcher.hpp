@@ -26,6 +26,8 @@ along with StitcHD.  If not, see <http://www.gnu.org/licenses/>.
 #include "ImageStitcher.hpp"
 #include "Homographier.hpp"
 #include "CameraCapture.hpp"
+#include "Y4mWriter.hpp"
+#include "QualityGovernor.hpp"
 #include "Config.hpp"
 
 using namespace cv;
@@ -39,8 +41,14 @@ public:
 	// Stores most variable information about this stitcher
 	Config& config;
 
-	// The most recently stitched frame
+	// The most recently stitched frame. With a viewport set, only the part of
+	// the canvas at displayRect, scaled by displayScale.
 	Mat displayFrame;
+	Rect displayRect;
+	double displayScale;
+
+	// Size of the whole stitched canvas
+	Size canvasSize;
 
 	// The latency of the homographierController
 	int hmgLatency;
@@ -62,6 +70,37 @@ public:
 	// Run the VideoStitcher
 	int getImage();
 
+	// From now on stitch only rect of the canvas, scaled by scale.
+	// Recording and requestFullFrame() still get the whole canvas.
+	void setViewport(Rect rect, double scale);
+	void clearViewport();
+
+	// The next getImage() stitches the whole canvas, e.g. for a snapshot
+	void requestFullFrame();
+
+	// Where stitched viewports are also written as 32-bit pixels, e.g. a
+	// QImage, saving the display a conversion. displayTargetWritten says
+	// whether the last frame went there.
+	void setDisplayTarget(ImageStitcher::PixelTargetFunction function, void* context);
+	bool displayTargetWritten;
+
+	// How many tiles the CPU stitcher could keep from the frame before
+	const ImageStitcher::TileCounters& tileCounters() const { return imageStitcher.getTileCounters(); }
+
+	// Frame-sized buffers the stitcher has allocated
+	int stitchAllocations() const { return imageStitcher.getAllocations(); }
+
+	// What the stitcher is giving up to hold config.targetFrameTime, and
+	// the frame timings it goes by
+	const QualityGovernor& qualityGovernor() const { return governor; }
+
+	// True while config.lockCalibration holds the homographies still. A lock
+	// that couldn't compile a plan stays false, and sets calibrationLockFailed()
+	// until config.lockCalibration changes or retryCalibrationLock() is called.
+	bool calibrationLocked() const { return locked; }
+	bool calibrationLockFailed() const { return lockFailed; }
+	void retryCalibrationLock();
+
 	int showImage();
 
 private:
@@ -71,6 +110,17 @@ private:
 	bool recording;
 	VideoWriter *recorder;
 
+	// Records instead of recorder when config.recordFormat is I420, taking
+	// the stitcher's output as it renders
+	Y4mWriter *rawRecorder;
+
+	// The part of the canvas being displayed, empty for all of it
+	Rect viewport;
+	double viewportScale;
+	bool fullFrameRequested;
+	ImageStitcher::PixelTargetFunction displayTarget;
+	void* displayTargetContext;
+
 	// Objects for the CaptureThreads
 	vector<CameraCapture*> cameraCaptures;
 	HANDLE startCapEvent, stopCapEvent;
@@ -84,6 +134,37 @@ private:
 
 	// Stitches images together
 	ImageStitcher imageStitcher;
+
+	// Trades quality for time when frames run over config.targetFrameTime.
+	// governedConfig is config less what it gave up, for the stitcher.
+	QualityGovernor governor;
+	Config governedConfig;
+	clock_t lastFrameEnd;
+
+	// Longest the homographiers sit out a cycle for the governor, in ms
+	static const int MaxHmgPause = 1000;
+
+	// Homographier cycles finished since the controller started, and how
+	// many it takes for the homographies to settle
+	volatile int hmgCycles;
+	int hmgSettleCycles;
+
+	static const int MaxHmgSettleCycles = 50;
+
+	// With the calibration locked, the homographiers are stopped, hmgs and
+	// gains stay as they were, and the stitcher keeps a compiled plan
+	bool locked;
+	bool lockFailed;
+	int lockCalibration();
+	int unlockCalibration();
+
+	// Each frame's inputs, kept so their buffers are reused
+	Mat frames[MAX_CAMERAS];
+	Mat hmgs[MAX_CAMERAS];
+	Scalar gains[MAX_CAMERAS];
+
+	// Each frame and its pyramid, for stitching reduced views
+	vector<Mat> pyramids[MAX_CAMERAS];
 	
 	// Called from within start()
 	int startCameraCaptures();
@@ -0,0 +1,888 @@
+/*
+This file is part of StitcHD.
+
+StitcHD is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+StitcHD is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with StitcHD.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "WarpKernels.hpp"
+
+#include <climits>
+#include <cmath>
+#include <cstring>
+
+#include <intrin.h>
+#include <smmintrin.h>
+#include <immintrin.h>
+
+// AVX2 intrinsics need Visual Studio 2012, AVX-512 needs Visual Studio 2017
+#ifndef WARP_KERNELS_AVX2
+#if defined(_MSC_VER) && _MSC_VER >= 1700
+#define WARP_KERNELS_AVX2 1
+#else
+#define WARP_KERNELS_AVX2 0
+#endif
+#endif
+
+#ifndef WARP_KERNELS_AVX512
+#if defined(_MSC_VER) && _MSC_VER >= 1910
+#define WARP_KERNELS_AVX512 1
+#else
+#define WARP_KERNELS_AVX512 0
+#endif
+#endif
+
+namespace WarpKernels
+{
+	typedef void (*ResolveFunction)(const Accumulator&, int, unsigned char*);
+	typedef void (*PackFunction)(const unsigned char*, int, unsigned char*);
+
+	// What the sampling functions do, as a template argument, so that the
+	// loops instantiated for one set of Params test nothing per pixel
+	enum Sampling
+	{
+		SampleFlat,
+		SampleNearest,
+		SampleBilinear,
+		SamplingCount
+	};
+
+	const int GainRound = 1 << (GainBits - 1);
+
+	// The four bilinear weights of each map fraction add up to 1 << BilinearBits
+	const int BilinearBits = 2 * MapBits;
+	const int BilinearRound = 1 << (BilinearBits - 1);
+
+	// ---------- Map packing ----------
+
+	// Weights of the top left, top right, bottom left and bottom right
+	// neighbours for every fy * MapScale + fx, the table cv::remap keeps
+	static int bilinearWeights[MapScale * MapScale][4];
+
+	static bool buildBilinearWeights()
+	{
+		for (int fY = 0; fY < MapScale; fY++)
+		{
+			for (int fX = 0; fX < MapScale; fX++)
+			{
+				int* w = bilinearWeights[fY * MapScale + fX];
+				w[0] = (MapScale - fX) * (MapScale - fY);
+				w[1] = fX * (MapScale - fY);
+				w[2] = (MapScale - fX) * fY;
+				w[3] = fX * fY;
+			}
+		}
+		return true;
+	}
+
+	static const bool bilinearWeightsBuilt = buildBilinearWeights();
+
+	// A coordinate in 1/MapScale pixels, clamped to what a short holds
+	static inline int toMapUnits(float t)
+	{
+		if (!(t > SHRT_MIN))
+			return SHRT_MIN * MapScale;
+		if (t >= SHRT_MAX)
+			return SHRT_MAX * MapScale;
+		return int(floor(t * MapScale + 0.5f));
+	}
+
+	void packMap(const float* coords, int count, short* xy, unsigned short* fractions)
+	{
+		for (int i=0; i<count; i++)
+		{
+			int x = toMapUnits(coords[2*i]);
+			int y = toMapUnits(coords[2*i + 1]);
+
+			// Shifting down floors negative coordinates too, so the fractions stay positive
+			xy[2*i] = short(x >> MapBits);
+			xy[2*i + 1] = short(y >> MapBits);
+			fractions[i] = (unsigned short)((y & (MapScale - 1)) * MapScale + (x & (MapScale - 1)));
+		}
+	}
+
+	// The map run from pixel i on
+	static inline Map offsetMap(const Map& map, int i)
+	{
+		Map tail = { map.xy + 2*i, map.fractions + i };
+		return tail;
+	}
+
+	// ---------- Scalar reference ----------
+
+	// addFrameToPixel's sampling, at the map's 1/MapScale steps, with the
+	// bilinear sum in fixed point the way cv::remap does it
+	template <int S, bool Adjusted>
+	static inline void samplePixel(const Source& src, int x, int y, int fraction, const Params& params, int v[3])
+	{
+		if (S == SampleFlat)
+		{
+			v[0] = 0;
+			v[1] = 0;
+			v[2] = 0;
+		}
+		else if (S == SampleNearest)
+		{
+			// Round up from half a pixel
+			x += (fraction & (MapScale - 1)) >> (MapBits - 1);
+			y += fraction >> (2 * MapBits - 1);
+			const unsigned char* p = src.data + y * src.step + x * 3;
+			v[0] = p[0];
+			v[1] = p[1];
+			v[2] = p[2];
+		}
+		else
+		{
+			const int* w = bilinearWeights[fraction];
+
+			const unsigned char* p00 = src.data + y * src.step + x * 3;
+			const unsigned char* p10 = p00 + 3;
+			const unsigned char* p01 = p00 + src.step;
+			const unsigned char* p11 = p01 + 3;
+
+			for (int c=0; c<3; c++)
+				v[c] = (p00[c] * w[0] + p10[c] * w[1] + p01[c] * w[2] + p11[c] * w[3] + BilinearRound) >> BilinearBits;
+		}
+
+		if (Adjusted)
+		{
+			for (int c=0; c<3; c++)
+				v[c] = ((v[c] * params.gain[c] + GainRound) >> GainBits) + params.tint[c];
+		}
+	}
+
+	template <int S, bool Adjusted>
+	static void accumulateScalar(const Source& src, const Map& map, const unsigned short* weights,
+		int count, const Params& params, const Accumulator& acc)
+	{
+		for (int i=0; i<count; i++)
+		{
+			int m = weights[i];
+			if (m == 0)
+				continue;
+
+			int v[3];
+			samplePixel<S, Adjusted>(src, map.xy[2*i], map.xy[2*i + 1], map.fractions[i], params, v);
+
+			acc.b[i] += m * v[0];
+			acc.g[i] += m * v[1];
+			acc.r[i] += m * v[2];
+		}
+	}
+
+	static inline unsigned char saturate(int val)
+	{
+		return val > 255 ? 255 : val;
+	}
+
+	static void resolveScalar(const Accumulator& acc, int count, unsigned char* dst)
+	{
+		for (int i=0; i<count; i++, dst += 3)
+		{
+			dst[0] = saturate(acc.b[i] >> WeightBits);
+			dst[1] = saturate(acc.g[i] >> WeightBits);
+			dst[2] = saturate(acc.r[i] >> WeightBits);
+		}
+	}
+
+	template <int S, bool Adjusted>
+	static void warpScalar(const Source& src, const Map& map, int count, const Params& params, unsigned char* dst)
+	{
+		for (int i=0; i<count; i++, dst += 3)
+		{
+			int v[3];
+			samplePixel<S, Adjusted>(src, map.xy[2*i], map.xy[2*i + 1], map.fractions[i], params, v);
+
+			dst[0] = saturate(v[0]);
+			dst[1] = saturate(v[1]);
+			dst[2] = saturate(v[2]);
+		}
+	}
+
+	static void packBgrxScalar(const unsigned char* bgr, int count, unsigned char* dst)
+	{
+		for (int i=0; i<count; i++, bgr += 3, dst += 4)
+		{
+			dst[0] = bgr[0];
+			dst[1] = bgr[1];
+			dst[2] = bgr[2];
+			dst[3] = 255;
+		}
+	}
+
+	// Accumulators offset to the scalar tail of a SIMD loop
+	static inline Accumulator offsetAccumulator(const Accumulator& acc, int i)
+	{
+		Accumulator tail = { acc.b + i, acc.g + i, acc.r + i };
+		return tail;
+	}
+
+	// ---------- SSE4.1: 4 pixels at a time, gathered with scalar loads ----------
+
+	static inline __m128i gatherChannelSse(const unsigned char* base, const int* ofs, int delta)
+	{
+		return _mm_setr_epi32(base[ofs[0] + delta], base[ofs[1] + delta], base[ofs[2] + delta], base[ofs[3] + delta]);
+	}
+
+	// 4 map entries -> whole x, whole y and fraction, a pixel per lane.
+	// Each x, y pair of shorts is one 32-bit lane to start with.
+	static inline void unpackSse(const Map& map, __m128i& x, __m128i& y, __m128i& fraction)
+	{
+		__m128i xy = _mm_loadu_si128((const __m128i*)map.xy);
+		x = _mm_srai_epi32(_mm_slli_epi32(xy, 16), 16);
+		y = _mm_srai_epi32(xy, 16);
+		fraction = _mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i*)map.fractions));
+	}
+
+	// Adjusted samples at 4 coordinates, which must all be inFrame
+	template <int S, bool Adjusted>
+	static inline void sampleSse(const Source& src, __m128i x, __m128i y, __m128i fraction, const Params& params, __m128i v[3])
+	{
+		const __m128i step = _mm_set1_epi32(src.step);
+		const __m128i three = _mm_set1_epi32(3);
+		int ofs[4];
+
+		if (S == SampleFlat)
+		{
+			v[0] = _mm_setzero_si128();
+			v[1] = _mm_setzero_si128();
+			v[2] = _mm_setzero_si128();
+		}
+		else if (S == SampleNearest)
+		{
+			x = _mm_add_epi32(x, _mm_srli_epi32(_mm_and_si128(fraction, _mm_set1_epi32(MapScale - 1)), MapBits - 1));
+			y = _mm_add_epi32(y, _mm_srli_epi32(fraction, 2 * MapBits - 1));
+			_mm_storeu_si128((__m128i*)ofs, _mm_add_epi32(_mm_mullo_epi32(y, step), _mm_mullo_epi32(x, three)));
+
+			for (int c=0; c<3; c++)
+				v[c] = gatherChannelSse(src.data, ofs, c);
+		}
+		else
+		{
+			// bilinearWeights, worked out in the registers rather than gathered
+			const __m128i scale = _mm_set1_epi32(MapScale);
+			__m128i fX = _mm_and_si128(fraction, _mm_set1_epi32(MapScale - 1));
+			__m128i fY = _mm_srli_epi32(fraction, MapBits);
+			__m128i gX = _mm_sub_epi32(scale, fX);
+			__m128i gY = _mm_sub_epi32(scale, fY);
+			__m128i w00 = _mm_mullo_epi32(gX, gY);
+			__m128i w10 = _mm_mullo_epi32(fX, gY);
+			__m128i w01 = _mm_mullo_epi32(gX, fY);
+			__m128i w11 = _mm_mullo_epi32(fX, fY);
+			_mm_storeu_si128((__m128i*)ofs, _mm_add_epi32(_mm_mullo_epi32(y, step), _mm_mullo_epi32(x, three)));
+
+			for (int c=0; c<3; c++)
+			{
+				__m128i s = _mm_mullo_epi32(gatherChannelSse(src.data, ofs, c), w00);
+				s = _mm_add_epi32(s, _mm_mullo_epi32(gatherChannelSse(src.data, ofs, c + 3), w10));
+				s = _mm_add_epi32(s, _mm_mullo_epi32(gatherChannelSse(src.data, ofs, c + src.step), w01));
+				s = _mm_add_epi32(s, _mm_mullo_epi32(gatherChannelSse(src.data, ofs, c + src.step + 3), w11));
+
+				v[c] = _mm_srli_epi32(_mm_add_epi32(s, _mm_set1_epi32(BilinearRound)), BilinearBits);
+			}
+		}
+
+		if (Adjusted)
+		{
+			const __m128i round = _mm_set1_epi32(GainRound);
+
+			for (int c=0; c<3; c++)
+			{
+				__m128i gained = _mm_srai_epi32(_mm_add_epi32(_mm_mullo_epi32(v[c], _mm_set1_epi32(params.gain[c])), round), GainBits);
+				v[c] = _mm_add_epi32(gained, _mm_set1_epi32(params.tint[c]));
+			}
+		}
+	}
+
+	// Saturates 4 pixels of 32-bit channels to bytes and stores them as BGR
+	static inline void storeBgrSse(__m128i b, __m128i g, __m128i r, unsigned char* dst)
+	{
+		// b0 b1 b2 b3 g0 g1 g2 g3 r0 r1 r2 r3 -> b0 g0 r0 b1 g1 r1 ...
+		const __m128i interleave = _mm_setr_epi8(0, 4, 8, 1, 5, 9, 2, 6, 10, 3, 7, 11, -1, -1, -1, -1);
+
+		__m128i bytes = _mm_packus_epi16(_mm_packus_epi32(b, g), _mm_packus_epi32(r, r));
+		__m128i bgr = _mm_shuffle_epi8(bytes, interleave);
+
+		_mm_storel_epi64((__m128i*)dst, bgr);
+		int tail = _mm_extract_epi32(bgr, 2);
+		memcpy(dst + 8, &tail, 4);
+	}
+
+	template <int S, bool Adjusted>
+	static void accumulateSse41(const Source& src, const Map& map, const unsigned short* weights,
+		int count, const Params& params, const Accumulator& acc)
+	{
+		int i = 0;
+		for (; i + 4 <= count; i += 4)
+		{
+			__m128i m = _mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i*)(weights + i)));
+			__m128i valid = _mm_cmpgt_epi32(m, _mm_setzero_si128());
+
+			if (_mm_movemask_ps(_mm_castsi128_ps(valid)) == 0)
+				continue;
+
+			// Park the unused lanes on pixel (0, 0), which is always readable.
+			// They weigh nothing.
+			__m128i x, y, fraction;
+			unpackSse(offsetMap(map, i), x, y, fraction);
+			x = _mm_and_si128(x, valid);
+			y = _mm_and_si128(y, valid);
+			fraction = _mm_and_si128(fraction, valid);
+
+			__m128i v[3];
+			sampleSse<S, Adjusted>(src, x, y, fraction, params, v);
+
+			__m128i* b = (__m128i*)(acc.b + i);
+			__m128i* g = (__m128i*)(acc.g + i);
+			__m128i* r = (__m128i*)(acc.r + i);
+			_mm_storeu_si128(b, _mm_add_epi32(_mm_loadu_si128(b), _mm_mullo_epi32(m, v[0])));
+			_mm_storeu_si128(g, _mm_add_epi32(_mm_loadu_si128(g), _mm_mullo_epi32(m, v[1])));
+			_mm_storeu_si128(r, _mm_add_epi32(_mm_loadu_si128(r), _mm_mullo_epi32(m, v[2])));
+		}
+
+		accumulateScalar<S, Adjusted>(src, offsetMap(map, i), weights + i, count - i, params, offsetAccumulator(acc, i));
+	}
+
+	static void resolveSse41(const Accumulator& acc, int count, unsigned char* dst)
+	{
+		int i = 0;
+		for (; i + 4 <= count; i += 4, dst += 12)
+		{
+			__m128i b = _mm_srai_epi32(_mm_loadu_si128((const __m128i*)(acc.b + i)), WeightBits);
+			__m128i g = _mm_srai_epi32(_mm_loadu_si128((const __m128i*)(acc.g + i)), WeightBits);
+			__m128i r = _mm_srai_epi32(_mm_loadu_si128((const __m128i*)(acc.r + i)), WeightBits);
+			storeBgrSse(b, g, r, dst);
+		}
+
+		resolveScalar(offsetAccumulator(acc, i), count - i, dst);
+	}
+
+	static void packBgrxSse41(const unsigned char* bgr, int count, unsigned char* dst)
+	{
+		// b0 g0 r0 b1 g1 r1 ... -> b0 g0 r0 _ b1 g1 r1 _ ..., then _ = 255
+		const __m128i spread = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+		const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+
+		// Each load reads 16 bytes for 4 pixels' 12, so stop while 6 pixels remain
+		int i = 0;
+		for (; i + 6 <= count; i += 4, bgr += 12, dst += 16)
+		{
+			__m128i pixels = _mm_loadu_si128((const __m128i*)bgr);
+			_mm_storeu_si128((__m128i*)dst, _mm_or_si128(_mm_shuffle_epi8(pixels, spread), alpha));
+		}
+
+		packBgrxScalar(bgr, count - i, dst);
+	}
+
+	template <int S, bool Adjusted>
+	static void warpSse41(const Source& src, const Map& map, int count, const Params& params, unsigned char* dst)
+	{
+		int i = 0;
+		for (; i + 4 <= count; i += 4, dst += 12)
+		{
+			__m128i x, y, fraction;
+			unpackSse(offsetMap(map, i), x, y, fraction);
+
+			__m128i v[3];
+			sampleSse<S, Adjusted>(src, x, y, fraction, params, v);
+			storeBgrSse(v[0], v[1], v[2], dst);
+		}
+
+		warpScalar<S, Adjusted>(src, offsetMap(map, i), count - i, params, dst);
+	}
+
+#if WARP_KERNELS_AVX2
+	// ---------- AVX2: 8 pixels at a time with hardware gathers ----------
+
+	// Gathers the BGR bytes at each byte offset. The 32-bit loads end on the
+	// red byte so they never read past the frame, except at offset 0.
+	static inline void gatherBgrAvx2(const unsigned char* base, __m256i ofs, __m256i v[3])
+	{
+		const __m256i byteMask = _mm256_set1_epi32(0xFF);
+
+		__m256i atStart = _mm256_cmpeq_epi32(ofs, _mm256_setzero_si256());
+		__m256i addr = _mm256_sub_epi32(_mm256_sub_epi32(ofs, _mm256_set1_epi32(1)), atStart);
+		__m256i shift = _mm256_andnot_si256(atStart, _mm256_set1_epi32(8));
+
+		__m256i px = _mm256_srlv_epi32(_mm256_i32gather_epi32((const int*)base, addr, 1), shift);
+
+		v[0] = _mm256_and_si256(px, byteMask);
+		v[1] = _mm256_and_si256(_mm256_srli_epi32(px, 8), byteMask);
+		v[2] = _mm256_and_si256(_mm256_srli_epi32(px, 16), byteMask);
+	}
+
+	// See unpackSse
+	static inline void unpackAvx2(const Map& map, __m256i& x, __m256i& y, __m256i& fraction)
+	{
+		__m256i xy = _mm256_loadu_si256((const __m256i*)map.xy);
+		x = _mm256_srai_epi32(_mm256_slli_epi32(xy, 16), 16);
+		y = _mm256_srai_epi32(xy, 16);
+		fraction = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)map.fractions));
+	}
+
+	// Adjusted samples at 8 coordinates, which must all be inFrame
+	template <int S, bool Adjusted>
+	static inline void sampleAvx2(const Source& src, __m256i x, __m256i y, __m256i fraction, const Params& params, __m256i v[3])
+	{
+		const __m256i step = _mm256_set1_epi32(src.step);
+		const __m256i three = _mm256_set1_epi32(3);
+
+		if (S == SampleFlat)
+		{
+			v[0] = _mm256_setzero_si256();
+			v[1] = _mm256_setzero_si256();
+			v[2] = _mm256_setzero_si256();
+		}
+		else if (S == SampleNearest)
+		{
+			x = _mm256_add_epi32(x, _mm256_srli_epi32(_mm256_and_si256(fraction, _mm256_set1_epi32(MapScale - 1)), MapBits - 1));
+			y = _mm256_add_epi32(y, _mm256_srli_epi32(fraction, 2 * MapBits - 1));
+			gatherBgrAvx2(src.data, _mm256_add_epi32(_mm256_mullo_epi32(y, step), _mm256_mullo_epi32(x, three)), v);
+		}
+		else
+		{
+			const __m256i scale = _mm256_set1_epi32(MapScale);
+			__m256i fX = _mm256_and_si256(fraction, _mm256_set1_epi32(MapScale - 1));
+			__m256i fY = _mm256_srli_epi32(fraction, MapBits);
+			__m256i gX = _mm256_sub_epi32(scale, fX);
+			__m256i gY = _mm256_sub_epi32(scale, fY);
+			__m256i w00 = _mm256_mullo_epi32(gX, gY);
+			__m256i w10 = _mm256_mullo_epi32(fX, gY);
+			__m256i w01 = _mm256_mullo_epi32(gX, fY);
+			__m256i w11 = _mm256_mullo_epi32(fX, fY);
+
+			__m256i o00 = _mm256_add_epi32(_mm256_mullo_epi32(y, step), _mm256_mullo_epi32(x, three));
+			__m256i o01 = _mm256_add_epi32(o00, step);
+
+			__m256i p00[3], p10[3], p01[3], p11[3];
+			gatherBgrAvx2(src.data, o00, p00);
+			gatherBgrAvx2(src.data, _mm256_add_epi32(o00, three), p10);
+			gatherBgrAvx2(src.data, o01, p01);
+			gatherBgrAvx2(src.data, _mm256_add_epi32(o01, three), p11);
+
+			for (int c=0; c<3; c++)
+			{
+				__m256i s = _mm256_mullo_epi32(p00[c], w00);
+				s = _mm256_add_epi32(s, _mm256_mullo_epi32(p10[c], w10));
+				s = _mm256_add_epi32(s, _mm256_mullo_epi32(p01[c], w01));
+				s = _mm256_add_epi32(s, _mm256_mullo_epi32(p11[c], w11));
+
+				v[c] = _mm256_srli_epi32(_mm256_add_epi32(s, _mm256_set1_epi32(BilinearRound)), BilinearBits);
+			}
+		}
+
+		if (Adjusted)
+		{
+			const __m256i round = _mm256_set1_epi32(GainRound);
+
+			for (int c=0; c<3; c++)
+			{
+				__m256i gained = _mm256_srai_epi32(_mm256_add_epi32(_mm256_mullo_epi32(v[c], _mm256_set1_epi32(params.gain[c])), round), GainBits);
+				v[c] = _mm256_add_epi32(gained, _mm256_set1_epi32(params.tint[c]));
+			}
+		}
+	}
+
+	template <int S, bool Adjusted>
+	static void accumulateAvx2(const Source& src, const Map& map, const unsigned short* weights,
+		int count, const Params& params, const Accumulator& acc)
+	{
+		int i = 0;
+		for (; i + 8 <= count; i += 8)
+		{
+			__m256i m = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(weights + i)));
+			__m256i valid = _mm256_cmpgt_epi32(m, _mm256_setzero_si256());
+
+			if (_mm256_movemask_ps(_mm256_castsi256_ps(valid)) == 0)
+				continue;
+
+			__m256i x, y, fraction;
+			unpackAvx2(offsetMap(map, i), x, y, fraction);
+			x = _mm256_and_si256(x, valid);
+			y = _mm256_and_si256(y, valid);
+			fraction = _mm256_and_si256(fraction, valid);
+
+			__m256i v[3];
+			sampleAvx2<S, Adjusted>(src, x, y, fraction, params, v);
+
+			__m256i* b = (__m256i*)(acc.b + i);
+			__m256i* g = (__m256i*)(acc.g + i);
+			__m256i* r = (__m256i*)(acc.r + i);
+			_mm256_storeu_si256(b, _mm256_add_epi32(_mm256_loadu_si256(b), _mm256_mullo_epi32(m, v[0])));
+			_mm256_storeu_si256(g, _mm256_add_epi32(_mm256_loadu_si256(g), _mm256_mullo_epi32(m, v[1])));
+			_mm256_storeu_si256(r, _mm256_add_epi32(_mm256_loadu_si256(r), _mm256_mullo_epi32(m, v[2])));
+		}
+
+		accumulateSse41<S, Adjusted>(src, offsetMap(map, i), weights + i, count - i, params, offsetAccumulator(acc, i));
+	}
+
+	template <int S, bool Adjusted>
+	static void warpAvx2(const Source& src, const Map& map, int count, const Params& params, unsigned char* dst)
+	{
+		int i = 0;
+		for (; i + 8 <= count; i += 8, dst += 24)
+		{
+			__m256i x, y, fraction;
+			unpackAvx2(offsetMap(map, i), x, y, fraction);
+
+			__m256i v[3];
+			sampleAvx2<S, Adjusted>(src, x, y, fraction, params, v);
+
+			storeBgrSse(_mm256_castsi256_si128(v[0]), _mm256_castsi256_si128(v[1]), _mm256_castsi256_si128(v[2]), dst);
+			storeBgrSse(_mm256_extracti128_si256(v[0], 1), _mm256_extracti128_si256(v[1], 1), _mm256_extracti128_si256(v[2], 1), dst + 12);
+		}
+
+		warpSse41<S, Adjusted>(src, offsetMap(map, i), count - i, params, dst);
+	}
+#endif
+
+#if WARP_KERNELS_AVX512
+	// ---------- AVX-512: 16 pixels at a time with hardware gathers ----------
+
+	static inline void gatherBgrAvx512(const unsigned char* base, __m512i ofs, __m512i v[3])
+	{
+		const __m512i byteMask = _mm512_set1_epi32(0xFF);
+
+		// See gatherBgrAvx2
+		__mmask16 inside = _mm512_cmpneq_epi32_mask(ofs, _mm512_setzero_si512());
+		__m512i addr = _mm512_maskz_sub_epi32(inside, ofs, _mm512_set1_epi32(1));
+		__m512i shift = _mm512_maskz_mov_epi32(inside, _mm512_set1_epi32(8));
+
+		__m512i px = _mm512_srlv_epi32(_mm512_i32gather_epi32(addr, (const int*)base, 1), shift);
+
+		v[0] = _mm512_and_si512(px, byteMask);
+		v[1] = _mm512_and_si512(_mm512_srli_epi32(px, 8), byteMask);
+		v[2] = _mm512_and_si512(_mm512_srli_epi32(px, 16), byteMask);
+	}
+
+	// See unpackSse
+	static inline void unpackAvx512(const Map& map, __m512i& x, __m512i& y, __m512i& fraction)
+	{
+		__m512i xy = _mm512_loadu_si512(map.xy);
+		x = _mm512_srai_epi32(_mm512_slli_epi32(xy, 16), 16);
+		y = _mm512_srai_epi32(xy, 16);
+		fraction = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*)map.fractions));
+	}
+
+	// Adjusted samples at 16 coordinates, which must all be inFrame
+	template <int S, bool Adjusted>
+	static inline void sampleAvx512(const Source& src, __m512i x, __m512i y, __m512i fraction, const Params& params, __m512i v[3])
+	{
+		const __m512i step = _mm512_set1_epi32(src.step);
+		const __m512i three = _mm512_set1_epi32(3);
+
+		if (S == SampleFlat)
+		{
+			v[0] = _mm512_setzero_si512();
+			v[1] = _mm512_setzero_si512();
+			v[2] = _mm512_setzero_si512();
+		}
+		else if (S == SampleNearest)
+		{
+			x = _mm512_add_epi32(x, _mm512_srli_epi32(_mm512_and_si512(fraction, _mm512_set1_epi32(MapScale - 1)), MapBits - 1));
+			y = _mm512_add_epi32(y, _mm512_srli_epi32(fraction, 2 * MapBits - 1));
+			gatherBgrAvx512(src.data, _mm512_add_epi32(_mm512_mullo_epi32(y, step), _mm512_mullo_epi32(x, three)), v);
+		}
+		else
+		{
+			const __m512i scale = _mm512_set1_epi32(MapScale);
+			__m512i fX = _mm512_and_si512(fraction, _mm512_set1_epi32(MapScale - 1));
+			__m512i fY = _mm512_srli_epi32(fraction, MapBits);
+			__m512i gX = _mm512_sub_epi32(scale, fX);
+			__m512i gY = _mm512_sub_epi32(scale, fY);
+			__m512i w00 = _mm512_mullo_epi32(gX, gY);
+			__m512i w10 = _mm512_mullo_epi32(fX, gY);
+			__m512i w01 = _mm512_mullo_epi32(gX, fY);
+			__m512i w11 = _mm512_mullo_epi32(fX, fY);
+
+			__m512i o00 = _mm512_add_epi32(_mm512_mullo_epi32(y, step), _mm512_mullo_epi32(x, three));
+			__m512i o01 = _mm512_add_epi32(o00, step);
+
+			__m512i p00[3], p10[3], p01[3], p11[3];
+			gatherBgrAvx512(src.data, o00, p00);
+			gatherBgrAvx512(src.data, _mm512_add_epi32(o00, three), p10);
+			gatherBgrAvx512(src.data, o01, p01);
+			gatherBgrAvx512(src.data, _mm512_add_epi32(o01, three), p11);
+
+			for (int c=0; c<3; c++)
+			{
+				__m512i s = _mm512_mullo_epi32(p00[c], w00);
+				s = _mm512_add_epi32(s, _mm512_mullo_epi32(p10[c], w10));
+				s = _mm512_add_epi32(s, _mm512_mullo_epi32(p01[c], w01));
+				s = _mm512_add_epi32(s, _mm512_mullo_epi32(p11[c], w11));
+
+				v[c] = _mm512_srli_epi32(_mm512_add_epi32(s, _mm512_set1_epi32(BilinearRound)), BilinearBits);
+			}
+		}
+
+		if (Adjusted)
+		{
+			const __m512i round = _mm512_set1_epi32(GainRound);
+
+			for (int c=0; c<3; c++)
+			{
+				__m512i gained = _mm512_srai_epi32(_mm512_add_epi32(_mm512_mullo_epi32(v[c], _mm512_set1_epi32(params.gain[c])), round), GainBits);
+				v[c] = _mm512_add_epi32(gained, _mm512_set1_epi32(params.tint[c]));
+			}
+		}
+	}
+
+	template <int S, bool Adjusted>
+	static void accumulateAvx512(const Source& src, const Map& map, const unsigned short* weights,
+		int count, const Params& params, const Accumulator& acc)
+	{
+		int i = 0;
+		for (; i + 16 <= count; i += 16)
+		{
+			__m512i m = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*)(weights + i)));
+			__mmask16 valid = _mm512_test_epi32_mask(m, m);
+
+			if (valid == 0)
+				continue;
+
+			__m512i x, y, fraction;
+			unpackAvx512(offsetMap(map, i), x, y, fraction);
+			x = _mm512_maskz_mov_epi32(valid, x);
+			y = _mm512_maskz_mov_epi32(valid, y);
+			fraction = _mm512_maskz_mov_epi32(valid, fraction);
+
+			__m512i v[3];
+			sampleAvx512<S, Adjusted>(src, x, y, fraction, params, v);
+
+			int* b = acc.b + i;
+			int* g = acc.g + i;
+			int* r = acc.r + i;
+			_mm512_storeu_si512(b, _mm512_add_epi32(_mm512_loadu_si512(b), _mm512_mullo_epi32(m, v[0])));
+			_mm512_storeu_si512(g, _mm512_add_epi32(_mm512_loadu_si512(g), _mm512_mullo_epi32(m, v[1])));
+			_mm512_storeu_si512(r, _mm512_add_epi32(_mm512_loadu_si512(r), _mm512_mullo_epi32(m, v[2])));
+		}
+
+		accumulateSse41<S, Adjusted>(src, offsetMap(map, i), weights + i, count - i, params, offsetAccumulator(acc, i));
+	}
+
+	template <int S, bool Adjusted>
+	static void warpAvx512(const Source& src, const Map& map, int count, const Params& params, unsigned char* dst)
+	{
+		int i = 0;
+		for (; i + 16 <= count; i += 16, dst += 48)
+		{
+			__m512i x, y, fraction;
+			unpackAvx512(offsetMap(map, i), x, y, fraction);
+
+			__m512i v[3];
+			sampleAvx512<S, Adjusted>(src, x, y, fraction, params, v);
+
+			storeBgrSse(_mm512_extracti32x4_epi32(v[0], 0), _mm512_extracti32x4_epi32(v[1], 0), _mm512_extracti32x4_epi32(v[2], 0), dst);
+			storeBgrSse(_mm512_extracti32x4_epi32(v[0], 1), _mm512_extracti32x4_epi32(v[1], 1), _mm512_extracti32x4_epi32(v[2], 1), dst + 12);
+			storeBgrSse(_mm512_extracti32x4_epi32(v[0], 2), _mm512_extracti32x4_epi32(v[1], 2), _mm512_extracti32x4_epi32(v[2], 2), dst + 24);
+			storeBgrSse(_mm512_extracti32x4_epi32(v[0], 3), _mm512_extracti32x4_epi32(v[1], 3), _mm512_extracti32x4_epi32(v[2], 3), dst + 36);
+		}
+
+		warpSse41<S, Adjusted>(src, offsetMap(map, i), count - i, params, dst);
+	}
+#endif
+
+	// ---------- Dispatch ----------
+
+	static Isa detectIsa()
+	{
+		int info[4];
+		__cpuid(info, 0);
+		int maxLeaf = info[0];
+
+		if (maxLeaf < 1)
+			return Scalar;
+
+		__cpuid(info, 1);
+		bool sse41 = (info[2] & (1 << 19)) != 0;
+		bool osxsave = (info[2] & (1 << 27)) != 0;
+
+		// The OS must save the wider registers on a context switch
+		unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+		bool ymmState = (xcr0 & 0x06) == 0x06;
+		bool zmmState = (xcr0 & 0xE6) == 0xE6;
+
+		bool avx2 = false;
+		bool avx512 = false;
+		if (maxLeaf >= 7)
+		{
+			__cpuidex(info, 7, 0);
+			avx2 = (info[1] & (1 << 5)) != 0 && ymmState;
+			avx512 = (info[1] & (1 << 16)) != 0 && zmmState;
+		}
+
+#if WARP_KERNELS_AVX512
+		if (avx512)
+			return Avx512;
+#endif
+#if WARP_KERNELS_AVX2
+		if (avx2)
+			return Avx2;
+#endif
+		if (sse41)
+			return Sse41;
+
+		return Scalar;
+	}
+
+	static const Isa supportedIsa = detectIsa();
+	static Isa activeIsa = supportedIsa;
+	static bool selected = false;
+	static AccumulateFunction accumulateFunctions[SamplingCount][2];
+	static WarpFunction warpFunctions[SamplingCount][2];
+	static ResolveFunction resolveFunction = NULL;
+	static PackFunction packFunction = NULL;
+
+// Every specialisation of one instruction set's accumulate and warp
+#define WARP_KERNELS_TABLE(accumulateName, warpName) \
+	accumulateFunctions[SampleFlat][0] = accumulateName<SampleFlat, false>; \
+	accumulateFunctions[SampleFlat][1] = accumulateName<SampleFlat, true>; \
+	accumulateFunctions[SampleNearest][0] = accumulateName<SampleNearest, false>; \
+	accumulateFunctions[SampleNearest][1] = accumulateName<SampleNearest, true>; \
+	accumulateFunctions[SampleBilinear][0] = accumulateName<SampleBilinear, false>; \
+	accumulateFunctions[SampleBilinear][1] = accumulateName<SampleBilinear, true>; \
+	warpFunctions[SampleFlat][0] = warpName<SampleFlat, false>; \
+	warpFunctions[SampleFlat][1] = warpName<SampleFlat, true>; \
+	warpFunctions[SampleNearest][0] = warpName<SampleNearest, false>; \
+	warpFunctions[SampleNearest][1] = warpName<SampleNearest, true>; \
+	warpFunctions[SampleBilinear][0] = warpName<SampleBilinear, false>; \
+	warpFunctions[SampleBilinear][1] = warpName<SampleBilinear, true>;
+
+	static void selectFunctions()
+	{
+		switch (activeIsa)
+		{
+#if WARP_KERNELS_AVX512
+		case Avx512:
+			WARP_KERNELS_TABLE(accumulateAvx512, warpAvx512)
+			resolveFunction = resolveSse41;
+			packFunction = packBgrxSse41;
+			break;
+#endif
+#if WARP_KERNELS_AVX2
+		case Avx2:
+			WARP_KERNELS_TABLE(accumulateAvx2, warpAvx2)
+			resolveFunction = resolveSse41;
+			packFunction = packBgrxSse41;
+			break;
+#endif
+		case Sse41:
+			WARP_KERNELS_TABLE(accumulateSse41, warpSse41)
+			resolveFunction = resolveSse41;
+			packFunction = packBgrxSse41;
+			break;
+		default:
+			activeIsa = Scalar;
+			WARP_KERNELS_TABLE(accumulateScalar, warpScalar)
+			resolveFunction = resolveScalar;
+			packFunction = packBgrxScalar;
+			break;
+		}
+
+		selected = true;
+	}
+
+#undef WARP_KERNELS_TABLE
+
+	void setIsa(Isa isa)
+	{
+		activeIsa = isa > supportedIsa ? supportedIsa : isa;
+		selectFunctions();
+	}
+
+	Isa isa()
+	{
+		if (!selected)
+			selectFunctions();
+		return activeIsa;
+	}
+
+	const char* isaName()
+	{
+		switch (isa())
+		{
+		case Avx512:	return "AVX-512";
+		case Avx2:		return "AVX2";
+		case Sse41:		return "SSE4.1";
+		default:		return "Scalar";
+		}
+	}
+
+	Specialized specialize(const Params& params)
+	{
+		if (!selected)
+			selectFunctions();
+
+		int sampling = params.flat ? SampleFlat : (params.interpolate ? SampleBilinear : SampleNearest);
+		int adjusted = adjusts(params) ? 1 : 0;
+
+		Specialized functions;
+		functions.accumulate = accumulateFunctions[sampling][adjusted];
+		functions.warp = warpFunctions[sampling][adjusted];
+		return functions;
+	}
+
+	void accumulate(const Source& src, const Map& map, const unsigned short* weights,
+		int count, const Params& params, const Accumulator& acc)
+	{
+		specialize(params).accumulate(src, map, weights, count, params, acc);
+	}
+
+	void resolve(const Accumulator& acc, int count, unsigned char* dst)
+	{
+		if (!selected)
+			selectFunctions();
+		resolveFunction(acc, count, dst);
+	}
+
+	void warp(const Source& src, const Map& map, int count, const Params& params, unsigned char* dst)
+	{
+		specialize(params).warp(src, map, count, params, dst);
+	}
+
+	void packBgrx(const unsigned char* bgr, int count, unsigned char* dst)
+	{
+		if (!selected)
+			selectFunctions();
+		packFunction(bgr, count, dst);
+	}
+
+	// BT.601 luma with studio swing, the coefficients in 1/256ths
+	static inline unsigned char lumaOf(const unsigned char* bgr)
+	{
+		return (unsigned char)(((25 * bgr[0] + 129 * bgr[1] + 66 * bgr[2] + 128) >> 8) + 16);
+	}
+
+	void packI420(const unsigned char* bgrTop, const unsigned char* bgrBottom, int count,
+		unsigned char* yTop, unsigned char* yBottom, unsigned char* u, unsigned char* v)
+	{
+		for (int i=0; i<count; i+=2)
+		{
+			// An odd last column counts twice
+			int right = i + 1 < count ? i + 1 : i;
+			const unsigned char* p[4] = { bgrTop + 3 * i, bgrTop + 3 * right, bgrBottom + 3 * i, bgrBottom + 3 * right };
+
+			yTop[i] = lumaOf(p[0]);
+			yTop[right] = lumaOf(p[1]);
+			yBottom[i] = lumaOf(p[2]);
+			yBottom[right] = lumaOf(p[3]);
+
+			int b = (p[0][0] + p[1][0] + p[2][0] + p[3][0] + 2) >> 2;
+			int g = (p[0][1] + p[1][1] + p[2][1] + p[3][1] + 2) >> 2;
+			int r = (p[0][2] + p[1][2] + p[2][2] + p[3][2] + 2) >> 2;
+
+			u[i / 2] = (unsigned char)(((112 * b - 74 * g - 38 * r + 128) >> 8) + 128);
+			v[i / 2] = (unsigned char)(((-18 * b - 94 * g + 112 * r + 128) >> 8) + 128);
+		}
+	}
+}
@@ -0,0 +1,161 @@
+/*
+This file is part of StitcHD.
+
+StitcHD is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+StitcHD is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with StitcHD.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef WARPKERNELS_HPP
+#define WARPKERNELS_HPP
+
+// CPU counterparts of addFrameToPixel and the blend in stitch_kernel.
+// Each call works on a run of output pixels from one row. The fastest
+// instruction set the processor supports is picked at startup.
+namespace WarpKernels
+{
+	// Blend weights are fixed point, and the weights of one pixel add up to WeightOne
+	const int WeightBits = 15;
+	const int WeightOne = 1 << WeightBits;
+
+	// Warp maps hold a frame coordinate as whole pixels plus a fraction in
+	// 1/MapScale steps, the layout cv::convertMaps makes for cv::remap.
+	// That is 6 bytes a pixel, where a pair of floats is 8.
+	const int MapBits = 5;
+	const int MapScale = 1 << MapBits;
+
+	// A run of a packed warp map. xy holds the whole x, y pairs, and fractions
+	// holds fy * MapScale + fx, which indexes a table of bilinear weights.
+	struct Map
+	{
+		const short* xy;
+		const unsigned short* fractions;
+	};
+
+	// A BGR source frame
+	struct Source
+	{
+		const unsigned char* data;
+		int step;
+		int cols;
+		int rows;
+	};
+
+	// Weighted sums for a run of output pixels, one array per channel
+	struct Accumulator
+	{
+		int* b;
+		int* g;
+		int* r;
+	};
+
+	// Gains are fixed point, GainOne leaves a sample as it is
+	const int GainBits = 10;
+	const int GainOne = 1 << GainBits;
+
+	struct Params
+	{
+		bool interpolate;	// Bilinear instead of nearest-neighbour sampling
+		bool flat;			// Use tint alone instead of sampling (maximum tinting)
+		int gain[3];		// Multiplies every sample's B, G and R (exposure compensation)
+		int tint[3];		// Added to every sample after the gain (frame tinting)
+	};
+
+	// True if params changes samples after they are read, by gain or tint
+	inline bool adjusts(const Params& params)
+	{
+		for (int c=0; c<3; c++)
+		{
+			if (params.gain[c] != GainOne || params.tint[c] != 0)
+				return true;
+		}
+		return false;
+	}
+
+	enum Isa
+	{
+		Scalar,
+		Sse41,
+		Avx2,
+		Avx512
+	};
+
+	// True if a frame can be sampled at (tX, tY). Same test as addFrameToPixel,
+	// written so that NaNs and coordinates too large for an int fail it.
+	inline bool inFrame(float tX, float tY, int cols, int rows, bool interpolate)
+	{
+		int margin = interpolate ? 2 : 1;
+		return tX >= 0.5f && tX < float(cols - margin) + 0.5f
+			&& tY >= 0.5f && tY < float(rows - margin) + 0.5f;
+	}
+
+	// Packs count (x, y) pairs into map entries. Coordinates a short can't
+	// hold, and NaNs, are clamped to values that fail inFrame.
+	void packMap(const float* coords, int count, short* xy, unsigned short* fractions);
+
+	// The coordinate a packed map entry stands for
+	inline void unpackMap(const short* xy, unsigned short fraction, float& tX, float& tY)
+	{
+		tX = xy[0] + float(fraction & (MapScale - 1)) / MapScale;
+		tY = xy[1] + float(fraction >> MapBits) / MapScale;
+	}
+
+	// Samples src at the count coordinates in map and adds each sample, times
+	// its weight, to the accumulators. Pixels weighing 0 are skipped, and every
+	// other pixel must be inFrame.
+	void accumulate(const Source& src, const Map& map, const unsigned short* weights,
+		int count, const Params& params, const Accumulator& acc);
+
+	typedef void (*AccumulateFunction)(const Source& src, const Map& map, const unsigned short* weights,
+		int count, const Params& params, const Accumulator& acc);
+	typedef void (*WarpFunction)(const Source& src, const Map& map, int count, const Params& params, unsigned char* dst);
+
+	// accumulate and warp compiled for one sampling mode, with or without
+	// adjusting, so that their loops don't test params per pixel. They still
+	// take params for the gain and tint values. Pick them once per frame and
+	// call them directly.
+	struct Specialized
+	{
+		AccumulateFunction accumulate;
+		WarpFunction warp;
+	};
+
+	Specialized specialize(const Params& params);
+
+	// Divides out the weights and writes count BGR pixels to dst
+	void resolve(const Accumulator& acc, int count, unsigned char* dst);
+
+	// Samples src at the count coordinates in map and writes them straight
+	// to count BGR pixels at dst. For pixels only one frame covers, all of
+	// which must be inFrame.
+	void warp(const Source& src, const Map& map, int count, const Params& params, unsigned char* dst);
+
+	// Widens count BGR pixels to 32 bits, B, G, R, 255 in memory, which is
+	// what QImage::Format_RGB32 and Format_ARGB32 hold
+	void packBgrx(const unsigned char* bgr, int count, unsigned char* dst);
+
+	// Converts two rows of count BGR pixels to I420: a row of luma for each
+	// and one row of (count + 1) / 2 chroma samples, each averaging 2x2
+	// pixels. BT.601 with studio swing, as video encoders expect. For an odd
+	// last row, pass the same row twice.
+	void packI420(const unsigned char* bgrTop, const unsigned char* bgrBottom, int count,
+		unsigned char* yTop, unsigned char* yBottom, unsigned char* u, unsigned char* v);
+
+	// The instruction set in use, and a name for it
+	Isa isa();
+	const char* isaName();
+
+	// Forces a particular implementation, falling back if it isn't supported
+	void setIsa(Isa isa);
+}
+
+#endif // WARPKERNELS_HPP
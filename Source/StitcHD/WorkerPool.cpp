@@ -0,0 +1,208 @@
+/*
+This file is part of StitcHD.
+
+StitcHD is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+StitcHD is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with StitcHD.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "WorkerPool.hpp"
+
+#include <iostream>
+using namespace std;
+
+WorkerPool::WorkerPool()
+{
+	running = false;
+	threadCount = 1;
+	function = NULL;
+	context = NULL;
+	jobCount = 0;
+	nextJob = 0;
+}
+
+WorkerPool::~WorkerPool()
+{
+	stop();
+}
+
+int WorkerPool::processorCount()
+{
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors > 0 ? info.dwNumberOfProcessors : 1;
+}
+
+int WorkerPool::start(int count)
+{
+	if (count <= 0)
+		count = processorCount();
+
+	if (count > MaxThreads)
+		count = MaxThreads;
+
+	if (running)
+	{
+		if (count == threadCount)
+			return 0;
+		stop();
+	}
+
+	threadCount = count;
+
+	// The calling thread is the last worker
+	workers.resize(threadCount - 1);
+	doneEvents.resize(threadCount - 1);
+
+	// stop() cleans up after a failure from here on
+	running = true;
+
+	for (int i=0; i<workers.size(); i++)
+	{
+		workers[i].pool = this;
+		workers[i].index = i;
+		workers[i].threadHandle = NULL;
+		workers[i].startEvent = NULL;
+		workers[i].doneEvent = NULL;
+	}
+
+	for (int i=0; i<workers.size(); i++)
+	{
+		workers[i].startEvent = CreateEvent(
+			NULL,               // default security attributes
+			false,				// manual-reset?
+			false,              // initial state
+			NULL				// object name
+			);
+
+		workers[i].doneEvent = CreateEvent(
+			NULL,               // default security attributes
+			false,				// manual-reset?
+			false,              // initial state
+			NULL				// object name
+			);
+
+		if (workers[i].startEvent == NULL || workers[i].doneEvent == NULL)
+		{
+			printf("CreateEvent failed (%d)\n", GetLastError());
+			stop();
+			return -1;
+		}
+
+		doneEvents[i] = workers[i].doneEvent;
+	}
+
+	for (int i=0; i<workers.size(); i++)
+	{
+		workers[i].threadHandle = CreateThread(
+			NULL,				// default security attributes
+			0,					// use default stack size
+			StartThread,		// thread function name
+			&workers[i],		// argument to thread function
+			0,					// use default creation flags
+			NULL);				// returns the thread identifier
+
+		if (workers[i].threadHandle == NULL)
+		{
+			cout << "Could not start WorkerPool thread " << i << '.' << endl;
+			stop();
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+int WorkerPool::stop()
+{
+	if (!running)
+		return 0;
+
+	running = false;
+
+	for (int i=0; i<workers.size(); i++)
+	{
+		if (workers[i].threadHandle == NULL)
+			continue;
+
+		SetEvent(workers[i].startEvent);
+		WaitForSingleObject(workers[i].threadHandle, INFINITE);
+		CloseHandle(workers[i].threadHandle);
+	}
+
+	for (int i=0; i<workers.size(); i++)
+	{
+		if (workers[i].startEvent != NULL)
+			CloseHandle(workers[i].startEvent);
+		if (workers[i].doneEvent != NULL)
+			CloseHandle(workers[i].doneEvent);
+	}
+
+	workers.clear();
+	doneEvents.clear();
+	threadCount = 1;
+
+	return 0;
+}
+
+void WorkerPool::run(JobFunction f, void* c, int count)
+{
+	function = f;
+	context = c;
+	jobCount = count;
+	nextJob = -1;
+
+	// Don't wake up threads which won't get a job
+	int helpers = 0;
+	if (running)
+		helpers = min((int)workers.size(), count - 1);
+
+	for (int i=0; i<helpers; i++)
+		SetEvent(workers[i].startEvent);
+
+	runJobs();
+
+	if (helpers > 0)
+	{
+		DWORD waitResult = WaitForMultipleObjects(
+			helpers,			// number of handles in array
+			&doneEvents[0],		// array of event handles
+			true,				// wait until all are signaled
+			INFINITE);			// timeout
+
+		if (waitResult != WAIT_OBJECT_0)
+			printf("WorkerPool wait failed (%d)\n", GetLastError());
+	}
+}
+
+void WorkerPool::runJobs()
+{
+	for (LONG job = InterlockedIncrement(&nextJob); job < jobCount; job = InterlockedIncrement(&nextJob))
+		function(context, job);
+}
+
+int WorkerPool::runWorker(Worker& worker)
+{
+	while (true)
+	{
+		WaitForSingleObject(worker.startEvent, INFINITE);
+
+		if (!running)
+			break;
+
+		runJobs();
+
+		SetEvent(worker.doneEvent);
+	}
+
+	return 0;
+}
@@ -0,0 +1,93 @@
+/*
+This file is part of StitcHD.
+
+StitcHD is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+StitcHD is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with StitcHD.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef WORKERPOOL_HPP
+#define WORKERPOOL_HPP
+
+#include <Windows.h>
+
+#include <vector>
+using namespace std;
+
+// A set of persistent worker threads.
+// run() hands out jobs 0..jobCount-1 to the workers and the calling thread,
+// and returns once every job has finished.
+class WorkerPool
+{
+public:
+
+	typedef void (*JobFunction)(void* context, int job);
+
+	WorkerPool();
+	~WorkerPool();
+
+	// Total number of threads taking part in run(), including the caller
+	int size() const { return threadCount; }
+
+	// (Re)start with threadCount threads. 0 picks one per processor.
+	// Either way there are at most MaxThreads.
+	int start(int threadCount);
+	int stop();
+
+	void run(JobFunction function, void* context, int jobCount);
+
+	static int processorCount();
+
+	// run() waits on every helper at once, and the caller is the last worker
+	static const int MaxThreads = MAXIMUM_WAIT_OBJECTS + 1;
+
+private:
+
+	struct Worker
+	{
+		WorkerPool* pool;
+		int index;
+		HANDLE threadHandle;
+		HANDLE startEvent;
+		HANDLE doneEvent;
+	};
+
+	volatile bool running;
+	int threadCount;
+	vector<Worker> workers;
+	vector<HANDLE> doneEvents;
+
+	// The current batch of jobs
+	JobFunction function;
+	void* context;
+	int jobCount;
+	volatile LONG nextJob;
+
+	// Pulls jobs until none are left
+	void runJobs();
+
+	// Thread entry point
+	static DWORD WINAPI StartThread(LPVOID arg)
+	{
+		Worker* worker = (Worker*)arg;
+		return worker->pool->runWorker(*worker);
+	}
+
+	// Thread function
+	int runWorker(Worker& worker);
+
+	// Not copyable
+	WorkerPool(const WorkerPool&);
+	WorkerPool& operator=(const WorkerPool&);
+};
+
+#endif // WORKERPOOL_HPP
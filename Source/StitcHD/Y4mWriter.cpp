@@ -0,0 +1,123 @@
+/*
+This file is part of StitcHD.
+
+StitcHD is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+StitcHD is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with StitcHD.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "Y4mWriter.hpp"
+#include "WarpKernels.hpp"
+
+#include <iostream>
+
+Y4mWriter::Y4mWriter()
+	:size(0, 0),
+	uOffset(0),
+	vOffset(0)
+{
+}
+
+Y4mWriter::~Y4mWriter()
+{
+	release();
+}
+
+bool Y4mWriter::open(const string& fileName, Size frameSize, int fps)
+{
+	release();
+
+	file.open(fileName.c_str(), ios::out | ios::binary);
+	if (!file.is_open())
+	{
+		cout << "ERROR: Could not open " << fileName << " for recording." << endl;
+		return false;
+	}
+
+	size = frameSize;
+
+	int chromaWidth = (size.width + 1) / 2;
+	int chromaHeight = (size.height + 1) / 2;
+	uOffset = size.width * size.height;
+	vOffset = uOffset + chromaWidth * chromaHeight;
+	buffer.resize(vOffset + chromaWidth * chromaHeight);
+
+	// Progressive, square pixels, chroma sited between the luma samples as
+	// packI420 averages it
+	file << "YUV4MPEG2 W" << size.width << " H" << size.height << " F" << fps << ":1 Ip A1:1 C420jpeg\n";
+
+	return true;
+}
+
+void Y4mWriter::release()
+{
+	if (file.is_open())
+		file.close();
+}
+
+bool Y4mWriter::isOpened() const
+{
+	return file.is_open();
+}
+
+void Y4mWriter::writeFrame()
+{
+	if (!file.is_open())
+		return;
+
+	file << "FRAME\n";
+	file.write((const char*)&buffer[0], buffer.size());
+}
+
+void Y4mWriter::write(const Mat& frame)
+{
+	if (!file.is_open() || frame.type() != CV_8UC3)
+		return;
+
+	const Mat* source = &frame;
+
+	if (frame.size() != size)
+	{
+		padded.create(size, CV_8UC3);
+		padded.setTo(Scalar::all(0));
+
+		Rect shared(0, 0, min(size.width, frame.cols), min(size.height, frame.rows));
+		Mat region = padded(shared);
+		frame(shared).copyTo(region);
+		source = &padded;
+	}
+
+	int chromaWidth = (size.width + 1) / 2;
+
+	for (int r = 0; r < size.height; r += 2)
+	{
+		int bottom = min(r + 1, size.height - 1);
+
+		WarpKernels::packI420(source->ptr(r), source->ptr(bottom), size.width,
+			&buffer[r * size.width], &buffer[bottom * size.width],
+			&buffer[uOffset + (r / 2) * chromaWidth], &buffer[vOffset + (r / 2) * chromaWidth]);
+	}
+
+	writeFrame();
+}
+
+unsigned char* Y4mWriter::pixelTarget(void* context, Size targetSize, int& step)
+{
+	Y4mWriter* writer = (Y4mWriter*)context;
+
+	if (!writer->isOpened() || targetSize != writer->size)
+		return NULL;
+
+	step = targetSize.width;
+	return writer->frameBuffer();
+}
@@ -0,0 +1,72 @@
+/*
+This file is part of StitcHD.
+
+StitcHD is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+StitcHD is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with StitcHD.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef Y4MWRITER_HPP
+#define Y4MWRITER_HPP
+
+#include <fstream>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include <opencv2/core/core.hpp>
+using namespace cv;
+
+// Writes uncompressed I420 video as YUV4MPEG2, which encoders such as
+// ffmpeg and x264 take as it is. The CPU stitcher can fill frameBuffer()
+// while it renders, so the frames never get a conversion pass of their own.
+class Y4mWriter
+{
+public:
+
+	Y4mWriter();
+	~Y4mWriter();
+
+	bool open(const string& fileName, Size size, int fps);
+	void release();
+	bool isOpened() const;
+
+	// The next frame: the Y, U and V planes one after another, with rows of
+	// size.width bytes for Y and (size.width + 1) / 2 for U and V
+	unsigned char* frameBuffer() { return &buffer[0]; }
+	Size frameSize() const { return size; }
+
+	// Writes frameBuffer() as the next frame
+	void writeFrame();
+
+	// Converts a BGR frame into frameBuffer() and writes it. A frame of
+	// another size is cropped, or padded with black.
+	void write(const Mat& frame);
+
+	// An ImageStitcher::PixelTargetFunction for I420, context being the
+	// writer. Gives frameBuffer() when size is the file's, NULL otherwise.
+	static unsigned char* pixelTarget(void* context, Size size, int& step);
+
+private:
+
+	ofstream file;
+	Size size;
+	vector<unsigned char> buffer;
+	Mat padded;
+
+	// Offsets of the U and V planes in buffer
+	int uOffset;
+	int vOffset;
+};
+
+#endif // Y4MWRITER_HPP
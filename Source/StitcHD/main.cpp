@@ -20,6 +20,7 @@ along with StitcHD.  If not, see <http://www.gnu.org/licenses/>.
 #include "VideoStitcher.hpp"
 #include "ImageStitcher.hpp"
 #include "Config.hpp"
+#include "OfflineStitcher.hpp"
 #include "Utils.h"
 #include "Timer.hpp"
 #include "DShowUtility.h"
@@ -62,6 +63,20 @@ void setAlphaExponential(int state,void* param)
 		*((int*)param) = 3;
 	}
 }
+void setAlphaMultiBand(int state,void* param)
+{
+	if (state)
+	{
+		*((int*)param) = 4;
+	}
+}
+void setAlphaSeamCut(int state,void* param)
+{
+	if (state)
+	{
+		*((int*)param) = 5;
+	}
+}
 void setMaxTint(int state,void* param)
 {
 	*((bool*)param) = state;
@@ -70,6 +85,10 @@ void setInterpolation(int state,void* param)
 {
 	*((bool*)param) = state;
 }
+void setLockCalibration(int state,void* param)
+{
+	*((bool*)param) = state;
+}
 
 int runStitcHD()
 {
@@ -87,6 +106,8 @@ int runStitcHD()
 	createButton("Alpha Blend - Constant (Average)", setAlphaConstant, &stitcher.config.alphaBlend, CV_RADIOBOX, (stitcher.config.alphaBlend == 1));
 	createButton("Alpha Blend - Linear", setAlphaLinear, &stitcher.config.alphaBlend, CV_RADIOBOX, (stitcher.config.alphaBlend == 2));
 	createButton("Alpha Blend - Exponential", setAlphaExponential, &stitcher.config.alphaBlend, CV_RADIOBOX, (stitcher.config.alphaBlend == 3));
+	createButton("Alpha Blend - Multi-band", setAlphaMultiBand, &stitcher.config.alphaBlend, CV_RADIOBOX, (stitcher.config.alphaBlend == 4));
+	createButton("Alpha Blend - Seam cut", setAlphaSeamCut, &stitcher.config.alphaBlend, CV_RADIOBOX, (stitcher.config.alphaBlend == 5));
 
 	createTrackbar("Blending", "", &stitcher.config.expBlendValue, 100);
 	
@@ -96,6 +117,8 @@ int runStitcHD()
 
 	createButton("Use Maximum Tinting", setMaxTint, &stitcher.config.maxTint, CV_CHECKBOX, stitcher.config.maxTint);
 
+	createButton("Lock Calibration", setLockCalibration, &stitcher.config.lockCalibration, CV_CHECKBOX, stitcher.config.lockCalibration);
+
 	createTrackbar("Hmg Alpha", "", &stitcher.config.hmgTransitionAlpha, 100);
 	createTrackbar("Overlap", "", &stitcher.config.frameOverlap, 100);
 	createTrackbar("Hessian", "", &stitcher.config.hessianThreshold, 2000);
@@ -202,6 +225,47 @@ int viewCameras()
 	return 0;
 }
 
+int stitchVideoFiles()
+{
+	Config settings = Config::getConfig();
+
+	vector<string> inputFiles;
+	for (int i=0; i<settings.camCount; i++)
+	{
+		cout << "Video file for camera " << i << ": ";
+
+		// Whole lines, as paths can have spaces in them
+		string fileName;
+		cin >> ws;
+		getline(cin, fileName);
+		inputFiles.push_back(fileName);
+	}
+
+	string outputFile = videoOutputFileName(settings.recordFormat == 1 ? ".y4m" : ".mpeg");
+	if (outputFile.empty())
+		return -1;
+
+	Timer timer(settings);
+
+	if (timer.start())
+		return -1;
+
+	OfflineStitcher stitcher(settings);
+
+	cout << "Stitching into " << outputFile << endl;
+	int frames = stitcher.run(inputFiles, outputFile);
+
+	timer.stop();
+
+	timer.writeToFile();
+
+	if (frames < 0)
+		return -1;
+
+	cout << "Wrote " << frames << " frames, " << stitcher.slotCount() << " at a time." << endl << endl;
+	return 0;
+}
+
 int mainMenu()
 {
 	string prompt = "Menu choice: ";
@@ -210,7 +274,8 @@ int mainMenu()
 		cout << "--- StitcHD Main Menu ---" << endl
 			<< "1 - Run StitcHD" << endl
 			<< "2 - View Cameras" << endl
-			<< "3 - Quit" << endl << endl;
+			<< "3 - Quit" << endl
+			<< "4 - Stitch Video Files" << endl << endl;
 
 		cout << prompt;
 		string inputStr;
@@ -227,6 +292,7 @@ int mainMenu()
 
 		if		(choice == 1)	runStitcHD();
 		else if	(choice == 2)	viewCameras();
+		else if	(choice == 4)	stitchVideoFiles();
 		else
 			return 0;
 	}
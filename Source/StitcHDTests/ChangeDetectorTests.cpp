@@ -0,0 +1,123 @@
+/*
+This file is part of StitcHD.
+
+StitcHD is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+StitcHD is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with StitcHD.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Tests.hpp"
+#include "ChangeDetector.hpp"
+
+#include <opencv2/core/core.hpp>
+using namespace cv;
+
+static const int Threshold = 8;
+
+// The pixels of block (bx, by)
+static Rect block(int bx, int by)
+{
+	return Rect(bx * ChangeDetector::BlockSize, by * ChangeDetector::BlockSize, ChangeDetector::BlockSize, ChangeDetector::BlockSize);
+}
+
+static void brighten(Mat& frame, Rect rect, int amount)
+{
+	for (int r = rect.y; r < rect.y + rect.height; r++)
+	{
+		unsigned char* row = frame.ptr(r);
+		for (int c = 3 * rect.x; c < 3 * (rect.x + rect.width); c++)
+			row[c] = (unsigned char)(row[c] + amount);
+	}
+}
+
+int testChangeDetector()
+{
+	int failedBefore = failures();
+
+	// Three blocks across, two down
+	Mat frame(2 * ChangeDetector::BlockSize, 3 * ChangeDetector::BlockSize, CV_8UC3, Scalar::all(100));
+	Rect whole(0, 0, frame.cols, frame.rows);
+
+	ChangeDetector detector;
+
+	// Everything has changed the first time, and is still in the history
+	// after one still frame
+	detector.update(frame, Threshold);
+	CHECK(detector.changed(block(0, 0)));
+	CHECK(detector.changed(block(2, 1)));
+
+	detector.update(frame, Threshold);
+	CHECK(!detector.changed(whole));
+	CHECK(detector.changed(whole, 2));
+
+	detector.update(frame, Threshold);
+	CHECK(!detector.changed(whole, 2));
+	CHECK(!detector.changed(Rect(0, 0, 0, 0)));
+
+	// A change over the threshold marks its block alone, and rectangles
+	// that reach into it
+	brighten(frame, block(1, 0), Threshold + 2);
+	detector.update(frame, Threshold);
+	CHECK(detector.changed(block(1, 0)));
+	CHECK(!detector.changed(block(0, 0)));
+	CHECK(!detector.changed(block(2, 0)));
+	CHECK(!detector.changed(block(1, 1)));
+	CHECK(detector.changed(Rect(ChangeDetector::BlockSize - 2, 0, 4, 4)));
+	CHECK(detector.changed(whole));
+
+	// It stays in the history for one more update
+	detector.update(frame, Threshold);
+	CHECK(!detector.changed(block(1, 0)));
+	CHECK(detector.changed(block(1, 0), 2));
+
+	// Changes up to the threshold don't count, but they add up against
+	// the block's sample until they do
+	brighten(frame, block(0, 1), Threshold);
+	detector.update(frame, Threshold);
+	CHECK(!detector.changed(block(0, 1)));
+
+	brighten(frame, block(0, 1), Threshold / 2);
+	detector.update(frame, Threshold);
+	CHECK(detector.changed(block(0, 1)));
+
+	// Once marked, the block is sampled again
+	detector.update(frame, Threshold);
+	CHECK(!detector.changed(block(0, 1)));
+
+	// A threshold of 0 takes any change
+	brighten(frame, block(2, 1), 1);
+	detector.update(frame, 0);
+	CHECK(detector.changed(block(2, 1)));
+	CHECK(!detector.changed(block(2, 0)));
+
+	// Partial blocks at the edges of a frame of another size, which marks
+	// everything again
+	Mat odd(ChangeDetector::BlockSize + 5, ChangeDetector::BlockSize + 7, CV_8UC3, Scalar::all(50));
+	detector.update(odd, Threshold);
+	CHECK(detector.changed(Rect(0, 0, odd.cols, odd.rows)));
+
+	detector.update(odd, Threshold);
+	detector.update(odd, Threshold);
+	CHECK(!detector.changed(Rect(0, 0, odd.cols, odd.rows), 2));
+
+	brighten(odd, Rect(ChangeDetector::BlockSize, ChangeDetector::BlockSize, 7, 5), Threshold + 2);
+	detector.update(odd, Threshold);
+	CHECK(detector.changed(Rect(ChangeDetector::BlockSize, ChangeDetector::BlockSize, 7, 5)));
+	CHECK(!detector.changed(Rect(0, 0, ChangeDetector::BlockSize, ChangeDetector::BlockSize)));
+
+	// After a reset everything has changed
+	detector.reset();
+	detector.update(odd, Threshold);
+	CHECK(detector.changed(Rect(0, 0, 1, 1)));
+
+	return failures() - failedBefore;
+}
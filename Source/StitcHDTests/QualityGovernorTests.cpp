@@ -0,0 +1,194 @@
+/*
+This file is part of StitcHD.
+
+StitcHD is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+StitcHD is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with StitcHD.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Tests.hpp"
+#include "QualityGovernor.hpp"
+#include "Config.hpp"
+
+#include <cstring>
+
+static const int Target = 33;
+
+// Frames well over the target, most of it stitching
+static const int SlowFrame = 50;
+static const int SlowStitch = 40;
+
+// Frames well inside the headroom
+static const int FastFrame = 10;
+
+static void slowFrames(QualityGovernor& governor, int count)
+{
+	for (int i=0; i<count; i++)
+		governor.update(Target, SlowFrame, SlowFrame - SlowStitch, SlowStitch);
+}
+
+static void fastFrames(QualityGovernor& governor, int count)
+{
+	for (int i=0; i<count; i++)
+		governor.update(Target, FastFrame, FastFrame / 2, FastFrame / 2);
+}
+
+// Steps down once, then lets the change settle
+static void stepDown(QualityGovernor& governor)
+{
+	slowFrames(governor, QualityGovernor::StepDownFrames);
+	slowFrames(governor, QualityGovernor::SettleFrames);
+}
+
+static void testLevels()
+{
+	QualityGovernor governor;
+	CHECK(governor.getLevel() == QualityGovernor::Full);
+	CHECK(governor.viewScale() == 1);
+	CHECK(!governor.fewerHomographies());
+
+	// Times that couldn't be measured are left out
+	governor.update(Target, -1, 0, 0);
+	CHECK(governor.averageFrameTime() == 0);
+
+	// Off with no target
+	for (int i=0; i<2 * QualityGovernor::StepDownFrames; i++)
+		governor.update(0, SlowFrame, SlowFrame - SlowStitch, SlowStitch);
+	CHECK(governor.getLevel() == QualityGovernor::Full);
+	CHECK(governor.averageFrameTime() == SlowFrame);
+
+	// Slow cameras aren't the stitcher's to make up for
+	QualityGovernor cameraBound;
+	for (int i=0; i<2 * QualityGovernor::StepDownFrames; i++)
+		cameraBound.update(Target, SlowFrame, SlowFrame - 5, 5);
+	CHECK(cameraBound.getLevel() == QualityGovernor::Full);
+
+	// Steps down on the StepDownFrames'th slow frame
+	slowFrames(governor, QualityGovernor::StepDownFrames - 1);
+	CHECK(governor.getLevel() == QualityGovernor::Full);
+	slowFrames(governor, 1);
+	CHECK(governor.getLevel() == QualityGovernor::NoInterpolation);
+
+	// The frames just after a change are left out, and the averages start
+	// over from the first one after them
+	for (int i=0; i<QualityGovernor::SettleFrames; i++)
+		governor.update(Target, 1000, 10, 990);
+	CHECK(governor.averageFrameTime() == SlowFrame);
+	governor.update(Target, 60, 10, 50);
+	CHECK(governor.averageFrameTime() == 60);
+	CHECK(governor.averageCaptureTime() == 10);
+	CHECK(governor.averageStitchTime() == 50);
+	slowFrames(governor, QualityGovernor::StepDownFrames - 1);
+	CHECK(governor.getLevel() == QualityGovernor::LinearBlend);
+
+	// One level at a time to the bottom, and no further
+	slowFrames(governor, QualityGovernor::SettleFrames);
+	stepDown(governor);
+	CHECK(governor.getLevel() == QualityGovernor::ThreeQuarterScale);
+	CHECK(governor.viewScale() == 0.75);
+	stepDown(governor);
+	CHECK(governor.getLevel() == QualityGovernor::HalfScale);
+	CHECK(governor.viewScale() == 0.5);
+	CHECK(!governor.fewerHomographies());
+	slowFrames(governor, QualityGovernor::StepDownFrames);
+	CHECK(governor.getLevel() == QualityGovernor::FewerHomographies);
+	CHECK(governor.fewerHomographies());
+	stepDown(governor);
+	stepDown(governor);
+	CHECK(governor.getLevel() == QualityGovernor::FewerHomographies);
+
+	// Steps up only after a longer run with headroom, once the average
+	// has come down
+	int fast = 0;
+	while (governor.getLevel() == QualityGovernor::FewerHomographies && fast < 10 * QualityGovernor::StepUpFrames)
+	{
+		fastFrames(governor, 1);
+		fast++;
+	}
+	CHECK(governor.getLevel() == QualityGovernor::HalfScale);
+	CHECK(fast > QualityGovernor::StepUpFrames);
+
+	// Which from a fresh average is StepUpFrames after the change settles
+	fastFrames(governor, QualityGovernor::SettleFrames + QualityGovernor::StepUpFrames - 1);
+	CHECK(governor.getLevel() == QualityGovernor::HalfScale);
+	fastFrames(governor, 1);
+	CHECK(governor.getLevel() == QualityGovernor::ThreeQuarterScale);
+
+	// Frames over the headroom but under the target hold the level
+	QualityGovernor held;
+	stepDown(held);
+	for (int i=0; i<2 * QualityGovernor::StepUpFrames; i++)
+		held.update(Target, Target - 2, 5, Target - 7);
+	CHECK(held.getLevel() == QualityGovernor::NoInterpolation);
+
+	// Dropping the target goes straight back to full quality once the
+	// change has settled
+	fastFrames(governor, QualityGovernor::SettleFrames);
+	governor.update(0, SlowFrame, SlowFrame - SlowStitch, SlowStitch);
+	CHECK(governor.getLevel() == QualityGovernor::Full);
+}
+
+static void testApply()
+{
+	Config config;
+	config.interpolate = true;
+
+	QualityGovernor governor;
+	Config governed;
+
+	const int blends[] = { 0, 1, 2, 3, 4, 5 };
+	const int linearBlends[] = { 0, 1, 2, 3, 2, 2 };
+
+	for (int b=0; b<6; b++)
+	{
+		config.alphaBlend = blends[b];
+		governor.apply(config, governed);
+		CHECK(governed.interpolate);
+		CHECK(governed.alphaBlend == blends[b]);
+	}
+
+	stepDown(governor);
+	config.alphaBlend = 5;
+	governor.apply(config, governed);
+	CHECK(!governed.interpolate);
+	CHECK(governed.alphaBlend == 5);
+
+	// Multi-band and seam cut drop to linear, the others cost no more
+	stepDown(governor);
+	CHECK(governor.getLevel() == QualityGovernor::LinearBlend);
+	for (int b=0; b<6; b++)
+	{
+		config.alphaBlend = blends[b];
+		governor.apply(config, governed);
+		CHECK(!governed.interpolate);
+		CHECK(governed.alphaBlend == linearBlends[b]);
+	}
+
+	// The rest of the config is copied as it is
+	config.targetFrameTime = 40;
+	governor.apply(config, governed);
+	CHECK(governed.targetFrameTime == 40);
+	CHECK(config.alphaBlend == 5 && config.interpolate);
+}
+
+int testQualityGovernor()
+{
+	int failedBefore = failures();
+
+	testLevels();
+	testApply();
+
+	CHECK(strcmp(QualityGovernor::levelName(QualityGovernor::Full), "Full") == 0);
+	CHECK(strcmp(QualityGovernor::levelName(QualityGovernor::LevelCount), "Unknown") == 0);
+
+	return failures() - failedBefore;
+}
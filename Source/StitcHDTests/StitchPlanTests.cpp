@@ -0,0 +1,184 @@
+/*
+This file is part of StitcHD.
+
+StitcHD is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+StitcHD is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with StitcHD.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Tests.hpp"
+#include "StitchPlan.hpp"
+#include "Homographier.hpp"
+#include "WarpKernels.hpp"
+
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <vector>
+using namespace std;
+
+#include <opencv2/core/core.hpp>
+using namespace cv;
+
+// Half a map step, the furthest packing may round a coordinate
+static const float HalfStep = 0.5f / WarpKernels::MapScale;
+
+static Mat homography(double h00, double h01, double h02, double h10, double h11, double h12, double h20, double h21)
+{
+	return (Mat_<HOM_MAT_TYPE>(3,3) << h00, h01, h02, h10, h11, h12, h20, h21, 1);
+}
+
+static void testPackMap()
+{
+	using namespace WarpKernels;
+
+	// Whole pixels, then fy * MapScale + fx. Negative coordinates floor, so
+	// the fractions stay positive, and halves of a step round up.
+	const float coords[] =
+	{
+		2.25f, 3.5f,
+		-0.25f, -1,
+		5 + 1.0f / (2 * MapScale), 0,
+		numeric_limits<float>::quiet_NaN(), 1,
+		1, 1e6f,
+		-1e6f, 1
+	};
+	const int count = sizeof(coords) / sizeof(coords[0]) / 2;
+
+	short xy[2 * count];
+	unsigned short fractions[count];
+	packMap(coords, count, xy, fractions);
+
+	CHECK(xy[0] == 2 && xy[1] == 3);
+	CHECK(fractions[0] == (MapScale / 2) * MapScale + MapScale / 4);
+
+	CHECK(xy[2] == -1 && xy[3] == -1);
+	CHECK(fractions[1] == 3 * MapScale / 4);
+
+	CHECK(xy[4] == 5 && xy[5] == 0);
+	CHECK(fractions[2] == 1);
+
+	// What a short can't hold is clamped out of every frame
+	for (int i=3; i<count; i++)
+	{
+		float tX, tY;
+		unpackMap(&xy[2*i], fractions[i], tX, tY);
+		CHECK(!inFrame(tX, tY, 64, 64, false));
+		CHECK(!inFrame(tX, tY, SHRT_MAX / 2, SHRT_MAX / 2, false));
+	}
+
+	// Anything in range comes back within half a step
+	srand(1);
+	vector<float> random(2 * 1000);
+	for (size_t i=0; i<random.size(); i++)
+		random[i] = (rand() - RAND_MAX / 2) * 2000.0f / RAND_MAX;
+
+	vector<short> randomXy(random.size());
+	vector<unsigned short> randomFractions(random.size() / 2);
+	packMap(&random[0], (int)randomFractions.size(), &randomXy[0], &randomFractions[0]);
+
+	for (size_t i=0; i<randomFractions.size(); i++)
+	{
+		float tX, tY;
+		unpackMap(&randomXy[2*i], randomFractions[i], tX, tY);
+		CHECK(fabs(tX - random[2*i]) <= HalfStep * 1.001f);
+		CHECK(fabs(tY - random[2*i + 1]) <= HalfStep * 1.001f);
+	}
+}
+
+// True if every pixel of camera i's map is within error of the exact projection
+static bool mapWithin(const StitchPlan& plan, int i, const Mat& h, double error)
+{
+	for (int y = 0; y < plan.canvasSize.height; y++)
+	{
+		for (int x = 0; x < plan.canvasSize.width; x++)
+		{
+			double z = h.at<HOM_MAT_TYPE>(2, 0) * x + h.at<HOM_MAT_TYPE>(2, 1) * y + h.at<HOM_MAT_TYPE>(2, 2);
+			double exactX = (h.at<HOM_MAT_TYPE>(0, 0) * x + h.at<HOM_MAT_TYPE>(0, 1) * y + h.at<HOM_MAT_TYPE>(0, 2)) / z;
+			double exactY = (h.at<HOM_MAT_TYPE>(1, 0) * x + h.at<HOM_MAT_TYPE>(1, 1) * y + h.at<HOM_MAT_TYPE>(1, 2)) / z;
+
+			WarpKernels::Map map = plan.warpMap(i, x, y);
+			float tX, tY;
+			WarpKernels::unpackMap(map.xy, map.fractions[0], tX, tY);
+
+			if (fabs(tX - exactX) > error || fabs(tY - exactY) > error)
+				return false;
+		}
+	}
+	return true;
+}
+
+static void testPlanMaps()
+{
+	Size canvas(80, 48);
+	Size frame(64, 48);
+
+	vector<Mat> hmgs;
+	hmgs.push_back(Mat::eye(3, 3, DataType<HOM_MAT_TYPE>::type));
+	hmgs.push_back(homography(1, 0, -10.5, 0, 1, 3.25, 0, 0));
+	hmgs.push_back(homography(1, 0, 5, 0, 1, -2, 0, 0));
+	hmgs.push_back(homography(1.02, 0.01, -3, 0.005, 0.99, 2, 1e-4, 2e-4));
+
+	vector<Size> sizes(hmgs.size(), frame);
+
+	StitchPlan plan;
+	plan.build(hmgs, sizes, canvas, Projection(), 0);
+
+	CHECK(plan.camCount == (int)hmgs.size());
+	CHECK(plan.builds == 1);
+	CHECK(plan.matches(hmgs, sizes, canvas, Projection(), 0));
+	CHECK(!plan.matches(hmgs, sizes, canvas, Projection(), 0.5));
+	CHECK(plan.sourcesMatch(sizes));
+
+	// Packed as WarpKernels::Map describes, one entry per canvas pixel
+	for (int i=0; i<plan.camCount; i++)
+	{
+		CHECK(plan.warpCoords[i].type() == CV_16SC2);
+		CHECK(plan.warpFractions[i].type() == CV_16U);
+		CHECK(plan.warpCoords[i].size() == canvas);
+		CHECK(plan.warpFractions[i].size() == canvas);
+	}
+
+	WarpKernels::Map map = plan.warpMap(1, 7, 5);
+	CHECK(map.xy == plan.warpCoords[1].ptr<short>(5) + 2 * 7);
+	CHECK(map.fractions == plan.warpFractions[1].ptr<unsigned short>(5) + 7);
+
+	// Translations by whole map steps pack exactly
+	CHECK(mapWithin(plan, 0, hmgs[0], 0));
+	CHECK(mapWithin(plan, 1, hmgs[1], 0));
+	CHECK(mapWithin(plan, 2, hmgs[2], 0));
+
+	// Every pixel projected, then rounded to the nearest step
+	CHECK(mapWithin(plan, 3, hmgs[3], HalfStep + 1e-3));
+
+	// Only whole-pixel translations can copy rows
+	CHECK(plan.translated[0] && plan.translations[0] == Point(0, 0));
+	CHECK(!plan.translated[1]);
+	CHECK(plan.translated[2] && plan.translations[2] == Point(5, -2));
+	CHECK(!plan.translated[3]);
+
+	// Interpolating between knots stays within maxWarpError as well
+	StitchPlan approximate;
+	approximate.build(hmgs, sizes, canvas, Projection(), 0.25);
+	CHECK(mapWithin(approximate, 3, hmgs[3], 0.25 + HalfStep + 1e-3));
+}
+
+int testStitchPlan()
+{
+	int failedBefore = failures();
+
+	testPackMap();
+	testPlanMaps();
+
+	return failures() - failedBefore;
+}
@@ -0,0 +1,38 @@
+/*
+This file is part of StitcHD.
+
+StitcHD is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+StitcHD is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with StitcHD.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Tests.hpp"
+
+#include <iostream>
+using namespace std;
+
+static int failed = 0;
+
+bool check(bool passed, const char* condition, const char* file, int line)
+{
+	if (!passed)
+	{
+		failed++;
+		cout << "FAILED: " << condition << " (" << file << ", line " << line << ")" << endl;
+	}
+	return passed;
+}
+
+int failures()
+{
+	return failed;
+}
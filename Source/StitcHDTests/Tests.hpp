@@ -0,0 +1,38 @@
+/*
+This file is part of StitcHD.
+
+StitcHD is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+StitcHD is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with StitcHD.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TESTS_HPP
+#define TESTS_HPP
+
+// Checks for the parts of the stitcher that work without cameras or a GPU.
+// Each suite returns how many of its checks failed.
+
+#define CHECK(condition) check((condition), #condition, __FILE__, __LINE__)
+
+// Prints the condition and where it is if it failed
+bool check(bool passed, const char* condition, const char* file, int line);
+
+// Failed checks so far, over every suite
+int failures();
+
+int testWarpKernels();
+int testY4mWriter();
+int testChangeDetector();
+int testQualityGovernor();
+int testStitchPlan();
+
+#endif // TESTS_HPP
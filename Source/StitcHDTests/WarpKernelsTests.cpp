@@ -0,0 +1,245 @@
+/*
+This file is part of StitcHD.
+
+StitcHD is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+StitcHD is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with StitcHD.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Tests.hpp"
+#include "WarpKernels.hpp"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <vector>
+using namespace std;
+
+using namespace WarpKernels;
+
+// Runs of random pixels, each checked with every instruction set against
+// the scalar kernels, which the SIMD ones must match to the bit
+static const int Trials = 400;
+
+// Slack after each run, as the SIMD kernels may load a vector past the end
+static const int Padding = 64;
+
+static float randomFloat(float low, float high)
+{
+	return low + (high - low) * rand() / RAND_MAX;
+}
+
+// One random run of output pixels over a random frame
+struct Trial
+{
+	vector<unsigned char> frame;
+	Source src;
+	Params params;
+
+	int count;
+	vector<short> xy;
+	vector<unsigned short> fractions;
+	Map map;
+
+	// Random weights, 0 where the frame can't be sampled
+	vector<unsigned short> weights;
+
+	// The pixels that can be sampled, for warp
+	int framedCount;
+	vector<short> framedXy;
+	vector<unsigned short> framedFractions;
+	Map framedMap;
+
+	// Sums from earlier cameras, for accumulate to add to
+	vector<int> sums;
+
+	Trial()
+	{
+		src.cols = 3 + rand() % 60;
+		src.rows = 3 + rand() % 60;
+		src.step = 3 * src.cols + rand() % 8;
+		frame.resize(src.step * src.rows + Padding);
+		for (size_t i=0; i<frame.size(); i++)
+			frame[i] = (unsigned char)rand();
+		src.data = &frame[0];
+
+		params.interpolate = rand() % 2 == 0;
+		params.flat = rand() % 8 == 0;
+		for (int c=0; c<3; c++)
+		{
+			params.gain[c] = rand() % 2 ? GainOne : GainOne / 2 + rand() % (GainOne * 3 / 2);
+			params.tint[c] = rand() % 2 ? 0 : rand() % 256;
+		}
+
+		// Some pixels off each edge of the frame, and the odd NaN
+		count = 1 + rand() % 150;
+		vector<float> coords(2 * count);
+		for (int i=0; i<count; i++)
+		{
+			coords[2*i] = randomFloat(-3, float(src.cols + 3));
+			coords[2*i + 1] = randomFloat(-3, float(src.rows + 3));
+			if (rand() % 40 == 0)
+				coords[2*i] = numeric_limits<float>::quiet_NaN();
+		}
+
+		xy.resize(2 * (count + Padding));
+		fractions.resize(count + Padding);
+		packMap(&coords[0], count, &xy[0], &fractions[0]);
+		map.xy = &xy[0];
+		map.fractions = &fractions[0];
+
+		weights.assign(count + Padding, 0);
+		framedXy.assign(2 * (count + Padding), 0);
+		framedFractions.assign(count + Padding, 0);
+		framedCount = 0;
+
+		for (int i=0; i<count; i++)
+		{
+			float tX, tY;
+			unpackMap(&xy[2*i], fractions[i], tX, tY);
+			if (!inFrame(tX, tY, src.cols, src.rows, params.interpolate))
+				continue;
+
+			weights[i] = (unsigned short)(rand() % 3 ? WeightOne : rand() % WeightOne);
+
+			framedXy[2*framedCount] = xy[2*i];
+			framedXy[2*framedCount + 1] = xy[2*i + 1];
+			framedFractions[framedCount] = fractions[i];
+			framedCount++;
+		}
+		framedMap.xy = &framedXy[0];
+		framedMap.fractions = &framedFractions[0];
+
+		sums.assign(3 * (count + Padding), 0);
+		for (int i=0; i<3*count; i++)
+			sums[i] = rand() % 3 ? 0 : rand() % (64 * WeightOne);
+	}
+
+	Accumulator accumulator(vector<int>& s) const
+	{
+		Accumulator acc = { &s[0], &s[count + Padding], &s[2 * (count + Padding)] };
+		return acc;
+	}
+};
+
+static bool sameSums(const vector<int>& a, const vector<int>& b, int count)
+{
+	int stride = (int)a.size() / 3;
+	for (int c=0; c<3; c++)
+	{
+		if (memcmp(&a[c * stride], &b[c * stride], count * sizeof(int)) != 0)
+			return false;
+	}
+	return true;
+}
+
+// Checks isa's kernels against the scalar ones on one trial
+static void compareKernels(Isa simd, const Trial& trial)
+{
+	int count = trial.count;
+
+	// accumulate, through the dispatcher and specialized
+	vector<int> expected = trial.sums;
+	setIsa(Scalar);
+	accumulate(trial.src, trial.map, &trial.weights[0], count, trial.params, trial.accumulator(expected));
+
+	setIsa(simd);
+	vector<int> actual = trial.sums;
+	accumulate(trial.src, trial.map, &trial.weights[0], count, trial.params, trial.accumulator(actual));
+	CHECK(sameSums(expected, actual, count));
+
+	actual = trial.sums;
+	Specialized kernels = specialize(trial.params);
+	kernels.accumulate(trial.src, trial.map, &trial.weights[0], count, trial.params, trial.accumulator(actual));
+	CHECK(sameSums(expected, actual, count));
+
+	// resolve, from full sums and from the sums of other cameras alone
+	vector<unsigned char> expectedPixels(3 * (count + Padding)), actualPixels(3 * (count + Padding));
+	vector<int> sums[2] = { expected, trial.sums };
+	for (int s=0; s<2; s++)
+	{
+		setIsa(Scalar);
+		resolve(trial.accumulator(sums[s]), count, &expectedPixels[0]);
+		setIsa(simd);
+		resolve(trial.accumulator(sums[s]), count, &actualPixels[0]);
+		CHECK(memcmp(&expectedPixels[0], &actualPixels[0], 3 * count) == 0);
+	}
+
+	// warp, which must also match accumulating at full weight and resolving
+	int framed = trial.framedCount;
+	if (framed > 0)
+	{
+		vector<unsigned char> warped(3 * (framed + Padding));
+		setIsa(Scalar);
+		warp(trial.src, trial.framedMap, framed, trial.params, &expectedPixels[0]);
+
+		vector<int> single(3 * (framed + Padding), 0);
+		vector<unsigned short> ones(framed + Padding, (unsigned short)WeightOne);
+		Accumulator acc = { &single[0], &single[framed + Padding], &single[2 * (framed + Padding)] };
+		accumulate(trial.src, trial.framedMap, &ones[0], framed, trial.params, acc);
+		resolve(acc, framed, &warped[0]);
+		CHECK(memcmp(&expectedPixels[0], &warped[0], 3 * framed) == 0);
+
+		setIsa(simd);
+		warp(trial.src, trial.framedMap, framed, trial.params, &actualPixels[0]);
+		CHECK(memcmp(&expectedPixels[0], &actualPixels[0], 3 * framed) == 0);
+
+		specialize(trial.params).warp(trial.src, trial.framedMap, framed, trial.params, &actualPixels[0]);
+		CHECK(memcmp(&expectedPixels[0], &actualPixels[0], 3 * framed) == 0);
+	}
+
+	// packBgrx
+	vector<unsigned char> expectedBgrx(4 * (count + Padding)), actualBgrx(4 * (count + Padding));
+	setIsa(Scalar);
+	packBgrx(&trial.frame[0], count, &expectedBgrx[0]);
+	setIsa(simd);
+	packBgrx(&trial.frame[0], count, &actualBgrx[0]);
+	CHECK(memcmp(&expectedBgrx[0], &actualBgrx[0], 4 * count) == 0);
+}
+
+int testWarpKernels()
+{
+	int failedBefore = failures();
+	Isa original = isa();
+
+	// packBgrx writes B, G, R, 255
+	unsigned char bgr[6] = { 1, 2, 3, 4, 5, 6 };
+	unsigned char bgrx[8];
+	setIsa(Scalar);
+	packBgrx(bgr, 2, bgrx);
+	CHECK(bgrx[0] == 1 && bgrx[1] == 2 && bgrx[2] == 3 && bgrx[3] == 255);
+	CHECK(bgrx[4] == 4 && bgrx[5] == 5 && bgrx[6] == 6 && bgrx[7] == 255);
+
+	const Isa simds[] = { Sse41, Avx2, Avx512 };
+	const char* simdNames[] = { "SSE4.1", "AVX2", "AVX-512" };
+
+	for (int s=0; s<3; s++)
+	{
+		setIsa(simds[s]);
+		if (isa() != simds[s])
+		{
+			setIsa(Scalar);
+			cout << "  Skipping " << simdNames[s] << ", which this build or processor lacks." << endl;
+			continue;
+		}
+		cout << "  Comparing " << isaName() << " with the scalar kernels." << endl;
+
+		srand(s + 1);
+		for (int t=0; t<Trials; t++)
+			compareKernels(simds[s], Trial());
+	}
+
+	setIsa(original);
+
+	return failures() - failedBefore;
+}
@@ -0,0 +1,168 @@
+/*
+This file is part of StitcHD.
+
+StitcHD is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+StitcHD is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with StitcHD.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Tests.hpp"
+#include "Y4mWriter.hpp"
+#include "WarpKernels.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+using namespace std;
+
+#include <opencv2/core/core.hpp>
+using namespace cv;
+
+static bool near(int actual, int expected)
+{
+	return abs(actual - expected) <= 1;
+}
+
+// Converts one BGR colour filling a 2x2 block
+static void convert(int b, int g, int r, unsigned char& y, unsigned char& u, unsigned char& v)
+{
+	unsigned char bgr[6] = { b, g, r, b, g, r };
+	unsigned char luma[2][2];
+	WarpKernels::packI420(bgr, bgr, 2, luma[0], luma[1], &u, &v);
+	y = luma[1][1];
+}
+
+static void testPackI420()
+{
+	// BT.601 studio swing, to within a step of the textbook values
+	struct Colour { int b, g, r, y, u, v; };
+	const Colour colours[] =
+	{
+		{   0,   0,   0,  16, 128, 128 },
+		{ 255, 255, 255, 235, 128, 128 },
+		{   0,   0, 255,  81,  90, 240 },
+		{   0, 255,   0, 145,  54,  34 },
+		{ 255,   0,   0,  41, 240, 110 },
+		{ 128, 128, 128, 126, 128, 128 }
+	};
+
+	for (int i=0; i<sizeof(colours) / sizeof(colours[0]); i++)
+	{
+		const Colour& c = colours[i];
+		unsigned char y, u, v;
+		convert(c.b, c.g, c.r, y, u, v);
+		CHECK(near(y, c.y));
+		CHECK(near(u, c.u));
+		CHECK(near(v, c.v));
+	}
+
+	// Chroma averages each 2x2 block, and an odd last column counts twice
+	unsigned char top[9] = { 0, 0, 0, 255, 255, 255, 0, 0, 255 };
+	unsigned char bottom[9] = { 255, 255, 255, 0, 0, 0, 0, 0, 255 };
+	unsigned char yTop[3], yBottom[3], u[2], v[2];
+	WarpKernels::packI420(top, bottom, 3, yTop, yBottom, u, v);
+
+	unsigned char grey, greyU, greyV, red, redU, redV;
+	convert(128, 128, 128, grey, greyU, greyV);
+	convert(0, 0, 255, red, redU, redV);
+
+	CHECK(yTop[0] == 16 && yTop[1] == 235 && yTop[2] == red);
+	CHECK(yBottom[0] == 235 && yBottom[1] == 16 && yBottom[2] == red);
+	CHECK(u[0] == greyU && v[0] == greyV);
+	CHECK(u[1] == redU && v[1] == redV);
+}
+
+// Reads the whole file
+static string readFile(const string& fileName)
+{
+	ifstream file(fileName.c_str(), ios::in | ios::binary);
+	return string(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+}
+
+static void testFile()
+{
+	const string fileName = "StitcHDTests.y4m";
+
+	// Odd in both directions, so the last chroma row and column cover one pixel
+	const int width = 5, height = 3;
+	const int chromaWidth = 3, chromaHeight = 2;
+
+	Mat frame(height, width, CV_8UC3);
+	for (int r = 0; r < height; r++)
+		for (int c = 0; c < width; c++)
+			frame.at<Vec3b>(r, c) = Vec3b(uchar(40 * c), uchar(60 * r), uchar(200 - 30 * c));
+
+	Y4mWriter writer;
+	CHECK(writer.open(fileName, Size(width, height), 30));
+	CHECK(writer.frameSize() == Size(width, height));
+
+	int step = 0;
+	CHECK(Y4mWriter::pixelTarget(&writer, Size(width, height), step) == writer.frameBuffer());
+	CHECK(step == width);
+	CHECK(Y4mWriter::pixelTarget(&writer, Size(width + 1, height), step) == NULL);
+
+	writer.write(frame);
+
+	// A smaller frame is padded with black
+	Mat small(1, 2, CV_8UC3, Scalar(255, 255, 255));
+	writer.write(small);
+	writer.release();
+
+	string header = "YUV4MPEG2 W5 H3 F30:1 Ip A1:1 C420jpeg\n";
+	int planes = width * height + 2 * chromaWidth * chromaHeight;
+	string contents = readFile(fileName);
+	remove(fileName.c_str());
+
+	if (!CHECK(contents.size() == header.size() + 2 * (6 + planes)))
+		return;
+	CHECK(contents.compare(0, header.size(), header) == 0);
+
+	const unsigned char* first = (const unsigned char*)contents.data() + header.size();
+	CHECK(string((const char*)first, 6) == "FRAME\n");
+	first += 6;
+
+	// The planes, Y then U then V, match packI420 row pair by row pair,
+	// the last row paired with itself
+	const unsigned char* u = first + width * height;
+	const unsigned char* v = u + chromaWidth * chromaHeight;
+
+	for (int r = 0; r < height; r += 2)
+	{
+		int bottom = min(r + 1, height - 1);
+		unsigned char yTop[width], yBottom[width], uRow[chromaWidth], vRow[chromaWidth];
+		WarpKernels::packI420(frame.ptr(r), frame.ptr(bottom), width, yTop, yBottom, uRow, vRow);
+
+		CHECK(memcmp(first + r * width, yTop, width) == 0);
+		CHECK(memcmp(first + bottom * width, yBottom, width) == 0);
+		CHECK(memcmp(u + (r / 2) * chromaWidth, uRow, chromaWidth) == 0);
+		CHECK(memcmp(v + (r / 2) * chromaWidth, vRow, chromaWidth) == 0);
+	}
+
+	const unsigned char* second = first + planes;
+	CHECK(string((const char*)second, 6) == "FRAME\n");
+	second += 6;
+
+	CHECK(second[0] == 235 && second[1] == 235 && second[2] == 16);
+	CHECK(second[width] == 16 && second[width * height - 1] == 16);
+}
+
+int testY4mWriter()
+{
+	int failedBefore = failures();
+
+	testPackI420();
+	testFile();
+
+	return failures() - failedBefore;
+}
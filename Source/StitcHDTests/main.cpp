@@ -0,0 +1,63 @@
+/*
+This file is part of StitcHD.
+
+StitcHD is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+StitcHD is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with StitcHD.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Tests.hpp"
+
+#include <iostream>
+using namespace std;
+
+struct Suite
+{
+	const char* name;
+	int (*run)();
+};
+
+static const Suite suites[] =
+{
+	{ "WarpKernels", testWarpKernels },
+	{ "Y4mWriter", testY4mWriter },
+	{ "ChangeDetector", testChangeDetector },
+	{ "QualityGovernor", testQualityGovernor },
+	{ "StitchPlan", testStitchPlan }
+};
+
+int main(int argc, char** argv)
+{
+	int suiteCount = sizeof(suites) / sizeof(suites[0]);
+	int failedSuites = 0;
+
+	for (int i=0; i<suiteCount; i++)
+	{
+		cout << suites[i].name << "..." << endl;
+
+		int suiteFailures = suites[i].run();
+		if (suiteFailures > 0)
+		{
+			failedSuites++;
+			cout << suites[i].name << ": " << suiteFailures << " checks failed." << endl;
+		}
+	}
+
+	if (failures() > 0)
+	{
+		cout << failedSuites << " of " << suiteCount << " suites failed." << endl;
+		return 1;
+	}
+
+	cout << "All " << suiteCount << " suites passed." << endl;
+	return 0;
+}